@@ -0,0 +1,344 @@
+/**
+ * @file bench.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the load generator measuring the server
+ * @date 2024
+ *
+ */
+
+#include "bench.hpp"
+#include "../common/header/header.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+/**
+ * @brief The value below which the given fraction of the sorted values lie.
+ */
+double percentile(const vector<int64_t> &sorted, double fraction) {
+    if (sorted.empty()) return 0;
+    size_t index = min(sorted.size() - 1,
+                       static_cast<size_t>(fraction * sorted.size()));
+    return sorted[index];
+}
+
+const char *patternName(BenchPattern pattern) {
+    switch (pattern) {
+    case BenchPattern::FAN_IN:
+        return "fan-in";
+    case BenchPattern::FAN_OUT:
+        return "fan-out";
+    default:
+        return "pairs";
+    }
+}
+
+} // namespace
+
+// ### Constructors ###
+Bench::Client::Client(unsigned i)
+    : index(i),
+      decoder(CURRENT_VERSION, MAX_LENGTH_NICKNAME, MAX_LENGTH_MESSAGE) {}
+
+Bench::Bench(const BenchConfig &config) : config_(config) {}
+
+// ### Destructor ###
+Bench::~Bench() {
+    for (auto &client : clients_) {
+        if (client->fd != -1 and close(client->fd) != 0) perror("close");
+    }
+}
+
+// ### Private methods ###
+
+void *Bench::workerThreadFunc(void *arg) {
+    Worker *worker = static_cast<Worker *>(arg);
+    worker->bench->runWorker(*worker);
+    return nullptr;
+}
+
+void Bench::runWorker(Worker &worker) {
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        perror("epoll_create1");
+        return;
+    }
+    for (Client *client : worker.clients) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = client;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, client->fd, &event) != 0) {
+            perror("epoll_ctl");
+        }
+        client->nextSend = start_;
+    }
+
+    auto end = start_ + chrono::duration_cast<BenchClock::duration>(
+                            chrono::duration<double>(config_.duration));
+    auto interval =
+        config_.rate > 0
+            ? chrono::duration_cast<BenchClock::duration>(
+                  chrono::duration<double>(1 / config_.rate))
+            : BenchClock::duration::zero();
+    epoll_event events[64];
+
+    BenchClock::time_point now;
+    while ((now = BenchClock::now()) < end + BENCH_DRAIN_TIME) {
+        BenchClock::time_point wakeUp = end + BENCH_DRAIN_TIME;
+
+        if (now < end) {
+            for (Client *client : worker.clients) {
+                if (not isSender(*client)) continue;
+
+                // A sender the socket cannot keep up with falls behind
+                if (config_.rate > 0) {
+                    while (client->nextSend <= now
+                           and client->out.size() < BENCH_OUTPUT_LIMIT) {
+                        queueFrame(*client, worker);
+                        client->nextSend += interval;
+                    }
+                    wakeUp = min(wakeUp, client->nextSend);
+                } else if (client->out.empty()) {
+                    for (unsigned i = 0; i < BENCH_FLOOD_BATCH; ++i) {
+                        queueFrame(*client, worker);
+                    }
+                }
+                flush(*client);
+            }
+            if (config_.rate == 0) wakeUp = now;
+        }
+
+        auto timeout =
+            chrono::duration_cast<chrono::milliseconds>(wakeUp - now).count();
+        int numEvents =
+            epoll_wait(epollFd, events, 64, max<long>(0, timeout));
+        if (numEvents < 0 and errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < numEvents; ++i) {
+            Client *client = static_cast<Client *>(events[i].data.ptr);
+            if (events[i].events & EPOLLOUT) flush(*client);
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)
+                and not receive(*client, worker)) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, nullptr);
+            }
+        }
+    }
+
+    if (close(epollFd) != 0) perror("close");
+}
+
+string Bench::nickname(unsigned index) {
+    return "bench-" + to_string(index);
+}
+
+bool Bench::isSender(const Client &client) const {
+    switch (config_.pattern) {
+    case BenchPattern::FAN_IN:
+        return client.index != 0;
+    case BenchPattern::FAN_OUT:
+        return client.index == 0;
+    default:
+        return true;
+    }
+}
+
+void Bench::queueFrame(Client &client, Worker &worker) {
+    unsigned dest;
+    if (config_.pattern == BenchPattern::FAN_IN) {
+        dest = 0;
+    } else if (config_.pattern == BenchPattern::FAN_OUT) {
+        dest = 1 + client.nextDest;
+        client.nextDest = (client.nextDest + 1) % (config_.clients - 1);
+    } else {
+        dest = (client.index + 1) % config_.clients;
+    }
+    string destNickname = nickname(dest);
+
+    uniform_int_distribution<size_t> sizes(config_.minSize, config_.maxSize);
+    size_t messageSize = sizes(worker.random);
+    uint16_t totalSize =
+        sizeof(PacketHeader) + destNickname.size() + messageSize;
+    PacketHeader header{PROTOCOL_V1, htons(totalSize),
+                        static_cast<uint8_t>(destNickname.size())};
+
+    // Compacted only once written: the offset stays valid
+    if (client.outOffset == client.out.size()) {
+        client.out.clear();
+        client.outOffset = 0;
+    }
+    client.out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    client.out.append(destNickname);
+
+    int64_t sentAt = BenchClock::now().time_since_epoch().count();
+    client.out.append(reinterpret_cast<const char *>(&sentAt), sizeof(sentAt));
+    client.out.append(messageSize - BENCH_TIMESTAMP_SIZE, 'x');
+    ++worker.stats.sent;
+}
+
+bool Bench::flush(Client &client) {
+    while (client.outOffset < client.out.size()) {
+        ssize_t ret = send(client.fd, client.out.data() + client.outOffset,
+                           client.out.size() - client.outOffset, MSG_NOSIGNAL);
+        if (ret > 0) {
+            client.outOffset += ret;
+        } else if (ret < 0 and errno == EINTR) {
+            continue;
+        } else {
+            return ret < 0 and (errno == EAGAIN or errno == EWOULDBLOCK);
+        }
+    }
+    client.out.clear();
+    client.outOffset = 0;
+    return true;
+}
+
+bool Bench::receive(Client &client, Worker &worker) {
+    while (true) {
+        FrameView frame;
+        DecodeReturnVal ret;
+        while ((ret = client.decoder.next(frame))
+               == DecodeReturnVal::FRAME_READY) {
+            if (frame.nickname.empty()
+                or frame.message.size() < BENCH_TIMESTAMP_SIZE) {
+                ++worker.stats.notices;
+                continue;
+            }
+            int64_t sentAt;
+            memcpy(&sentAt, frame.message.data(), sizeof(sentAt));
+            worker.stats.latencies.push_back(
+                BenchClock::now().time_since_epoch().count() - sentAt);
+            ++worker.stats.received;
+            worker.stats.bytesReceived += frame.message.size();
+        }
+        if (ret != DecodeReturnVal::NEED_MORE) return false;
+
+        ssize_t bytesRead = client.decoder.fill(client.fd);
+        if (bytesRead > 0) continue;
+        if (bytesRead < 0 and errno == EINTR) continue;
+        if (bytesRead < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+            return true;
+        }
+        cerr << "Err: " << nickname(client.index) << " a été déconnecté."
+             << endl;
+        return false;
+    }
+}
+
+void Bench::report() const {
+    BenchStats total;
+    for (const Worker &worker : workers_) {
+        total.sent += worker.stats.sent;
+        total.received += worker.stats.received;
+        total.bytesReceived += worker.stats.bytesReceived;
+        total.notices += worker.stats.notices;
+        total.latencies.insert(total.latencies.end(),
+                               worker.stats.latencies.begin(),
+                               worker.stats.latencies.end());
+    }
+    sort(total.latencies.begin(), total.latencies.end());
+
+    auto toUs = [](double ns) { return ns / 1000; };
+    printf("{\"clients\": %u, \"threads\": %u, \"pattern\": \"%s\", "
+           "\"rate\": %g, \"duration_s\": %g, \"min_size\": %zu, "
+           "\"max_size\": %zu, \"sent\": %llu, \"received\": %llu, "
+           "\"notices\": %llu, \"throughput_msgs_s\": %.1f, "
+           "\"throughput_bytes_s\": %.1f, \"latency_us\": {\"p50\": %.1f, "
+           "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}}\n",
+           config_.clients, config_.threads, patternName(config_.pattern),
+           config_.rate, config_.duration, config_.minSize, config_.maxSize,
+           static_cast<unsigned long long>(total.sent),
+           static_cast<unsigned long long>(total.received),
+           static_cast<unsigned long long>(total.notices),
+           total.received / config_.duration,
+           total.bytesReceived / config_.duration,
+           toUs(percentile(total.latencies, 0.5)),
+           toUs(percentile(total.latencies, 0.99)),
+           toUs(percentile(total.latencies, 0.999)),
+           toUs(total.latencies.empty() ? 0 : total.latencies.back()));
+}
+
+// ### Public methods ###
+
+bool Bench::connectAll() {
+    for (unsigned i = 0; i < config_.clients; ++i) {
+        auto client = make_unique<Client>(i);
+        client->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (client->fd < 0
+            or connect(client->fd,
+                       reinterpret_cast<const sockaddr *>(&config_.server),
+                       sizeof(config_.server))
+                   != 0) {
+            cerr << "Err: Connexion " << i << " impossible - "
+                 << strerror(errno) << endl;
+            clients_.push_back(move(client));
+            return false;
+        }
+
+        // Handshake: the client's own nickname and an empty message
+        string name = nickname(i);
+        PacketHeader header{
+            PROTOCOL_V1,
+            htons(static_cast<uint16_t>(sizeof(PacketHeader) + name.size())),
+            static_cast<uint8_t>(name.size())};
+        string frame(reinterpret_cast<const char *>(&header), sizeof(header));
+        frame += name;
+        uint8_t response = 0;
+        if (send(client->fd, frame.data(), frame.size(), MSG_NOSIGNAL)
+                != static_cast<ssize_t>(frame.size())
+            or recv(client->fd, &response, 1, MSG_WAITALL) != 1
+            or response != 1) {
+            cerr << "Err: Le serveur a refusé " << name << "." << endl;
+            clients_.push_back(move(client));
+            return false;
+        }
+
+        int flags = fcntl(client->fd, F_GETFL);
+        fcntl(client->fd, F_SETFL, flags | O_NONBLOCK);
+        clients_.push_back(move(client));
+    }
+    return true;
+}
+
+int Bench::run() {
+    if ((config_.pattern != BenchPattern::PAIRS and config_.clients < 2)
+        or config_.clients < 1) {
+        cerr << "Err: Pas assez de clients pour ce schéma." << endl;
+        return 1;
+    }
+
+    workers_.resize(min(config_.threads, config_.clients));
+    for (size_t i = 0; i < clients_.size(); ++i) {
+        workers_[i % workers_.size()].clients.push_back(clients_[i].get());
+    }
+
+    start_ = BenchClock::now();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i].bench = this;
+        workers_[i].random.seed(i);
+        if (pthread_create(&workers_[i].thread, nullptr, workerThreadFunc,
+                           &workers_[i])
+            != 0) {
+            cerr << "Err: Impossible de créer le thread." << endl;
+            workers_[i].thread = 0;
+        }
+    }
+    for (Worker &worker : workers_) {
+        if (worker.thread != 0) pthread_join(worker.thread, nullptr);
+    }
+
+    report();
+    return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file bench.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the load generator measuring the server
+ * @date 2024
+ *
+ */
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include "../common/frame_decoder/frame_decoder.hpp"
+#include "../serveur/server.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+using BenchClock = chrono::steady_clock;
+
+constexpr size_t BENCH_TIMESTAMP_SIZE = sizeof(int64_t); //< Payload prefix
+constexpr size_t BENCH_OUTPUT_LIMIT = 64 * 1024; //< Unsent bytes per client
+constexpr unsigned BENCH_FLOOD_BATCH = 16; //< Frames per turn at full speed
+constexpr chrono::milliseconds BENCH_DRAIN_TIME(1000); //< After the last send
+
+/**
+ * @brief Who sends to whom.
+ */
+enum class BenchPattern {
+    PAIRS,   //< Every client sends to the next one (in a ring)
+    FAN_IN,  //< Every client but the first sends to the first
+    FAN_OUT, //< The first client sends to all the others in turn
+};
+
+/**
+ * @brief The parameters of a run.
+ */
+struct BenchConfig {
+    sockaddr_in server{};
+    unsigned clients = 10;
+    unsigned threads = 1;
+    double rate = 100;   //< Frames per second per sender (0: at full speed)
+    double duration = 5; //< Seconds of sending
+    BenchPattern pattern = BenchPattern::PAIRS;
+    size_t minSize = BENCH_TIMESTAMP_SIZE; //< Smallest payload
+    size_t maxSize = MAX_LENGTH_MESSAGE;   //< Largest payload
+};
+
+/**
+ * @brief What a worker thread measured.
+ */
+struct BenchStats {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t notices = 0;      //< Frames from the server itself (errors)
+    vector<int64_t> latencies; //< Nanoseconds, one per frame received
+};
+
+/**
+ * @class Bench
+ * @brief Opens many connections to the server and measures the throughput
+ * and the end-to-end latency of the frames they exchange.
+ *
+ * @details Each worker thread drives a share of the clients with its own
+ * epoll: senders follow a fixed schedule (or send as fast as their socket
+ * allows), and every payload starts with its send time, so the receiver
+ * computes the latency on arrival.
+ */
+class Bench {
+  private:
+    /**
+     * @brief One simulated client.
+     */
+    struct Client {
+        unsigned index;
+        int fd = -1;
+        FrameDecoder decoder;
+        string out; //< Frames not written yet
+        size_t outOffset = 0;
+        BenchClock::time_point nextSend;
+        unsigned nextDest = 0; //< FAN_OUT only
+
+        Client(unsigned i);
+    };
+
+    /**
+     * @brief A thread and the clients it drives.
+     */
+    struct Worker {
+        Bench *bench;
+        pthread_t thread = 0;
+        vector<Client *> clients;
+        mt19937 random;
+        BenchStats stats;
+    };
+
+    BenchConfig config_;
+    vector<unique_ptr<Client>> clients_;
+    vector<Worker> workers_;
+    BenchClock::time_point start_;
+
+    /**
+     * @brief Thread function running a worker.
+     *
+     * @param arg A pointer to the Worker object.
+     * @return void* Return a pointer to void.
+     */
+    static void *workerThreadFunc(void *arg);
+
+    /**
+     * @brief Send and receive until the end of the run.
+     */
+    void runWorker(Worker &worker);
+
+    /**
+     * @brief Nickname of the i-th client.
+     */
+    static string nickname(unsigned index);
+
+    /**
+     * @brief Whether the client sends frames with the configured pattern.
+     */
+    bool isSender(const Client &client) const;
+
+    /**
+     * @brief Append a frame with a random payload to the client's output.
+     */
+    void queueFrame(Client &client, Worker &worker);
+
+    /**
+     * @brief Write as much of the client's output as the socket accepts.
+     *
+     * @return bool False if the connection is broken.
+     */
+    bool flush(Client &client);
+
+    /**
+     * @brief Read the socket until it is drained and account for the frames.
+     *
+     * @return bool False if the connection is closed or broken.
+     */
+    bool receive(Client &client, Worker &worker);
+
+    /**
+     * @brief Print the merged statistics as JSON on the standard output.
+     */
+    void report() const;
+
+  public:
+    /**
+     * @brief Construct a new Bench object.
+     *
+     * @param config The parameters of the run.
+     */
+    explicit Bench(const BenchConfig &config);
+
+    /**
+     * @brief Destroy the Bench object, closing the connections.
+     */
+    ~Bench();
+
+    Bench(const Bench &) = delete;
+    Bench &operator=(const Bench &) = delete;
+
+    /**
+     * @brief Open and log on every connection.
+     *
+     * @return bool If the operation succeded
+     */
+    bool connectAll();
+
+    /**
+     * @brief Run the load and print the report.
+     *
+     * @return int The exit code.
+     */
+    int run();
+};
+
+#endif // BENCH_HPP
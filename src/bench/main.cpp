@@ -0,0 +1,97 @@
+/**
+ * @file main.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Main execution of the load generator
+ * @date 2024
+ *
+ */
+
+#include "bench.hpp"
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+void usage(const char *program) {
+    cerr << "Usage: " << program
+         << " [--clients N] [--threads N] [--rate N] [--duration S]"
+            " [--pattern pairs|fan-in|fan-out] [--min-size N]"
+            " [--max-size N]\n"
+            "Le serveur est désigné par IP_SERVEUR et PORT_SERVEUR."
+         << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    BenchConfig config;
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    config.threads = numCores > 0 ? numCores : 1;
+
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (i + 1 == argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char *value = argv[++i];
+
+        if (option == "--clients") {
+            config.clients = atoi(value);
+        } else if (option == "--threads") {
+            config.threads = atoi(value);
+        } else if (option == "--rate") {
+            config.rate = atof(value);
+        } else if (option == "--duration") {
+            config.duration = atof(value);
+        } else if (option == "--min-size") {
+            config.minSize = atoi(value);
+        } else if (option == "--max-size") {
+            config.maxSize = atoi(value);
+        } else if (option == "--pattern" and strcmp(value, "pairs") == 0) {
+            config.pattern = BenchPattern::PAIRS;
+        } else if (option == "--pattern" and strcmp(value, "fan-in") == 0) {
+            config.pattern = BenchPattern::FAN_IN;
+        } else if (option == "--pattern" and strcmp(value, "fan-out") == 0) {
+            config.pattern = BenchPattern::FAN_OUT;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.clients < 1 or config.threads < 1 or config.rate < 0
+        or config.duration <= 0 or config.minSize < BENCH_TIMESTAMP_SIZE
+        or config.maxSize > MAX_LENGTH_MESSAGE
+        or config.minSize > config.maxSize) {
+        cerr << "Err: Paramètres invalides (taille entre "
+             << BENCH_TIMESTAMP_SIZE << " et " << MAX_LENGTH_MESSAGE
+             << " octets)." << endl;
+        return 1;
+    }
+
+    // Same server address as the chat client
+    config.server.sin_family = AF_INET;
+    config.server.sin_port = htons(DEFAULT_PORT);
+    config.server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const char *ipEnv = getenv("IP_SERVEUR");
+    if (ipEnv and inet_pton(AF_INET, ipEnv, &config.server.sin_addr) != 1) {
+        cerr << "Err: Adresse IP invalide: " << ipEnv << endl;
+        return 1;
+    }
+    const char *portEnv = getenv("PORT_SERVEUR");
+    if (portEnv) {
+        int port = atoi(portEnv);
+        if (port > 1 and port < 65535) config.server.sin_port = htons(port);
+    }
+
+    Bench bench(config);
+    if (not bench.connectAll()) return 1;
+    return bench.run();
+}
@@ -18,9 +18,11 @@ using namespace std;
 
 void ArgParser::checkArgc() const {
     if (argc_ < 2) {
-        cerr << "chat pseudo_utilisateur [--bot] [--manuel]" << endl;
+        cerr << "chat pseudo_utilisateur [--bot] [--manuel] [--balise] "
+                "[--batch [fichier]]"
+             << endl;
         exit(1);
-    } else if (argc_ > 5) {
+    } else if (argc_ > 7) {
         cerr << "Err: Trop d'arguments donnés." << endl;
         exit(9);
     }
@@ -53,7 +55,8 @@ void ArgParser::checkName(const string &name) const {
 
 // #### Internal Setters ####
 
-void ArgParser::setFlag(const char *const flag) {
+void ArgParser::setFlag(int &index) {
+    const char *const flag = argv_[index];
     if (strcmp(flag, BOT_FLAG) == 0) {
         flags_.bot = true;
     } else if (strcmp(flag, MANUEL_FLAG) == 0) {
@@ -61,6 +64,12 @@ void ArgParser::setFlag(const char *const flag) {
     } else if (strcmp(flag, BALISE_FLAG) == 0) {
         flags_.balise = true;
 
+    } else if (strcmp(flag, BATCH_FLAG) == 0) {
+        flags_.batch = true;
+        // Followed by the file, if it is not another flag
+        if (index + 1 < argc_ and strncmp(argv_[index + 1], "--", 2) != 0) {
+            batchFile_ = argv_[++index];
+        }
     } else {
         cerr << "Err: L'argument '" + string{flag} + "' est inconnu." << endl;
         exit(13);
@@ -68,7 +77,7 @@ void ArgParser::setFlag(const char *const flag) {
 }
 
 void ArgParser::setFlags() {
-    for (int i = 2; i < argc_; i++) setFlag(argv_[i]);
+    for (int i = 2; i < argc_; i++) setFlag(i);
 }
 
 void ArgParser::setNames() {
@@ -90,3 +99,5 @@ ArgParser::~ArgParser() = default;
 const ChatFlags &ArgParser::getFlags() const noexcept { return flags_; }
 
 string ArgParser::getSpeaker() const noexcept { return speaker_; }
+
+string ArgParser::getBatchFile() const noexcept { return batchFile_; }
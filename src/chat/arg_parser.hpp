@@ -27,6 +27,7 @@ static constexpr int MAX_NAME_LENGTH =
 class ArgParser {
   private:
     string speaker_ = "speaker";
+    string batchFile_ = "-"; //< Of --batch, "-" for STDIN
     int argc_;
     char **argv_;
     ChatFlags flags_;
@@ -45,8 +46,11 @@ class ArgParser {
 
     /**
      * @brief Set the given flag or exit if it is invalid
+     *
+     * @param index The flag's index in argv, moved past its value if it
+     * takes one
      */
-    void setFlag(const char *const flag);
+    void setFlag(int &index);
 
     /**
      * @brief Set all the flags
@@ -62,7 +66,7 @@ class ArgParser {
     static constexpr array<const char, 4> INVALID_CHARS{'/', '-', '[', ']'};
     static constexpr array<const char *, 2> INVALID_NAMES{".", ".."};
     static constexpr char const *BOT_FLAG{"--bot"}, *MANUEL_FLAG{"--manuel"},
-        *BALISE_FLAG{"--balise"};
+        *BALISE_FLAG{"--balise"}, *BATCH_FLAG{"--batch"};
 
     // #### Constructors and destructor ####
 
@@ -95,6 +99,11 @@ class ArgParser {
      * @brief Get the speaker name
      */
     virtual string getSpeaker() const noexcept;
+
+    /**
+     * @brief Get the file of the --batch flag ("-" for STDIN)
+     */
+    virtual string getBatchFile() const noexcept;
 };
 
 #endif
@@ -8,23 +8,32 @@
  */
 
 #include "client.hpp"
-#include "../common/receive_message/receive_message.hpp"
+#include "../common/frame_decoder/frame_decoder.hpp"
 #include "../common/safe_read/safe_read.hpp"
+#include "../common/scan/scan.hpp"
 #include "../common/send_message/send_message.hpp"
 #include "../common/signal/mask.hpp"
 #include "arg_parser.hpp"
 #include "message_queue/message_queue.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
 #include <iostream>
 #include <memory.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <signal.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
 using namespace std;
 
@@ -33,12 +42,14 @@ volatile sig_atomic_t pipeFlag = 0, exitFlag = 0, termFlag = 0;
 
 // ### Constructor ###
 Client::Client(const ArgParser &args)
-    : flags_(args.getFlags()), nickname_(args.getSpeaker()) {};
+    : flags_(args.getFlags()), nickname_(args.getSpeaker()),
+      batchFile_(args.getBatchFile()) {};
 
 // ### Destructor ###
 Client::~Client() {
     logOut();
-    if (pthread_mutex_destroy(&printMtx_) != 0) {
+    if (pthread_mutex_destroy(&printMtx_) != 0
+        or pthread_mutex_destroy(&flushMtx_) != 0) {
         safePrint(Text("Err: échec de la destruction du mutex."), true);
     }
 }
@@ -82,9 +93,13 @@ bool Client::logOn() {
 
     connectionState_ = ConnectionState::Connecting;
 
+    // Always v1, so that any server reads it: the message is our highest
+    // version and our capabilities (a v1 client sends an empty message)
     const string &nickname = nickname_;
-    const string emptyMessage;
-    if (sendMessage(sockFd_, nickname, emptyMessage, CURRENT_VERSION)
+    const string versionMessage(
+        1, static_cast<char>(CURRENT_VERSION | CAP_NICKNAME_IDS
+                             | CAP_COMPRESSION));
+    if (sendMessage(sockFd_, nickname, versionMessage, PROTOCOL_V1)
         != SendMessageReturnVal::SUCCESS) {
         safePrint(Text("Err: Échec du serrage de main avec le serveur."), true);
         if (close(sockFd_) != 0) {
@@ -107,7 +122,10 @@ bool Client::logOn() {
         connectionState_ = ConnectionState::Disconnected;
         return false;
     }
-    if (response != 1) {
+    // The version the server speaks to us and the capabilities it accepted,
+    // or 0
+    uint8_t version = response & VERSION_MASK;
+    if (version == 0 or version > CURRENT_VERSION) {
         safePrint(Text("Err: Pseudonyme non-accepté par le serveur."), true);
         if (close(sockFd_) != 0) {
             perror("close");
@@ -115,6 +133,12 @@ bool Client::logOn() {
         connectionState_ = ConnectionState::Disconnected;
         return false;
     }
+    version_ = version;
+    nicknameIds_ = response & CAP_NICKNAME_IDS;
+    sentIds_.clear();
+    compressor_.reset(response & CAP_COMPRESSION
+                          ? new StreamCompressor(BUFFER_SIZE_MESSAGE)
+                          : nullptr);
     safePrint(Text("Session ouverte."), true);
 
     connectionState_ = ConnectionState::Connected;
@@ -122,19 +146,21 @@ bool Client::logOn() {
 }
 
 void Client::flushQueue() {
-    while (not queue_.empty()) {
-        const string &author = queue_.front().sender,
-                     &content = queue_.front().content;
-        safePrint(Text(author, content, flags_.bot, flags_.balise));
-        queue_.pop();
+    pthread_mutex_lock(&flushMtx_);
+    Message message;
+    while (queue_.pop(message)) {
+        output_.writeMessage(message.sender, message.content, flags_.bot,
+                             flags_.balise);
     }
+    pthread_mutex_unlock(&flushMtx_);
 }
 
-void Client::addToQueue(const Message &message) {
-    cout << "\a" << flush; //< Ring the bell
-    if (not queue_.push(message)) {
+void Client::addToQueue(string_view sender, string_view content) {
+    output_.write("\a"); //< Ring the bell
+    if (not queue_.push(sender, content)) {
         flushQueue();
-        safePrint({message.sender, message.content, flags_.bot, flags_.balise});
+        safePrint(
+            {string(sender), string(content), flags_.bot, flags_.balise});
     }
 }
 
@@ -150,6 +176,7 @@ void Client::logOut() {
         pthread_join(receiveThread_, nullptr);
         receiveThread_ = 0; //< Reinitialize the TID
     }
+    output_.stop(); //< Every message received is written
 
     if (close(sockFd_) < 0) {
         safePrint(Text("Err: Échec lors de la fermeture de la connexion."),
@@ -173,6 +200,10 @@ void Client::run() {
         exitCode_ = 5;
         return;
     }
+    if (not output_.start()) {
+        safePrint(Text("Err: Impossible de créer le thread d'affichage."),
+                  true);
+    }
 
     if (not setSigMask(false)) {
         exitCode_ = 9;
@@ -180,7 +211,8 @@ void Client::run() {
         return;
     }
 
-    sendMessages();
+    if (flags_.batch) sendBatch();
+    else sendMessages();
 }
 
 // ### Private methods ###
@@ -209,18 +241,72 @@ void Client::readIpConfig() {
 }
 
 void Client::receiveMessages() {
-    string nickname;
-    string message;
-
-    while (connectionState_ == ConnectionState::Connected
-           and receiveMessage(sockFd_, nickname, message, CURRENT_VERSION)
-                   == ReceiveMessageReturnVal::SUCCESS) {
-        if (nickname.empty())
-            safePrint(Text(message, flags_.balise),
-                      true); //< All server log are displayed on STDERR
-        else if (not flags_.manuel)
-            safePrint(Text(nickname, message, flags_.bot, flags_.balise));
-        else addToQueue(Message{nickname, message});
+    FrameDecoder decoder(version_, MAX_LENGTH_PSEUDO, BUFFER_SIZE_MESSAGE);
+    if (nicknameIds_) decoder.allowNicknameIds(MAX_NICKNAME_IDS);
+    if (compressor_ != nullptr) decoder.allowCompression();
+    FrameView frame;
+    // By sender, until the last one: a few at most, so searched in place
+    // rather than hashed into a key to allocate for every frame
+    struct Fragments {
+        string sender;
+        string gathered;
+    };
+    vector<Fragments> fragments;
+    string notice; //< The server's notices, formatted in it
+
+    while (connectionState_ == ConnectionState::Connected) {
+        DecodeReturnVal ret = decoder.next(frame);
+        if (ret == DecodeReturnVal::NEED_MORE) {
+            // Every frame already received is displayed before reading again
+            ssize_t bytesRead = decoder.fill(sockFd_);
+            if (bytesRead > 0 or (bytesRead < 0 and errno == EINTR)) continue;
+            if (bytesRead < 0) {
+                if (errno == ECONNRESET)
+                    cerr << "Err: L'autre partie a annulé la connexion."
+                         << endl;
+                else perror("read");
+            }
+            break;
+        } else if (ret != DecodeReturnVal::FRAME_READY) {
+            break;
+        }
+
+        // The fragments of a message are gathered, the rest is displayed
+        // straight from the decoder's buffer: no copy to allocate
+        string_view message = frame.message;
+        auto it = find_if(fragments.begin(), fragments.end(),
+                          [&](const Fragments &pending) {
+                              return pending.sender == frame.nickname;
+                          });
+        if (frame.more or it != fragments.end()) {
+            if (it == fragments.end()) {
+                fragments.push_back({string(frame.nickname), string()});
+                it = prev(fragments.end());
+            }
+            string &gathered = it->gathered;
+            if (gathered.size() + message.size() > MAX_REASSEMBLED_SIZE) {
+                safePrint(Text("Err: Message reçu trop long, ignoré."), true);
+                fragments.erase(it);
+                continue;
+            }
+            gathered += message;
+            if (frame.more) continue;
+            message = gathered;
+        }
+
+        if (frame.nickname.empty()) {
+            // All server log are displayed on STDERR
+            notice.clear();
+            if (flags_.balise) Text::formatTags(notice, message, false);
+            else notice += message;
+            safePrint(string_view(notice), true);
+        } else if (not flags_.manuel) {
+            output_.writeMessage(frame.nickname, message, flags_.bot,
+                                 flags_.balise);
+        } else {
+            addToQueue(frame.nickname, message);
+        }
+        if (it != fragments.end()) fragments.erase(it);
     }
 }
 
@@ -240,8 +326,7 @@ void Client::sendMessages() {
             string message = messageWithNickname.substr(spaceIndex + 1);
 
             if (nickname != nickname_
-                and sendMessage(sockFd_, nickname, message, CURRENT_VERSION)
-                        != SendMessageReturnVal::SUCCESS) {
+                and not sendFragmented(nickname, message)) {
                 safePrint(Text("Err: Le message n'a pas été envoyé."), true);
             } else {
                 if (not flags_.bot)
@@ -254,10 +339,210 @@ void Client::sendMessages() {
     }
 }
 
+void Client::sendBatch() {
+    int fd = STDIN_FILENO;
+    if (batchFile_ != "-") {
+        fd = open(batchFile_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            safePrint(Text("Err: Impossible d'ouvrir le fichier '" + batchFile_
+                           + "'."),
+                      true);
+            exitCode_ = 14;
+            logOut();
+            return;
+        }
+    }
+
+    uint64_t sent = 0, sentBytes = 0;
+    auto start = chrono::steady_clock::now();
+    batching_ = true;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 and S_ISREG(st.st_mode) and st.st_size > 0) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (map != MAP_FAILED) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        sendBatchLines(string_view(static_cast<const char *>(map), st.st_size),
+                       true, sent, sentBytes);
+        munmap(map, st.st_size);
+    } else {
+        // The incomplete last line stays at the front of the buffer
+        string buffer;
+        size_t pending = 0;
+        while (connectionState_ == ConnectionState::Connected) {
+            buffer.resize(pending + BATCH_READ_SIZE);
+            ssize_t bytesRead = read(fd, &buffer[pending], BATCH_READ_SIZE);
+            if (bytesRead < 0 and errno == EINTR) {
+                if (exitFlag or termFlag or pipeFlag) break;
+                continue;
+            } else if (bytesRead < 0) {
+                perror("read");
+                break;
+            }
+            size_t size = pending + bytesRead;
+            size_t parsed = sendBatchLines(string_view(buffer.data(), size),
+                                           bytesRead == 0, sent, sentBytes);
+            if (bytesRead == 0 or not flushBatch()) break;
+            pending = size - parsed;
+            buffer.erase(0, parsed);
+        }
+    }
+    flushBatch();
+    batching_ = false;
+    if (fd != STDIN_FILENO and close(fd) != 0) {
+        perror("close");
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now()
+                                              - start)
+                         .count();
+    char report[160];
+    snprintf(report, sizeof(report),
+             "Lot envoyé : %llu messages (%.1f Mo) en %.3f s, %.0f "
+             "messages/s, %.1f Mo/s.",
+             static_cast<unsigned long long>(sent), sentBytes / 1e6, seconds,
+             sent / max(seconds, 1e-9), sentBytes / 1e6 / max(seconds, 1e-9));
+    safePrint(Text(report), true);
+
+    handleSignalsSafely(true);
+}
+
+size_t Client::sendBatchLines(string_view data, bool last, uint64_t &sent,
+                              uint64_t &sentBytes) {
+    string nickname;
+    size_t pos = 0;
+    while (pos < data.size()
+           and connectionState_ == ConnectionState::Connected
+           and not(exitFlag or termFlag or pipeFlag)) {
+        size_t end = data.find('\n', pos);
+        if (end == string_view::npos) {
+            if (not last) break;
+            end = data.size();
+        }
+        string_view line = data.substr(pos, end - pos);
+        pos = min(end + 1, data.size());
+
+        // Same parsing as sendMessages, without copying the message
+        size_t spaceIndex = line.find(' ');
+        if (spaceIndex == string_view::npos) continue;
+        nickname.assign(line.data(), spaceIndex);
+        removeHyphens(nickname);
+        string_view message = line.substr(spaceIndex + 1);
+        if (nickname == nickname_) continue;
+
+        if (sendFragmented(nickname, message)) {
+            ++sent;
+            sentBytes += message.size();
+        } else if (connectionState_ == ConnectionState::Connected) {
+            safePrint(Text("Err: Le message n'a pas été envoyé."), true);
+        }
+    }
+    return pos;
+}
+
+bool Client::flushBatch() {
+    const char *data = batchOut_.data();
+    size_t left = batchOut_.size();
+    while (left > 0) {
+        ssize_t written = write(sockFd_, data, left);
+        if (written < 0 and errno == EINTR) continue;
+        if (written < 0) {
+            if (errno == EPIPE)
+                cerr << "Err: L'autre partie a cassé la connexion pendant "
+                        "l'écriture"
+                     << endl;
+            else perror("write");
+            batchOut_.clear();
+            logOut();
+            return false;
+        }
+        data += written;
+        left -= written;
+    }
+    batchOut_.clear();
+    return true;
+}
+
+bool Client::sendFrame(const string &nickname, string_view message,
+                       uint8_t flags) {
+    // The first frame to a recipient binds it to an id, the next ones only
+    // carry the id
+    uint32_t id = 0;
+    if (nicknameIds_ and not nickname.empty()) {
+        auto it = sentIds_.find(nickname);
+        if (it != sentIds_.end()) {
+            id = it->second;
+            flags |= FRAME_NICKNAME_ID;
+        } else if (sentIds_.size() < MAX_CLIENT_NICKNAME_IDS) {
+            id = sentIds_.size();
+            flags |= FRAME_NICKNAME_BIND;
+        }
+    }
+
+    char compressed[BUFFER_SIZE_MESSAGE];
+    if (compressor_ != nullptr and message.size() <= sizeof(compressed)) {
+        size_t size = compressor_->compress(message, compressed);
+        if (size > 0) {
+            message = string_view(compressed, size);
+            flags |= FRAME_COMPRESSED;
+        }
+    }
+
+    if (batching_) {
+        appendMessage(batchOut_, nickname, message, version_, flags, id);
+        if (batchOut_.size() >= BATCH_WRITE_SIZE and not flushBatch()) {
+            return false;
+        }
+    } else if (sendMessage(sockFd_, nickname, message, version_, flags, id)
+               != SendMessageReturnVal::SUCCESS) {
+        return false;
+    }
+    if (flags & FRAME_NICKNAME_BIND) sentIds_.emplace(nickname, id);
+    return true;
+}
+
+bool Client::sendFragmented(const string &nickname, string_view message) {
+    if (version_ < PROTOCOL_V2 or message.size() <= BUFFER_SIZE_MESSAGE) {
+        return sendFrame(nickname, message);
+    }
+    if (message.size() > MAX_REASSEMBLED_SIZE) {
+        safePrint(Text("Err: Message trop long."), true);
+        return false;
+    }
+
+    // Each fragment is a frame of its own: the server relays the other
+    // messages between them
+    while (message.size() > BUFFER_SIZE_MESSAGE) {
+        size_t size = BUFFER_SIZE_MESSAGE;
+        while (size > 0 and (message[size] & 0xc0) == 0x80) --size;
+        if (size == 0) size = BUFFER_SIZE_MESSAGE;
+        if (not sendFrame(nickname, message.substr(0, size), FRAME_MORE)) {
+            return false;
+        }
+        message.remove_prefix(size);
+    }
+    return sendFrame(nickname, message);
+}
+
+void Client::safePrint(string_view content, bool onSTDERR) {
+    if (not onSTDERR) {
+        output_.writeLine(content);
+        return;
+    }
+    pthread_mutex_lock(&printMtx_);
+    cerr << content << endl;
+    pthread_mutex_unlock(&printMtx_);
+}
+
 void Client::safePrint(const Text &msg, bool onSTDERR) {
+    if (not onSTDERR) {
+        output_.writeLine(msg.out());
+        return;
+    }
     pthread_mutex_lock(&printMtx_);
-    if (onSTDERR) cerr << msg << endl;
-    else cout << msg << endl;
+    cerr << msg << endl;
     pthread_mutex_unlock(&printMtx_);
 }
 
@@ -316,6 +601,5 @@ ConnectionState Client::getState() const { return connectionState_; }
 int Client::getExitCode() const { return exitCode_; }
 
 void Client::removeHyphens(string &txt) {
-    for (char &chr : txt)
-        if (chr == '-') chr = ' ';
+    replaceByte(txt.data(), txt.size(), '-', ' ');
 }
@@ -9,26 +9,35 @@
 #ifndef CLIENT_HPP
 #define CLIENT_HPP
 
+#include "../common/compression/compression.hpp"
+#include "../common/header/header.hpp"
 #include "arg_parser.hpp"
 #include "flags.hpp"
 #include "message_queue/message_queue.hpp"
+#include "output_writer/output_writer.hpp"
 #include "text.hpp"
 
 #include <arpa/inet.h>
 #include <atomic>
 #include <csignal>
 #include <memory.h>
+#include <memory>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <string>
+#include <string_view>
 #include <unistd.h>
+#include <unordered_map>
 
 using namespace std;
 
 constexpr int DEFAULT_PORT = 1234;        // Default port
 constexpr int BUFFER_SIZE_MESSAGE = 1024; // Buffer size for the message
 constexpr int MAX_LENGTH_PSEUDO = 30;     // Max length of the pseudo
-constexpr uint8_t CURRENT_VERSION = 1;
+constexpr uint8_t CURRENT_VERSION = PROTOCOL_V2; // Highest version spoken
+constexpr size_t MAX_REASSEMBLED_SIZE = 1024 * 1024; // Fragmented message
+constexpr size_t BATCH_WRITE_SIZE = 64 * 1024; // Frames coalesced by --batch
+constexpr size_t BATCH_READ_SIZE = 64 * 1024;  // Read at once from a pipe
 
 enum class ConnectionState {
     Disconnected, // before the call to connect() or after logOut()
@@ -42,9 +51,18 @@ class Client {
     sockaddr_in serverAddrIn_;
     const ChatFlags &flags_;
     pthread_t receiveThread_ = 0;
-    pthread_mutex_t printMtx_ = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t printMtx_ = PTHREAD_MUTEX_INITIALIZER; //< STDERR
+    OutputWriter output_{STDOUT_FILENO};
+    pthread_mutex_t flushMtx_ = PTHREAD_MUTEX_INITIALIZER; //< Queue consumers
     atomic<ConnectionState> connectionState_ = ConnectionState::Disconnected;
     string nickname_;
+    uint8_t version_ = PROTOCOL_V1; //< Negotiated with the server
+    bool nicknameIds_ = false;      //< Negotiated CAP_NICKNAME_IDS
+    unordered_map<string, uint32_t> sentIds_; //< Bound by sendFrame
+    unique_ptr<StreamCompressor> compressor_;  //< If CAP_COMPRESSION
+    string batchFile_;                        //< Of --batch
+    bool batching_ = false; //< Frames appended to batchOut_, not sent
+    string batchOut_;
     MessageQueue queue_;
     atomic<int> exitCode_ = 0;
 
@@ -63,15 +81,81 @@ class Client {
      */
     void sendMessages();
 
+    /**
+     * @brief Send the messages of the --batch file ("dest message" lines),
+     * then log out.
+     *
+     * @details A regular file is mapped, a pipe read BATCH_READ_SIZE bytes
+     * at a time: the lines are parsed in place and their frames coalesced
+     * into writes of BATCH_WRITE_SIZE bytes (and at the end of every read,
+     * for the messages to leave as they are streamed). The sent messages are
+     * not displayed; the throughput is, on STDERR.
+     */
+    void sendBatch();
+
+    /**
+     * @brief Send the complete lines of a --batch chunk.
+     *
+     * @param data The chunk.
+     * @param last If the chunk ends the input (its last line may then lack a
+     * newline).
+     * @param sent Incremented by the number of messages sent.
+     * @param sentBytes Incremented by their size.
+     *
+     * @return size_t The size of the lines parsed.
+     */
+    size_t sendBatchLines(string_view data, bool last, uint64_t &sent,
+                          uint64_t &sentBytes);
+
+    /**
+     * @brief Write the frames of batchOut_, logging out if it fails.
+     *
+     * @return bool If they were written.
+     */
+    bool flushBatch();
+
+    /**
+     * @brief Send a message, in fragments of BUFFER_SIZE_MESSAGE bytes if it
+     * is longer and the server speaks v2 (a v1 server rejects it).
+     *
+     * @note Fragments end on a UTF-8 character boundary, so that a v1 client
+     * receiving them as separate messages can still display each of them.
+     *
+     * @param nickname The recipient's nickname.
+     * @param message The message.
+     *
+     * @return bool If every fragment was sent.
+     */
+    bool sendFragmented(const string &nickname, string_view message);
+
+    /**
+     * @brief Send a frame, naming the recipient by its id once bound and
+     * compressing the message when it pays off.
+     *
+     * @param nickname The recipient's nickname.
+     * @param message The message.
+     * @param flags The v2 flags.
+     *
+     * @return bool If the frame was sent.
+     */
+    bool sendFrame(const string &nickname, string_view message,
+                   uint8_t flags = 0);
+
     /**
      * @brief Safely print a string on STDOUT on one line
-     * @details Prevent concurrency between threads
+     * @details Prevent concurrency between threads. STDOUT goes through
+     * output_, which only writes at once on a TTY.
      *
      * @param content The content
      * @param onSTDERR If the text is printed on STDERR
      */
     void safePrint(const Text &content, bool onSTDERR = false);
 
+    /**
+     * @brief Same, for a text already formatted.
+     */
+    void safePrint(string_view content, bool onSTDERR = false);
+
     // ### Thread Function ###
 
     /**
@@ -109,15 +193,20 @@ class Client {
 
     /**
      * @brief Print the content of and empty the message queue.
+     *
+     * @note Both threads may flush: they take turns, while the receiving
+     * thread keeps pushing without waiting.
      */
     void flushQueue();
 
     /**
-     * @brief Add a new message in the message queue.
+     * @brief Add a new message in the message queue, or print it after the
+     * queued ones if the queue is full.
      *
-     * @param message The message
+     * @param sender The sender's nickname
+     * @param content The message
      */
-    void addToQueue(const Message &message);
+    void addToQueue(string_view sender, string_view content);
 
     /**
      * @brief Edit a text and remove all "-" characters
@@ -8,9 +8,11 @@
 
 #include "flags.hpp"
 
-ChatFlags::ChatFlags(bool b, bool m, bool ba) : bot(b), manuel(m), balise(ba) {}
+ChatFlags::ChatFlags(bool b, bool m, bool ba, bool bt)
+    : bot(b), manuel(m), balise(ba), batch(bt) {}
 
 bool ChatFlags::operator==(const ChatFlags &other) const noexcept {
     return (this->bot == other.bot) and (this->manuel == other.manuel)
-           and (this->balise == other.balise);
+           and (this->balise == other.balise)
+           and (this->batch == other.batch);
 }
\ No newline at end of file
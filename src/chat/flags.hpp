@@ -17,7 +17,7 @@ using namespace std;
  *
  */
 struct ChatFlags {
-    atomic_bool bot, manuel, balise;
+    atomic_bool bot, manuel, balise, batch;
 
     // #### Constructor: ####
 
@@ -27,9 +27,11 @@ struct ChatFlags {
      * @param b The --bot flag
      * @param m  The --manuel flag
      * @param ba The --balise flag
+     * @param bt The --batch flag
      *
      */
-    ChatFlags(bool b = false, bool m = false, bool ba = false);
+    ChatFlags(bool b = false, bool m = false, bool ba = false,
+              bool bt = false);
 
     /**
      * @brief The equality operator
@@ -8,65 +8,81 @@
 
 #include "message_queue.hpp"
 
-bool MessageQueue::push(const Message &message) {
-    size_t newMessageSize = message.sender.size() + message.content.size()
-                            + 2; // +2 for the null-terminator
-
-    pthread_mutex_lock(&mutex_);
-    bool enoughSpace = (numBytes_ + newMessageSize < MAX_QUEUE_SIZE);
-    if (enoughSpace) {
-        queue_.push(message);
-        numBytes_ += newMessageSize;
+#include <algorithm>
+#include <cstring>
+
+void MessageQueue::copyIn(size_t position, const void *data, size_t size) {
+    if (size == 0) return; //< data may be null
+    size_t index = position & (MAX_QUEUE_SIZE - 1);
+    size_t first = min(size, MAX_QUEUE_SIZE - index);
+    memcpy(ring_ + index, data, first);
+    if (first < size) { //< Wraps around the end
+        memcpy(ring_, static_cast<const char *>(data) + first, size - first);
     }
-    pthread_mutex_unlock(&mutex_);
-    return enoughSpace;
 }
 
-bool MessageQueue::push(const string &sender, const string &messageContent) {
-    Message message{sender, messageContent};
-    return push(message);
+void MessageQueue::copyOut(size_t position, void *data, size_t size) const {
+    if (size == 0) return; //< data may be null
+    size_t index = position & (MAX_QUEUE_SIZE - 1);
+    size_t first = min(size, MAX_QUEUE_SIZE - index);
+    memcpy(data, ring_ + index, first);
+    if (first < size) { //< Wraps around the end
+        memcpy(static_cast<char *>(data) + first, ring_, size - first);
+    }
 }
 
-unsigned MessageQueue::getNumBytes() {
-    pthread_mutex_lock(&mutex_);
-
-    unsigned numBytes = numBytes_;
-
-    pthread_mutex_unlock(&mutex_);
-
-    return numBytes;
+bool MessageQueue::push(const Message &message) {
+    return push(message.sender, message.content);
 }
 
-const Message &MessageQueue::front() {
-    pthread_mutex_lock(&mutex_);
+bool MessageQueue::push(string_view sender, string_view messageContent) {
+    size_t newMessageSize =
+        sizeof(Record) + sender.size() + messageContent.size();
+    if (sender.size() > UINT16_MAX or messageContent.size() > UINT16_MAX) {
+        return false;
+    }
 
-    Message &message = queue_.front();
+    // Acquire: the consumer is done with the bytes before head_
+    size_t tail = tail_.load(memory_order_relaxed);
+    size_t head = head_.load(memory_order_acquire);
+    if (tail - head + newMessageSize > MAX_QUEUE_SIZE) return false;
 
-    pthread_mutex_unlock(&mutex_);
+    Record record{static_cast<uint16_t>(sender.size()),
+                  static_cast<uint16_t>(messageContent.size())};
+    copyIn(tail, &record, sizeof(record));
+    copyIn(tail + sizeof(record), sender.data(), sender.size());
+    copyIn(tail + sizeof(record) + sender.size(), messageContent.data(),
+           messageContent.size());
 
-    return message;
+    tail_.store(tail + newMessageSize, memory_order_release);
+    return true;
 }
 
-void MessageQueue::pop() {
-    pthread_mutex_lock(&mutex_);
-
-    if (!queue_.empty()) {
-        size_t poppedMessageSize = queue_.front().sender.size()
-                                   + queue_.front().content.size()
-                                   + 2; // +2 for the null-terminator
-        queue_.pop();
-        numBytes_ -= poppedMessageSize;
-    }
-
-    pthread_mutex_unlock(&mutex_);
+unsigned MessageQueue::getNumBytes() const {
+    size_t head = head_.load(memory_order_acquire);
+    return tail_.load(memory_order_acquire) - head;
 }
 
-bool MessageQueue::empty() {
-    pthread_mutex_lock(&mutex_);
-
-    bool isEmpty = queue_.empty();
-
-    pthread_mutex_unlock(&mutex_);
+bool MessageQueue::pop(Message &message) {
+    // Acquire: the producer wrote the bytes before tail_
+    size_t head = head_.load(memory_order_relaxed);
+    size_t tail = tail_.load(memory_order_acquire);
+    if (head == tail) return false;
+
+    Record record;
+    copyOut(head, &record, sizeof(record));
+    message.sender.resize(record.senderSize);
+    message.content.resize(record.contentSize);
+    copyOut(head + sizeof(record), message.sender.data(), record.senderSize);
+    copyOut(head + sizeof(record) + record.senderSize, message.content.data(),
+            record.contentSize);
+
+    head_.store(head + sizeof(record) + record.senderSize + record.contentSize,
+                memory_order_release);
+    return true;
+}
 
-    return isEmpty;
+bool MessageQueue::empty() const {
+    return head_.load(memory_order_acquire)
+           == tail_.load(memory_order_acquire);
 }
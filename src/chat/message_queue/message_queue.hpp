@@ -9,9 +9,11 @@
 #ifndef MESSAGE_QUEUE_HPP
 #define MESSAGE_QUEUE_HPP
 
-#include <pthread.h>
-#include <queue>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 using namespace std;
 
@@ -24,14 +26,42 @@ struct Message {
 
 /**
  * @class MessageQueue
- * @brief Store messages in FIFO order thread-safely.
+ * @brief Store messages in FIFO order, without locks nor allocations.
+ *
+ * @details A ring of MAX_QUEUE_SIZE bytes where every message is stored inline
+ * as [sender size][content size][sender][content]. The positions only ever
+ * grow; the producer alone writes tail_ and the consumer alone writes head_,
+ * so each side publishes its progress with a single release store.
+ *
+ * @note One thread may push and one thread may pop at the same time; several
+ * consumers must take turns.
  */
 class MessageQueue {
+  public:
+    static constexpr size_t MAX_QUEUE_SIZE = 4096; //< A power of two
+
   private:
-    queue<Message> queue_;
-    unsigned numBytes_ = 0; // the number of bytes enqueued
-    pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
-    static constexpr unsigned MAX_QUEUE_SIZE = 4096;
+    /**
+     * @brief The header of a message in the ring.
+     */
+    struct Record {
+        uint16_t senderSize;
+        uint16_t contentSize;
+    };
+
+    alignas(64) atomic<size_t> head_ = 0; //< Next byte to pop (consumer)
+    alignas(64) atomic<size_t> tail_ = 0; //< Next byte to push (producer)
+    alignas(64) char ring_[MAX_QUEUE_SIZE];
+
+    /**
+     * @brief Copy bytes into the ring, wrapping around its end.
+     */
+    void copyIn(size_t position, const void *data, size_t size);
+
+    /**
+     * @brief Copy bytes out of the ring, wrapping around its end.
+     */
+    void copyOut(size_t position, void *data, size_t size) const;
 
   public:
     /**
@@ -46,44 +76,47 @@ class MessageQueue {
      */
     ~MessageQueue() = default;
 
+    MessageQueue(const MessageQueue &) = delete;
+    MessageQueue &operator=(const MessageQueue &) = delete;
+
     /**
-     * @brief Push the given message in the queue.
+     * @brief Push the given message in the queue (producer).
      *
      * @param message The message to be pushed.
+     *
+     * @return bool False if the queue is too full to take it.
      */
     bool push(const Message &message);
 
     /**
-     * @brief Push the given message in the queue.
+     * @brief Push the given message in the queue (producer).
      *
      * @param sender The sender's nickname.
      * @param messageContent The content of the message.
+     *
+     * @return bool False if the queue is too full to take it.
      */
-    bool push(const string &sender, const string &messageContent);
+    bool push(string_view sender, string_view messageContent);
 
     /**
      * @brief Return the number of enqueued bytes.
      */
-    unsigned getNumBytes();
+    unsigned getNumBytes() const;
 
     /**
-     * @brief Retrieve the message at the front of the queue without removing
-     * it.
-     */
-    const Message &front();
-
-    /**
-     * @brief Remove the message at the front of the queue.
+     * @brief Remove the message at the front of the queue (consumer).
+     *
+     * @param message Receives the message; its strings are reused, so popping
+     * into the same one does not allocate once it is large enough.
      *
-     * @note The behavior is undefined if the queue is empty. Ensure the queue
-     * is not empty before calling this function.
+     * @return bool False if the queue is empty.
      */
-    void pop();
+    bool pop(Message &message);
 
     /**
      * @brief Check whether the queue is empty.
      */
-    bool empty();
+    bool empty() const;
 };
 
 #endif
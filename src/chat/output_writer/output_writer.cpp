@@ -0,0 +1,176 @@
+/**
+ * @file output_writer.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file of the OutputWriter class
+ * @date 2024
+ *
+ */
+
+#include "output_writer.hpp"
+#include "../text.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <pthread.h>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+OutputWriter::OutputWriter(int fd) : fd_(fd), immediate_(isatty(fd)) {
+    // The latency is measured on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pendingCond_, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&drainedCond_, nullptr);
+}
+
+OutputWriter::~OutputWriter() {
+    stop();
+    pthread_cond_destroy(&pendingCond_);
+    pthread_cond_destroy(&drainedCond_);
+    pthread_mutex_destroy(&mtx_);
+}
+
+bool OutputWriter::start() {
+    if (immediate_ or thread_ != 0) return true;
+    pthread_t thread;
+    // Swapped at every write: both hold a full buffer, whatever its texts
+    pending_.reserve(OUTPUT_MAX_SIZE + OUTPUT_FLUSH_SIZE);
+    writing_.reserve(OUTPUT_MAX_SIZE + OUTPUT_FLUSH_SIZE);
+    if (pthread_create(&thread, nullptr, runThreadFunc, this) != 0) {
+        return false;
+    }
+    pthread_mutex_lock(&mtx_);
+    thread_ = thread;
+    pthread_mutex_unlock(&mtx_);
+    return true;
+}
+
+void OutputWriter::stop() {
+    pthread_mutex_lock(&mtx_);
+    pthread_t thread = thread_;
+    stopping_ = true;
+    pthread_cond_signal(&pendingCond_);
+    pthread_mutex_unlock(&mtx_);
+    if (thread != 0) pthread_join(thread, nullptr);
+
+    // What was written while the thread was exiting
+    pthread_mutex_lock(&mtx_);
+    thread_ = 0;
+    stopping_ = false;
+    if (not pending_.empty() and not failed_) {
+        failed_ = not writeAll(pending_.data(), pending_.size());
+    }
+    pending_.clear();
+    pthread_cond_broadcast(&drainedCond_);
+    pthread_mutex_unlock(&mtx_);
+}
+
+template <typename Fill> void OutputWriter::append(Fill fill) {
+    pthread_mutex_lock(&mtx_);
+    if (thread_ == 0) {
+        if (not failed_) {
+            line_.clear();
+            fill(line_);
+            failed_ = not writeAll(line_.data(), line_.size());
+        }
+        pthread_mutex_unlock(&mtx_);
+        return;
+    }
+
+    while (pending_.size() >= OUTPUT_MAX_SIZE and not failed_) {
+        pthread_cond_wait(&drainedCond_, &mtx_);
+    }
+    if (not failed_) {
+        // The thread waits for the first text, then for a full buffer
+        bool wasEmpty = pending_.empty();
+        fill(pending_);
+        if (wasEmpty or pending_.size() >= OUTPUT_FLUSH_SIZE) {
+            pthread_cond_signal(&pendingCond_);
+        }
+    }
+    pthread_mutex_unlock(&mtx_);
+}
+
+void OutputWriter::write(string_view text) {
+    append([&](string &out) { out += text; });
+}
+
+void OutputWriter::writeLine(string_view line) {
+    append([&](string &out) {
+        out += line;
+        out += '\n';
+    });
+}
+
+void OutputWriter::writeMessage(string_view nickname, string_view message,
+                                bool bot, bool balise) {
+    append([&](string &out) {
+        Text::format(out, nickname, message, bot, balise);
+        out += '\n';
+    });
+}
+
+bool OutputWriter::writeAll(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd_, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EPIPE) perror("write");
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+void OutputWriter::run() {
+    pthread_mutex_lock(&mtx_);
+    while (true) {
+        while (pending_.empty() and not stopping_) {
+            pthread_cond_wait(&pendingCond_, &mtx_);
+        }
+        if (pending_.empty()) break; //< Stopping, all written
+
+        // The first text waits at most OUTPUT_LATENCY_NS for the next ones
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += OUTPUT_LATENCY_NS;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (pending_.size() < OUTPUT_FLUSH_SIZE and not stopping_
+               and pthread_cond_timedwait(&pendingCond_, &mtx_, &deadline)
+                       != ETIMEDOUT) {
+        }
+
+        writing_.swap(pending_);
+        pthread_cond_broadcast(&drainedCond_);
+        pthread_mutex_unlock(&mtx_);
+        bool written = writeAll(writing_.data(), writing_.size());
+        writing_.clear();
+        pthread_mutex_lock(&mtx_);
+
+        if (not written and not failed_) {
+            // Signals are blocked here: the main thread handles it, as it
+            // would have if it had written itself
+            failed_ = true;
+            pending_.clear();
+            pthread_cond_broadcast(&drainedCond_);
+            kill(getpid(), SIGPIPE);
+        }
+    }
+    pthread_mutex_unlock(&mtx_);
+}
+
+void *OutputWriter::runThreadFunc(void *arg) {
+    static_cast<OutputWriter *>(arg)->run();
+    return nullptr;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file output_writer.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file of the OutputWriter class
+ * @date 2024
+ *
+ */
+
+#ifndef OUTPUT_WRITER_HPP
+#define OUTPUT_WRITER_HPP
+
+#include <cstddef>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+constexpr size_t OUTPUT_FLUSH_SIZE = 64 * 1024;  //< Written without waiting
+constexpr size_t OUTPUT_MAX_SIZE = 1024 * 1024;  //< Pending before blocking
+constexpr long OUTPUT_LATENCY_NS = 5 * 1000000L; //< Max delay of a line
+
+/**
+ * @class OutputWriter
+ * @brief Write the output of the client in bulk.
+ *
+ * @details On a TTY, every text is written at once. Otherwise, the texts are
+ * appended to a buffer that a thread writes OUTPUT_LATENCY_NS after the first
+ * of them (or as soon as it holds OUTPUT_FLUSH_SIZE bytes): a pipe gets a
+ * few large writes instead of one per line.
+ *
+ * @note Thread-safe. Until start is called (or once stop has been), the texts
+ * are written at once.
+ */
+class OutputWriter {
+  private:
+    int fd_;
+    bool immediate_; //< fd_ is a TTY
+    pthread_mutex_t mtx_ = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t pendingCond_; //< pending_ filled, or stopping_
+    pthread_cond_t drainedCond_; //< pending_ taken by the thread
+    string pending_;             //< Not written yet
+    string writing_;             //< Being written by the thread
+    string line_;                //< Written at once, reused
+    pthread_t thread_ = 0;
+    bool stopping_ = false;
+    bool failed_ = false; //< The output is closed: texts are dropped
+
+    /**
+     * @brief Write the whole data to fd_.
+     *
+     * @return bool False if the output is closed.
+     */
+    bool writeAll(const char *data, size_t size);
+
+    /**
+     * @brief Write a text, or append it to the buffer, under the lock.
+     *
+     * @param fill Called with the buffer to append the text to (line_ if it
+     * is written at once).
+     */
+    template <typename Fill> void append(Fill fill);
+
+    /**
+     * @brief Write the buffer until stop is called.
+     */
+    void run();
+
+    /**
+     * @brief Thread function of the writer.
+     *
+     * @param arg A pointer to the OutputWriter object.
+     */
+    static void *runThreadFunc(void *arg);
+
+  public:
+    /**
+     * @brief Construct a new OutputWriter object
+     *
+     * @param fd The output (not closed by the writer).
+     */
+    explicit OutputWriter(int fd);
+
+    /**
+     * @brief Write the buffer and destroy the OutputWriter object
+     */
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    /**
+     * @brief Start buffering, unless the output is a TTY.
+     *
+     * @note The signals should be blocked: the thread inherits the mask.
+     *
+     * @return bool If the thread could be created (otherwise, the texts keep
+     * being written at once).
+     */
+    bool start();
+
+    /**
+     * @brief Write the buffer and stop buffering.
+     */
+    void stop();
+
+    /**
+     * @brief Write a text.
+     *
+     * @note Blocks while OUTPUT_MAX_SIZE bytes are pending.
+     */
+    void write(string_view text);
+
+    /**
+     * @brief Write a text followed by a newline.
+     */
+    void writeLine(string_view line);
+
+    /**
+     * @brief Write a message followed by a newline, formatted by Text::format
+     * right into the buffer: nothing is copied before.
+     */
+    void writeMessage(string_view nickname, string_view message, bool bot,
+                      bool balise);
+};
+
+#endif // OUTPUT_WRITER_HPP
@@ -8,127 +8,317 @@
  */
 
 #include "text.hpp"
+#include "../common/scan/scan.hpp"
+
+#include <cstdint>
 
 using namespace std;
 
-// #### Private Methods ####
+namespace {
 
-void Text::formatNoBalise() {
-    formattedMessage_ = (bot_ ? "[" : "[\x1B[4m") + nickname_
-                        + (bot_ ? "] " : "\x1B[0m] ")
-                        + (bot_ ? "" : ANSI_FULL_RESET) + message_;
-}
+// #### Tag table ####
 
-void Text::formatBalise() {
-    size_t index = 0;
-    formattedMessage_ = (bot_ ? "[" : "[\x1B[4m") + nickname_
-                        + (bot_ ? "] " : "\x1B[0m] ") + tagSearch(index)
-                        + (bot_ ? "" : ANSI_FULL_RESET);
+constexpr size_t TAG_HASH_SIZE = 32;
+constexpr size_t MAX_TAG_NAME = 13; //< "strikethrough"
+
+/**
+ * @brief Hash of a tag name, perfect over TAGS (checked below)
+ */
+constexpr size_t tagHash(string_view name) {
+    return (3 * static_cast<uint8_t>(name.front()) + 31 * name.size()
+            + static_cast<uint8_t>(name.back()))
+           % TAG_HASH_SIZE;
 }
 
-string Text::tagSearch(size_t &index, const string &currentColor) {
-    const bool inTag = static_cast<bool>(index); //< Tag nesting
-    if (inTag) {
-        if (message_[index] != BEGIN_CHAR) {
-            // The tag content does not start with '{'
-            return "";
-        } else ++index;
+/**
+ * @brief The index + 1 in TAGS of the tag of every hash (0 if none)
+ */
+constexpr array<uint8_t, TAG_HASH_SIZE> makeTagSlots() {
+    array<uint8_t, TAG_HASH_SIZE> slots{};
+    for (size_t i = 0; i < TAGS.size(); ++i) {
+        slots[tagHash(TAGS[i].name)] = i + 1;
     }
+    return slots;
+}
 
-    string output;
-    for (size_t current = index; current < message_.size(); ++current) {
-        if (inTag and message_[current] == END_CHAR) {
-            // Only end on a "}" if we are not in a primary tags search
-            index = current + 1;
-            return output;
-        } else if (message_[current] == TAG_CHAR) {
-            size_t subindex = current + 1;
-            string suboutput = basicTag(subindex, currentColor);
-            if (suboutput.empty()) {
-                output.push_back(TAG_CHAR);
-            } else {
-                current = subindex - 1;
-                output.insert(output.end(), suboutput.begin(), suboutput.end());
-                output.insert(output.end(), currentColor.begin(),
-                              currentColor.end());
-            }
-        } else {
-            output.push_back(message_[current]);
+constexpr array<uint8_t, TAG_HASH_SIZE> TAG_SLOTS = makeTagSlots();
+
+constexpr bool tagHashIsPerfect() {
+    for (size_t i = 0; i < TAGS.size(); ++i) {
+        if (TAGS[i].name.size() > MAX_TAG_NAME
+            or TAG_SLOTS[tagHash(TAGS[i].name)] != i + 1) {
+            return false;
         }
     }
+    return true;
+}
+
+static_assert(tagHashIsPerfect(), "Two tags share a hash");
+static_assert(TAGS[LINK_TAG].name == "link");
+
+/**
+ * @brief The tag whose name starts at message[index] (right after a
+ * TAG_CHAR) and is followed by BEGIN_CHAR
+ *
+ * @return int Its index in TAGS, or -1 if none
+ */
+int tagAt(string_view message, size_t index) {
+    string_view window = message.substr(0, index + MAX_TAG_NAME + 1);
+    size_t end = scanByte(window, index, BEGIN_CHAR);
+    if (end == index or end == string_view::npos) return -1;
 
-    return inTag ? "" : output;
+    string_view name = message.substr(index, end - index);
+    int slot = TAG_SLOTS[tagHash(name)];
+    return slot and TAGS[slot - 1].name == name ? slot - 1 : -1;
 }
 
-bool Text::tagAt(const string &tag, size_t index) {
-    if (message_.size() - index < tag.size()) {
+// #### Scanning ####
+
+constexpr size_t MAX_OPEN_TAGS = 32;     //< Nested tags at once
+constexpr size_t MAX_OPEN_RESTORES = 64; //< Colors restored in open tags
+constexpr int NO_COLOR = -1;             //< Outside of any color tag
+
+/**
+ * @brief A tag whose END_CHAR is not found yet
+ */
+struct OpenTag {
+    size_t tag;
+    size_t content; //< Index of its content in the message
+    size_t code;    //< Where its opening code starts in the output
+    int color;      //< Depth of the enclosing color tag (or NO_COLOR)
+};
+
+/**
+ * @brief The code that gives the text after a tag the color of an open tag
+ * back
+ */
+struct Restore {
+    size_t code; //< Where it starts in the output
+    int color;   //< Depth of the color tag
+};
+
+/**
+ * @brief The url of a link whose text ends at message[close]
+ *
+ * @return bool False if there is none
+ */
+bool linkUrl(string_view message, size_t close, string_view &url) {
+    if (close + 1 >= message.size() or message[close + 1] != BEGIN_CHAR) {
         return false;
     }
+    size_t end = message.find(END_CHAR, close + 1);
+    if (end == string_view::npos) return false;
+    url = message.substr(close + 2, end - close - 2);
+    return true;
+}
+
+/**
+ * @brief Writes a message with its tags, in one scan
+ *
+ * @details Every tag is written as if it was well formed; when its END_CHAR
+ * (or the end of the message) shows that it is text, its codes in the output
+ * are changed back into its text. The colors restored in a color tag left
+ * open at the end become full resets. For that, the open tags and the
+ * restores in open color tags are kept, up to MAX_OPEN_TAGS and
+ * MAX_OPEN_RESTORES: a tag that would need more is text.
+ */
+class TagWriter {
+  private:
+    string &out_;
+    string_view message_;
+    bool bot_;
+    OpenTag open_[MAX_OPEN_TAGS];
+    Restore restores_[MAX_OPEN_RESTORES];
+    size_t depth_ = 0, restored_ = 0;
+    size_t colored_ = 0;   //< Open tags in an open color tag
+    int color_ = NO_COLOR; //< Depth of the innermost open color tag
+    size_t written_ = 0;   //< Index of the text not written yet
+
+    /**
+     * @brief The code that gives the color of an open tag back (a full
+     * reset outside of any tag, even in bot mode)
+     */
+    string_view colorCode(int color) const {
+        if (color == NO_COLOR) return ANSI_FULL_RESET;
+        return bot_ ? string_view() : TAGS[open_[color].tag].open;
+    }
+
+    /**
+     * @brief The "\name{" of an open tag, in the message
+     */
+    string_view tagText(const OpenTag &tag) const {
+        size_t size = TAGS[tag.tag].name.size() + 2;
+        return message_.substr(tag.content - size, size);
+    }
 
-    for (char chr : tag) {
-        if (message_[index] != chr) {
+    /**
+     * @brief Move the restores written at or after code by delta
+     */
+    void shiftRestores(size_t code, size_t delta) {
+        for (size_t i = restored_; i > 0 and restores_[i - 1].code >= code;
+             --i) {
+            restores_[i - 1].code += delta;
+        }
+    }
+
+    /**
+     * @brief Open the tag starting at message[index]
+     *
+     * @return bool False if it is text (no room left to keep it)
+     */
+    bool open(size_t index, size_t tag) {
+        bool colored = color_ != NO_COLOR;
+        if (depth_ == MAX_OPEN_TAGS
+            or (colored and restored_ + colored_ == MAX_OPEN_RESTORES)) {
             return false;
         }
-        ++index;
+        out_.append(message_, written_, index - written_);
+
+        const Tag &info = TAGS[tag];
+        written_ = index + info.name.size() + 2;
+        open_[depth_] = {tag, written_, out_.size(), color_};
+        if (not bot_) out_ += info.open;
+        if (tag == LINK_TAG) out_ += LINK_BEGIN; //< Then the url
+        if (colored) ++colored_;
+        if (info.color) color_ = static_cast<int>(depth_);
+        ++depth_;
+        return true;
     }
 
-    return true;
-}
+    /**
+     * @brief Close the innermost tag that the END_CHAR at message[index]
+     * ends (if any), the tags before it being text
+     *
+     * @return size_t Where the scan goes on
+     */
+    size_t close(size_t index) {
+        while (depth_ > 0) {
+            const OpenTag &closed = open_[--depth_];
+            if (closed.color != NO_COLOR) --colored_;
+            color_ = closed.color;
+            if (index == closed.content) { //< Empty: nothing in it
+                out_.resize(closed.code);
+                written_ = closed.content - tagText(closed).size();
+                continue;
+            }
+            out_.append(message_, written_, index - written_);
+            written_ = index;
+
+            if (closed.tag == LINK_TAG) {
+                size_t mark = closed.code + LINK_BEGIN.size();
+                string_view url;
+                if (not linkUrl(message_, index, url)) { //< Text
+                    string_view text = tagText(closed);
+                    shiftRestores(mark, text.size() - LINK_BEGIN.size());
+                    out_.replace(closed.code, LINK_BEGIN.size(), text);
+                    continue;
+                }
+                shiftRestores(mark, url.size() + LINK_MIDDLE.size());
+                out_.insert(mark, url);
+                out_.insert(mark + url.size(), LINK_MIDDLE);
+                out_ += LINK_END;
+                written_ = url.data() + url.size() + 1 - message_.data();
+            } else {
+                if (not bot_) out_ += TAGS[closed.tag].reset;
+                ++written_;
+            }
+
+            // Written: the restores in it stay
+            while (restored_ > 0 and restores_[restored_ - 1].color
+                                         >= static_cast<int>(depth_)) {
+                --restored_;
+            }
+            if (color_ != NO_COLOR) {
+                restores_[restored_++] = {out_.size(), color_};
+            }
+            out_ += colorCode(color_);
+            return written_;
+        }
+        return index + 1; //< Text
+    }
+
+    /**
+     * @brief Write the end of the message: the tags still open are text
+     */
+    void finish() {
+        out_.append(message_, written_, message_.size() - written_);
+        // From the end, for the indexes before to stay right
+        while (depth_ > 0) {
+            const OpenTag &text = open_[--depth_];
+            for (; restored_ > 0 and restores_[restored_ - 1].code > text.code;
+                 --restored_) {
+                const Restore &restore = restores_[restored_ - 1];
+                out_.replace(restore.code, colorCode(restore.color).size(),
+                             ANSI_FULL_RESET);
+            }
+            size_t size = (bot_ ? 0 : TAGS[text.tag].open.size())
+                          + (text.tag == LINK_TAG ? LINK_BEGIN.size() : 0);
+            out_.replace(text.code, size, tagText(text));
+        }
+    }
+
+  public:
+    TagWriter(string &out, string_view message, bool bot)
+        : out_(out), message_(message), bot_(bot) {}
 
-string Text::basicTag(size_t &index, const string &currentColor) {
-    for (const auto &tag : TAGS) {
-        if (tagAt(get<0>(tag), index)) {
-            size_t subindex = index + get<0>(tag).size();
-            string suboutput = tagSearch(
-                subindex, (get<2>(tag) ? ansiCode(get<1>(tag)) : currentColor));
-            if (suboutput.empty()) {
-                return suboutput;
+    /**
+     * @brief Append the message to the output
+     */
+    void write() {
+        // The next TAG_CHAR, or END_CHAR too inside a tag
+        CharScanner special(message_, TAG_CHAR, END_CHAR);
+        size_t index = special.next(0, false);
+        while (index < message_.size()) {
+            if (message_[index] == TAG_CHAR) {
+                int tag = tagAt(message_, index + 1);
+                if (tag >= 0 and open(index, tag)) index = written_;
+                else ++index;
             } else {
-                index = subindex;
-                return ansiCode(get<1>(tag)) + suboutput
-                       + (not get<2>(tag) ? ansiCode(get<1>(tag), true) : "");
+                index = close(index);
             }
+            index = special.next(index, depth_ > 0);
         }
+        finish();
     }
-    size_t subindex = index;
-    string output = linkTag(subindex, currentColor);
-    if (output.size()) index = subindex;
-    return output;
-}
+};
+
+} // namespace
 
-string Text::linkTag(size_t &index, const string &currentColor) {
-    if (not tagAt(LINK_TAG, index)) {
-        return "";
+// #### Formatting ####
+
+void Text::format(string &out, string_view nickname, string_view message,
+                  bool bot, bool balise) {
+    out += bot ? "[" : "[\x1B[4m";
+    out += nickname;
+    out += bot ? "] " : "\x1B[0m] ";
+    if (balise) {
+        formatTags(out, message, bot);
+        if (not bot) out += ANSI_FULL_RESET;
+    } else {
+        if (not bot) out += ANSI_FULL_RESET;
+        out += message;
     }
-    index += LINK_TAG.size();
-    size_t subindex = index;
-    string txt = tagSearch(subindex, currentColor);
-    if (txt.empty() or subindex >= message_.size()
-        or message_[subindex] != BEGIN_CHAR)
-        return ""; // Syntax error
-    auto end = message_.find(END_CHAR, subindex);
-    if (end >= message_.size()) return "";
-    string link = message_.substr(subindex + 1, end - (subindex + 1));
-    index = end + 1;
-    return LINK_BEGIN + link + LINK_MIDDLE + txt + LINK_END;
 }
 
-string Text::ansiCode(int style, bool reset) {
-    return bot_ ? ""
-                : ((reset ? ANSI_RESET_CODE : ANSI_START_CODE)
-                   + to_string(style) + "m");
+void Text::formatTags(string &out, string_view message, bool bot) {
+    if (scanByte(message, 0, TAG_CHAR) == string_view::npos) {
+        out += message; //< No tag
+        return;
+    }
+    TagWriter(out, message, bot).write();
 }
 
 // #### Public Methods ####
 
 Text::Text(const string &nickname, const string &message, bool bot, bool balise)
     : nickname_(nickname), message_(message), bot_(bot), balise_(balise) {
-    balise_ ? formatBalise() : formatNoBalise();
+    formattedMessage_.reserve(nickname.size() + message.size() + 64);
+    format(formattedMessage_, nickname_, message_, bot_, balise_);
 }
 Text::Text(const string &message, bool balise)
     : message_(message), balise_(balise) {
-    size_t index = 0;
-    formattedMessage_ = balise_ ? tagSearch(index) : message;
+    if (balise_) formatTags(formattedMessage_, message_, bot_);
+    else formattedMessage_ = message;
 }
 
 Text::~Text() = default;
@@ -11,35 +11,50 @@
 #define TEXT_HPP
 
 #include <array>
+#include <cstddef>
 #include <iostream>
 #include <string>
-#include <tuple>
+#include <string_view>
 using namespace std;
 
 static constexpr char TAG_CHAR = '\\', BEGIN_CHAR = '{', END_CHAR = '}';
-static const array<const tuple<string, int, bool>, 15> TAGS{{
-    // Color tags: {name, ANSI style}
-    {"red", 31, true},
-    {"yellow", 33, true},
-    {"green", 32, true},
-    {"blue", 34, true},
-    {"magenta", 35, true},
-    {"cyan", 36, true},
-    {"white", 37, true},
-    {"black", 30, true},
-
-    // Style tags:
-    {"bold", 1, false},
-    {"underline", 4, false},
-    {"dim", 2, false},
-    {"italic", 3, false},
-    {"inverse", 7, false},
-    {"hidden", 8, false},
-    {"strikethrough", 9, false},
+
+/**
+ * @brief A tag of the --balise markup
+ */
+struct Tag {
+    string_view name;
+    string_view open;  //< ANSI code starting the tag
+    string_view reset; //< ANSI code ending it (style tags)
+    bool color;        //< The nested tags restore it once they end
+};
+
+static constexpr array<Tag, 16> TAGS{{
+    // Color tags: {name, ANSI code}
+    {"red", "\033[31m", "", true},
+    {"yellow", "\033[33m", "", true},
+    {"green", "\033[32m", "", true},
+    {"blue", "\033[34m", "", true},
+    {"magenta", "\033[35m", "", true},
+    {"cyan", "\033[36m", "", true},
+    {"white", "\033[37m", "", true},
+    {"black", "\033[30m", "", true},
+
+    // Style tags: {name, ANSI code, reset code}
+    {"bold", "\033[1m", "\033[21m", false},
+    {"underline", "\033[4m", "\033[24m", false},
+    {"dim", "\033[2m", "\033[22m", false},
+    {"italic", "\033[3m", "\033[23m", false},
+    {"inverse", "\033[7m", "\033[27m", false},
+    {"hidden", "\033[8m", "\033[28m", false},
+    {"strikethrough", "\033[9m", "\033[29m", false},
+
+    // \link{text}{url}
+    {"link", "", "", false},
 }};
-static const string ANSI_RESET_CODE("\033[2"), ANSI_START_CODE("\033["),
-    ANSI_FULL_RESET("\033[0m"), LINK_TAG("link"), LINK_BEGIN("\033]8;;"),
-    LINK_MIDDLE("\033\\"), LINK_END("\033]8;;\033\\");
+static constexpr size_t LINK_TAG = TAGS.size() - 1;
+static constexpr string_view ANSI_FULL_RESET("\033[0m"),
+    LINK_BEGIN("\033]8;;"), LINK_MIDDLE("\033\\"), LINK_END("\033]8;;\033\\");
 
 /**
  * @brief Handle formatting of a message based on tags and bot chat flag
@@ -51,89 +66,10 @@ class Text {
     // #### Private attributes ####
     string nickname_;
     string message_;
-    bool bot_;
+    bool bot_ = false;
     bool balise_;
     string formattedMessage_;
 
-    // #### Private methods ####
-
-    /**
-     * @brief Format the message and initialize the attribute formattedMessage_
-     * with the output (no tags when --balise is not activated)
-     *
-     */
-    void formatNoBalise();
-
-    /**
-     * @brief Format the message and initialize the attribute formattedMessage_
-     * with the output (with tags when --balise is activated)
-     *
-     */
-    void formatBalise();
-
-    // #### Helpers ####
-
-    /**
-     * @brief Search for tags in the raw message and change them into ANSI codes
-     *
-     * @note This is a recursive method (To handle nested tags). If the arg
-     * index > 0, we are formatting the content of a tag
-     *
-     * @param index The begin index of the content to parse in the message
-     * @param currentColor The color of the current content (or empty string if
-     * none)
-     * @return size_t The number of treated characters
-     */
-    string tagSearch(size_t &index,
-                     const string &currentColor = ANSI_FULL_RESET);
-
-    /**
-     * @brief Return if a tag is present at message_[index]
-     *
-     * @param tag The tag
-     * @param index The index in the message
-     * @return bool (message_[index:index+tag.size] == tag )
-     */
-    bool tagAt(const string &tag, size_t index);
-
-    /**
-     * @brief Handle a \link tag at message_[index]
-     *
-     * @param index The index where the tag content begins (right after the
-     * '\link' expression)
-     * @param currentColor The color of the current content (or empty string if
-     * none)
-     * @return string The formatted link (or empty string if there is a
-     * formatting error)
-     * @warning A formatting error happens when the expression is incomplete
-     * (missing braces)
-     */
-    string linkTag(size_t &index, const string &currentColor);
-
-    /**
-     * @brief Handle a basic tag (e.g. \red) at message_[index]
-     *
-     * @param index The index where the tag content begins (right after the
-     * '\tag' expression)
-     * @param currentColor The color of the current content (or empty string if
-     * none)
-     * @return string The formatted link (or empty string if there is a
-     * formatting error)
-     * @warning A formatting error happens when the expression is incomplete
-     * (missing braces)
-     */
-    string basicTag(size_t &index, const string &currentColor);
-
-    /**
-     * @brief Build an ANSI escape code
-     *
-     * @param style The style of the code
-     * @param reset Is the code reseting that style ?
-     * @return string The ANSI escape code (or empty string if the bot mode is
-     * enabled)
-     */
-    string ansiCode(int style, bool reset = false);
-
   public:
     /**
      * @brief Constructor with the nickname, the message and the bot
@@ -155,6 +91,38 @@ class Text {
      */
     virtual ~Text();
 
+    /**
+     * @brief Append a formatted message to a buffer (what out() returns)
+     *
+     * @param out The buffer
+     * @param nickname The sender's nickname
+     * @param message The message
+     * @param bot True if the bot flag is toggled on
+     * @param balise True if the balise flag is toggled on
+     */
+    static void format(string &out, string_view nickname, string_view message,
+                       bool bot, bool balise);
+
+    /**
+     * @brief Append a message to a buffer, its tags changed into ANSI codes
+     *
+     * @details A tag is "\name{content}" ("\link{content}{url}"), its
+     * content not empty and made of text and tags; the url is raw, up to the
+     * first '}'. Anything else is text: after a '\\' that does not start a
+     * tag, the message is read as if it was not there (the '}' of "\red{}"
+     * ends the enclosing tag).
+     *
+     * Written in one scan, without recursion nor allocation (but in out): a
+     * tag found to be text is changed back into text in out. A tag is text too
+     * if 32 tags are open around it, or if the color tags open around it hold
+     * 64 tags already.
+     *
+     * @param out The buffer
+     * @param message The message
+     * @param bot True if the bot flag is toggled on (no ANSI styles)
+     */
+    static void formatTags(string &out, string_view message, bool bot);
+
     /**
      * @brief Get the raw message
      *
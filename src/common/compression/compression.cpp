@@ -0,0 +1,210 @@
+/**
+ * @file compression.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file of the LZ compression of the messages of a stream
+ * @date 2024
+ *
+ */
+
+#include "compression.hpp"
+#include "../header/header.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+/**
+ * @brief Read a varint, at most MAX_VARINT_SIZE bytes long.
+ *
+ * @return bool False if the data ends first or the varint is too long.
+ */
+bool readVarint(const uint8_t *&in, const uint8_t *end, size_t &value) {
+    value = 0;
+    for (size_t shift = 0; shift < 7 * MAX_VARINT_SIZE; shift += 7) {
+        if (in == end) return false;
+        uint8_t byte = *in++;
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (not(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+// ### CompressionWindow ###
+
+CompressionWindow::CompressionWindow(size_t maxMessage)
+    : maxMessage_(maxMessage),
+      history_(new char[2 * COMPRESSION_WINDOW + maxMessage]),
+      capacity_(2 * COMPRESSION_WINDOW + maxMessage) {}
+
+void CompressionWindow::compact() {
+    if (capacity_ - end_ >= maxMessage_) return;
+    size_t keep = min(end_, COMPRESSION_WINDOW);
+    memmove(history_.get(), history_.get() + end_ - keep, keep);
+    base_ += end_ - keep;
+    end_ = keep;
+}
+
+string_view CompressionWindow::window() const {
+    size_t keep = min(end_, COMPRESSION_WINDOW);
+    return string_view(history_.get() + end_ - keep, keep);
+}
+
+uint64_t CompressionWindow::position() const { return base_ + end_; }
+
+bool CompressionWindow::resume(string_view window, uint64_t position) {
+    if (window.size() > COMPRESSION_WINDOW or window.size() > position) {
+        return false;
+    }
+    memcpy(history_.get(), window.data(), window.size());
+    end_ = window.size();
+    base_ = position - window.size();
+    return true;
+}
+
+// ### StreamCompressor ###
+
+StreamCompressor::StreamCompressor(size_t maxMessage)
+    : CompressionWindow(maxMessage),
+      table_(new uint64_t[size_t(1) << HASH_BITS]()) {}
+
+size_t StreamCompressor::hash(size_t pos) const {
+    uint32_t sequence;
+    memcpy(&sequence, history_.get() + pos, sizeof(sequence));
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+bool StreamCompressor::resume(string_view window, uint64_t position) {
+    if (not CompressionWindow::resume(window, position)) return false;
+    for (size_t pos = 0; pos + MIN_MATCH <= end_; ++pos) {
+        table_[hash(pos)] = base_ + pos;
+    }
+    return true;
+}
+
+size_t StreamCompressor::compress(string_view message, char *out) {
+    size_t size = message.size();
+    if (size < MIN_COMPRESSED_MESSAGE or size > maxMessage_) return 0;
+
+    // Appended to the window, which only keeps it if it is sent compressed
+    compact();
+    char *data = history_.get();
+    memcpy(data + end_, message.data(), size);
+    size_t limit = end_ + size;
+
+    size_t written = encode(limit, out);
+    if (written == 0) {
+        // Until the window is full, sent as literals anyway: otherwise
+        // nothing would ever enter it
+        if (base_ + end_ >= COMPRESSION_WINDOW
+            or size + MAX_VARINT_SIZE > maxMessage_) {
+            return 0;
+        }
+        written = encodeVarint(out, size << 1);
+        memcpy(out + written, message.data(), size);
+        written += size;
+    }
+
+    end_ = limit;
+    return written;
+}
+
+size_t StreamCompressor::encode(size_t limit, char *out) {
+    char *data = history_.get();
+    size_t size = limit - end_;
+    size_t written = 0;
+    size_t literal = end_; //< First byte not written yet
+    auto flushLiterals = [&](size_t until) {
+        size_t count = until - literal;
+        if (count == 0) return true;
+        if (written + MAX_VARINT_SIZE + count >= size) return false;
+        written += encodeVarint(out + written, count << 1);
+        memcpy(out + written, data + literal, count);
+        written += count;
+        return true;
+    };
+    size_t pos = end_;
+    while (pos + MIN_MATCH <= limit) {
+        uint64_t &slot = table_[hash(pos)];
+        uint64_t candidate = slot;
+        slot = base_ + pos;
+
+        size_t from = candidate - base_;
+        if (candidate < base_ or from >= pos
+            or pos - from > COMPRESSION_WINDOW
+            or memcmp(data + from, data + pos, MIN_MATCH) != 0) {
+            ++pos;
+            continue;
+        }
+
+        size_t length = MIN_MATCH;
+        while (pos + length < limit
+               and data[from + length] == data[pos + length]) {
+            ++length;
+        }
+        if (not flushLiterals(pos)
+            or written + 2 * MAX_VARINT_SIZE >= size) {
+            return 0;
+        }
+        written += encodeVarint(out + written, (length - MIN_MATCH) << 1 | 1);
+        written += encodeVarint(out + written, pos - from);
+
+        for (size_t next = pos + 1;
+             next < pos + length and next + MIN_MATCH <= limit; ++next) {
+            table_[hash(next)] = base_ + next;
+        }
+        pos += length;
+        literal = pos;
+    }
+    return flushLiterals(limit) ? written : 0;
+}
+
+// ### StreamDecompressor ###
+
+StreamDecompressor::StreamDecompressor(size_t maxMessage)
+    : CompressionWindow(maxMessage) {}
+
+bool StreamDecompressor::decompress(string_view data, string_view &message) {
+    compact();
+    char *out = history_.get();
+    size_t pos = end_;
+    size_t limit = end_ + maxMessage_;
+
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(data.data());
+    const uint8_t *inEnd = in + data.size();
+    while (in < inEnd) {
+        size_t token;
+        if (not readVarint(in, inEnd, token)) return false;
+
+        if (not(token & 1)) {
+            size_t count = token >> 1;
+            if (count > static_cast<size_t>(inEnd - in)
+                or count > limit - pos) {
+                return false;
+            }
+            memcpy(out + pos, in, count);
+            in += count;
+            pos += count;
+        } else {
+            size_t length = (token >> 1) + MIN_MATCH;
+            size_t distance;
+            if (not readVarint(in, inEnd, distance) or distance == 0
+                or distance > COMPRESSION_WINDOW or distance > pos
+                or length > limit - pos) {
+                return false;
+            }
+            // Byte by byte: the copy may overlap what it writes
+            for (size_t i = 0; i < length; ++i, ++pos) {
+                out[pos] = out[pos - distance];
+            }
+        }
+    }
+
+    message = string_view(out + end_, pos - end_);
+    end_ = pos;
+    return true;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file compression.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file of the LZ compression of the messages of a stream
+ * @date 2024
+ *
+ */
+
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+using namespace std;
+
+constexpr size_t COMPRESSION_WINDOW = 4096;   //< Bytes a match reaches back
+constexpr size_t MIN_COMPRESSED_MESSAGE = 32; //< Shorter ones are sent as is
+constexpr size_t MIN_MATCH = 4;
+
+/**
+ * @brief The messages of a stream, compressed or decompressed in order: the
+ * last COMPRESSION_WINDOW bytes are the dictionary of the next message.
+ *
+ * @details A compressed message is a sequence of varint tokens, the low bit
+ * telling their kind:
+ * - (length << 1): length literal bytes follow;
+ * - ((length - MIN_MATCH) << 1 | 1) then the distance: copy length bytes
+ * from that far back (into the previous messages or this one).
+ *
+ * Only the compressed messages enter the window: a message sent as is (or
+ * dropped before being sent) does not change it. Until the window is full, a
+ * message that does not shrink is thus still "compressed", as literals, at
+ * the cost of a few bytes (see StreamCompressor::compress).
+ */
+class CompressionWindow {
+  protected:
+    size_t maxMessage_;
+    unique_ptr<char[]> history_; //< The window, then the current message
+    size_t capacity_;
+    size_t end_ = 0;  //< End of the messages compressed so far
+    uint64_t base_ = 0; //< Position in the stream of history_[0]
+
+    /**
+     * @brief Make room for a message, keeping the window.
+     */
+    void compact();
+
+    /**
+     * @brief Construct a new, empty CompressionWindow object.
+     *
+     * @param maxMessage The longest message (decompressed).
+     */
+    explicit CompressionWindow(size_t maxMessage);
+
+  public:
+    /**
+     * @brief Get the bytes the next match may reach back to, to resume the
+     * stream in another process (see resume).
+     */
+    string_view window() const;
+
+    /**
+     * @brief Get the position in the stream of the end of the window.
+     */
+    uint64_t position() const;
+
+    /**
+     * @brief Start from the window of a stream instead of an empty one.
+     *
+     * @param window The window (at most COMPRESSION_WINDOW bytes).
+     * @param position The position in the stream of its end.
+     *
+     * @return bool False if the window is too large.
+     */
+    bool resume(string_view window, uint64_t position);
+};
+
+/**
+ * @class StreamCompressor
+ * @brief Compresses the messages sent on a stream.
+ */
+class StreamCompressor : public CompressionWindow {
+  private:
+    static constexpr unsigned HASH_BITS = 12;
+
+    /**
+     * @brief Last stream position of every hashed 4-byte sequence (only a
+     * hint: the bytes are compared before being used).
+     */
+    unique_ptr<uint64_t[]> table_;
+
+    /**
+     * @brief Hash the 4-byte sequence at history_[pos].
+     */
+    size_t hash(size_t pos) const;
+
+    /**
+     * @brief Encode the message appended to the window.
+     *
+     * @return size_t The encoded size, or 0 if not smaller than the message.
+     */
+    size_t encode(size_t limit, char *out);
+
+  public:
+    /**
+     * @brief Construct a new StreamCompressor object.
+     *
+     * @param maxMessage The longest message compressed.
+     */
+    explicit StreamCompressor(size_t maxMessage);
+
+    /**
+     * @brief Compress the next message of the stream.
+     *
+     * @warning Until COMPRESSION_WINDOW bytes entered the window, a message
+     * that does not shrink is still returned, as a single literal token, so
+     * that the window fills up: it is then 1 or 2 bytes larger than the
+     * message (plus at most 1 byte for the message size in the frame header).
+     * Afterwards, such a message is always sent as is.
+     *
+     * @param message The message.
+     * @param out Room for the longest message.
+     *
+     * @return size_t The compressed size (never more than the longest
+     * message), or 0 if compressing does not pay off: the message must then
+     * be sent as is.
+     */
+    size_t compress(string_view message, char *out);
+
+    /**
+     * @brief Start from the window of a stream, hashing it so that the next
+     * messages match it (see CompressionWindow::resume).
+     */
+    bool resume(string_view window, uint64_t position);
+};
+
+/**
+ * @class StreamDecompressor
+ * @brief Decompresses the messages received on a stream.
+ */
+class StreamDecompressor : public CompressionWindow {
+  public:
+    /**
+     * @brief Construct a new StreamDecompressor object.
+     *
+     * @param maxMessage The longest message accepted.
+     */
+    explicit StreamDecompressor(size_t maxMessage);
+
+    /**
+     * @brief Decompress the next compressed message of the stream.
+     *
+     * @param data The compressed message.
+     * @param message The message, valid until the next call.
+     *
+     * @return bool False if the data is invalid or the message too long (the
+     * stream cannot be decompressed anymore).
+     */
+    bool decompress(string_view data, string_view &message);
+};
+
+#endif // COMPRESSION_HPP
@@ -0,0 +1,245 @@
+/**
+ * @file frame_decoder.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file of the buffered frame decoder
+ * @date 2024
+ *
+ */
+
+#include "frame_decoder.hpp"
+#include "../header/header.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <unistd.h>
+
+using namespace std;
+
+// ### Header ###
+
+DecodeReturnVal parseFrameHeader(const char *frame, size_t available,
+                                 uint8_t maxVersion, FrameHeader &header) {
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(frame);
+    if (available == 0) return DecodeReturnVal::NEED_MORE;
+
+    uint8_t version = data[0];
+    if (version < PROTOCOL_V1 or version > maxVersion) {
+        return DecodeReturnVal::INVALID_VERSION;
+    }
+
+    if (version == PROTOCOL_V1) {
+        if (available < sizeof(PacketHeader)) return DecodeReturnVal::NEED_MORE;
+        PacketHeader packet;
+        memcpy(&packet, data, sizeof(packet));
+        size_t totalSize = ntohs(packet.totalSize);
+        if (totalSize < sizeof(PacketHeader) + packet.nicknameSize) {
+            return DecodeReturnVal::INVALID_HEADER;
+        }
+        header.headerSize = sizeof(PacketHeader);
+        header.nicknameSize = packet.nicknameSize;
+        header.messageSize =
+            totalSize - sizeof(PacketHeader) - packet.nicknameSize;
+        header.flags = 0;
+        header.nicknameId = 0;
+        return DecodeReturnVal::FRAME_READY;
+    }
+
+    // [version][flags]([varint id])([varint nickname size])
+    // [varint message size]
+    if (available < 2) return DecodeReturnVal::NEED_MORE;
+    uint8_t flags = data[1];
+    bool hasId = flags & (FRAME_NICKNAME_ID | FRAME_NICKNAME_BIND);
+    bool hasNickname = not(flags & FRAME_NICKNAME_ID);
+    size_t pos = 2;
+    size_t fields[3] = {0, 0, 0}; //< Id, nickname size, message size
+    for (size_t i = hasId ? 0 : 1; i < 3; ++i) {
+        if (i == 1 and not hasNickname) continue;
+        for (size_t shift = 0;; shift += 7) {
+            if (shift == 7 * MAX_VARINT_SIZE) {
+                return DecodeReturnVal::INVALID_HEADER;
+            }
+            if (pos >= available) return DecodeReturnVal::NEED_MORE;
+            uint8_t byte = data[pos++];
+            fields[i] |= static_cast<size_t>(byte & 0x7f) << shift;
+            if (not(byte & 0x80)) break;
+        }
+    }
+    header.headerSize = pos;
+    header.nicknameId = fields[0];
+    header.nicknameSize = fields[1];
+    header.messageSize = fields[2];
+    header.flags = flags;
+    return DecodeReturnVal::FRAME_READY;
+}
+
+// ### Constructor ###
+FrameDecoder::FrameDecoder(uint8_t version, size_t maxNickname,
+                           size_t maxMessage, size_t capacity)
+    : version_(version), maxNickname_(maxNickname), maxMessage_(maxMessage),
+      buffer_(new char[capacity]), capacity_(capacity) {}
+
+// ### Destructor ###
+FrameDecoder::~FrameDecoder() { delete[] buffer_; }
+
+// ### Private methods ###
+
+void FrameDecoder::compact() {
+    if (begin_ == end_) {
+        begin_ = end_ = 0;
+    } else if (begin_ > 0 and capacity_ - end_ < capacity_ / 2) {
+        memmove(buffer_, buffer_ + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+}
+
+DecodeReturnVal FrameDecoder::parseHeader(FrameHeader &header) const {
+    DecodeReturnVal ret =
+        parseFrameHeader(buffer_ + begin_, end_ - begin_, version_, header);
+    if (ret == DecodeReturnVal::FRAME_READY
+        and (header.flags & (FRAME_NICKNAME_ID | FRAME_NICKNAME_BIND))
+        and header.nicknameId >= maxIds_) {
+        ret = DecodeReturnVal::INVALID_HEADER;
+    }
+
+    if (ret == DecodeReturnVal::INVALID_VERSION) {
+        cerr << "Err: version incorrecte" << endl;
+    } else if (ret == DecodeReturnVal::INVALID_HEADER) {
+        cerr << "Err: en-tête invalide" << endl;
+    }
+    return ret;
+}
+
+bool FrameDecoder::nickname(const FrameHeader &header, string_view &nickname) {
+    if (header.flags & FRAME_NICKNAME_ID) {
+        if (header.nicknameId >= nicknames_.size()) return false;
+        nickname = nicknames_[header.nicknameId];
+        return not nickname.empty();
+    }
+
+    nickname = string_view(buffer_ + begin_ + header.headerSize,
+                           header.nicknameSize);
+    if (header.flags & FRAME_NICKNAME_BIND) {
+        if (nickname.empty()) return false;
+        if (header.nicknameId >= nicknames_.size()) {
+            nicknames_.resize(header.nicknameId + 1);
+        }
+        nicknames_[header.nicknameId] = nickname;
+    }
+    return true;
+}
+
+// ### Public methods ###
+
+void FrameDecoder::setVersion(uint8_t version) { version_ = version; }
+
+void FrameDecoder::allowNicknameIds(uint32_t maxIds) { maxIds_ = maxIds; }
+
+void FrameDecoder::allowCompression() {
+    if (decompressor_ == nullptr) {
+        decompressor_ = make_unique<StreamDecompressor>(maxMessage_);
+    }
+}
+
+ssize_t FrameDecoder::fill(int fd, size_t limit) {
+    compact();
+    if (end_ == capacity_) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t ret = read(fd, buffer_ + end_, min(capacity_ - end_, limit));
+    if (ret > 0) end_ += ret;
+    return ret;
+}
+
+size_t FrameDecoder::feed(const char *data, size_t size) {
+    compact();
+    size_t count = min(size, capacity_ - end_);
+    memcpy(buffer_ + end_, data, count);
+    end_ += count;
+    return count;
+}
+
+DecodeReturnVal FrameDecoder::next(FrameView &frame) {
+    FrameHeader header;
+    DecodeReturnVal ret = parseHeader(header);
+    if (ret != DecodeReturnVal::FRAME_READY) return ret;
+
+    if (header.nicknameSize > maxNickname_) {
+        cerr << "Err: Pseudo trop long." << endl;
+        return DecodeReturnVal::NICKNAME_TOO_LONG;
+    }
+    if (header.messageSize > maxMessage_) {
+        cerr << "Err: Message trop long." << endl;
+        return DecodeReturnVal::MESSAGE_TOO_LONG;
+    }
+
+    size_t frameSize =
+        header.headerSize + header.nicknameSize + header.messageSize;
+    if (end_ - begin_ < frameSize) return DecodeReturnVal::NEED_MORE;
+
+    if (not nickname(header, frame.nickname)) {
+        cerr << "Err: en-tête invalide" << endl;
+        return DecodeReturnVal::INVALID_HEADER;
+    }
+    const char *message =
+        buffer_ + begin_ + header.headerSize + header.nicknameSize;
+    frame.message = string_view(message, header.messageSize);
+    if ((header.flags & FRAME_COMPRESSED)
+        and (decompressor_ == nullptr
+             or not decompressor_->decompress(frame.message, frame.message))) {
+        cerr << "Err: message compressé invalide" << endl;
+        return DecodeReturnVal::INVALID_HEADER;
+    }
+    frame.more = header.flags & FRAME_MORE;
+    begin_ += frameSize;
+    return DecodeReturnVal::FRAME_READY;
+}
+
+bool FrameDecoder::partial(FrameView &frame, size_t &missing) {
+    FrameHeader header;
+    if (parseHeader(header) != DecodeReturnVal::FRAME_READY
+        or (header.flags & FRAME_COMPRESSED)) {
+        return false;
+    }
+
+    size_t available = end_ - begin_;
+    size_t bodyStart = header.headerSize + header.nicknameSize;
+    size_t frameSize = bodyStart + header.messageSize;
+    if (available < bodyStart or available >= frameSize
+        or not nickname(header, frame.nickname)) {
+        return false;
+    }
+
+    frame.message =
+        string_view(buffer_ + begin_ + bodyStart, available - bodyStart);
+    frame.more = header.flags & FRAME_MORE;
+    missing = frameSize - available;
+    return true;
+}
+
+void FrameDecoder::discard() { begin_ = end_ = 0; }
+
+string_view FrameDecoder::buffered() const {
+    return string_view(buffer_ + begin_, end_ - begin_);
+}
+
+const vector<string> &FrameDecoder::boundNicknames() const {
+    return nicknames_;
+}
+
+bool FrameDecoder::bindNicknames(vector<string> nicknames) {
+    if (nicknames.size() > maxIds_) return false;
+    nicknames_ = move(nicknames);
+    return true;
+}
+
+StreamDecompressor *FrameDecoder::decompressor() const {
+    return decompressor_.get();
+}
+
+bool FrameDecoder::full() const { return end_ == capacity_; }
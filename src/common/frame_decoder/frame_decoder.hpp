@@ -0,0 +1,253 @@
+/**
+ * @file frame_decoder.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file of the buffered frame decoder
+ * @date 2024
+ *
+ */
+
+#ifndef FRAME_DECODER_HPP
+#define FRAME_DECODER_HPP
+
+#include "../compression/compression.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t FRAME_DECODER_CAPACITY = 16 * 1024; //< Default buffer size
+
+/**
+ * @brief A frame decoded in place: views into the decoder's buffer.
+ *
+ * @note Only valid until the next call to FrameDecoder::fill, feed or next.
+ */
+struct FrameView {
+    string_view nickname;
+    string_view message;
+    bool more = false; //< A fragment of a v2 message going on in the next one
+};
+
+/**
+ * @brief Result of a call to FrameDecoder::next.
+ */
+enum class DecodeReturnVal {
+    FRAME_READY = 0, //< A complete frame was decoded
+    NEED_MORE,       //< The buffer ends with an incomplete frame (or is empty)
+    NICKNAME_TOO_LONG,
+    MESSAGE_TOO_LONG,
+    INVALID_VERSION,
+    INVALID_HEADER //< A v2 size is too large or a nickname id is unknown
+};
+
+/**
+ * @brief The header of a frame, whatever its version.
+ */
+struct FrameHeader {
+    size_t headerSize;
+    size_t nicknameSize; //< In the frame (0 with FRAME_NICKNAME_ID)
+    size_t messageSize;
+    uint8_t flags;
+    uint32_t nicknameId; //< With FRAME_NICKNAME_ID or FRAME_NICKNAME_BIND
+};
+
+/**
+ * @brief Parse the header of a frame, whatever its version.
+ *
+ * @param frame The bytes of the frame received so far.
+ * @param available The number of bytes received.
+ * @param maxVersion The highest version accepted.
+ * @param header The header, when FRAME_READY is returned (the frame itself
+ * may still be incomplete).
+ *
+ * @return DecodeReturnVal NEED_MORE if the header is incomplete.
+ */
+DecodeReturnVal parseFrameHeader(const char *frame, size_t available,
+                                 uint8_t maxVersion, FrameHeader &header);
+
+/**
+ * @class FrameDecoder
+ * @brief Reads a stream of frames in large chunks and hands out every complete
+ * frame of its buffer without copying it.
+ *
+ * @details The frames are decoded in place, so they must be contiguous: rather
+ * than wrapping around, the buffer moves its unread bytes (less than a frame
+ * once every complete frame has been handed out) back to its start when the
+ * space left at its end runs low.
+ *
+ * The nicknames bound to ids by the peer are kept for the whole stream: a
+ * frame referring to an id gets its nickname from there. Likewise, compressed
+ * messages are decompressed into the window of the stream.
+ */
+class FrameDecoder {
+  private:
+    uint8_t version_; //< Highest version accepted
+    size_t maxNickname_;
+    size_t maxMessage_;
+
+    char *buffer_;
+    size_t capacity_;
+    size_t begin_ = 0; //< First byte not decoded yet
+    size_t end_ = 0;   //< End of the received bytes
+
+    uint32_t maxIds_ = 0;      //< Nickname ids accepted
+    vector<string> nicknames_; //< By id, empty if not bound
+
+    unique_ptr<StreamDecompressor> decompressor_; //< If compression is allowed
+
+    /**
+     * @brief Make room at the end of the buffer.
+     */
+    void compact();
+
+    /**
+     * @brief Parse the header of the frame starting at begin_.
+     *
+     * @param header The header, when FRAME_READY is returned (the frame itself
+     * may still be incomplete).
+     *
+     * @return DecodeReturnVal NEED_MORE if the header is incomplete.
+     */
+    DecodeReturnVal parseHeader(FrameHeader &header) const;
+
+    /**
+     * @brief Get the nickname of the complete header at begin_, binding it to
+     * its id if asked to.
+     *
+     * @return bool False if the id is not bound or a bound nickname is empty.
+     */
+    bool nickname(const FrameHeader &header, string_view &nickname);
+
+  public:
+    /**
+     * @brief Construct a new FrameDecoder object.
+     *
+     * @param version The highest protocol version accepted: every frame may
+     * use any version up to it.
+     * @param maxNickname The longest nickname accepted.
+     * @param maxMessage The longest message accepted.
+     * @param capacity The buffer size (at least twice the largest frame).
+     */
+    FrameDecoder(uint8_t version, size_t maxNickname, size_t maxMessage,
+                 size_t capacity = FRAME_DECODER_CAPACITY);
+
+    /**
+     * @brief Destroy the FrameDecoder object.
+     */
+    ~FrameDecoder();
+
+    FrameDecoder(const FrameDecoder &) = delete;
+    FrameDecoder &operator=(const FrameDecoder &) = delete;
+
+    /**
+     * @brief Accept the frames up to another version from now on: the one
+     * negotiated at handshake (later ones are invalid).
+     */
+    void setVersion(uint8_t version);
+
+    /**
+     * @brief Accept the frames using nickname ids (none by default).
+     *
+     * @param maxIds The ids accepted are below it.
+     */
+    void allowNicknameIds(uint32_t maxIds);
+
+    /**
+     * @brief Accept the frames with a compressed message (none by default).
+     */
+    void allowCompression();
+
+    /**
+     * @brief Read from a socket into the free space of the buffer, with a
+     * single read() call.
+     *
+     * @param fd The socket to read from.
+     * @param limit The most bytes to read.
+     *
+     * @return ssize_t Same as read(): the number of bytes read, 0 on EOF or
+     * -1 with errno set (ENOBUFS if the buffer is full).
+     */
+    ssize_t fill(int fd, size_t limit = SIZE_MAX);
+
+    /**
+     * @brief Copy already received bytes into the free space of the buffer.
+     *
+     * @param data The received bytes.
+     * @param size The number of received bytes.
+     *
+     * @return size_t The number of bytes copied; the rest must be fed again
+     * once the frames of the buffer have been decoded.
+     */
+    size_t feed(const char *data, size_t size);
+
+    /**
+     * @brief Decode the next complete frame of the buffer.
+     *
+     * @param frame The decoded frame, when FRAME_READY is returned.
+     *
+     * @return DecodeReturnVal Whether a frame was decoded, more bytes are
+     * needed, or the stream is invalid (the decoder must not be used anymore).
+     */
+    DecodeReturnVal next(FrameView &frame);
+
+    /**
+     * @brief Get the incomplete frame ending the buffer, once its nickname is
+     * received (and bound, if the frame binds it).
+     *
+     * @note Only meaningful after next returned NEED_MORE, which checked the
+     * header.
+     *
+     * @param frame The frame; its message only holds the bytes received.
+     * @param missing The bytes of the message still to be received.
+     *
+     * @return bool False if no nickname is waiting for its message.
+     */
+    bool partial(FrameView &frame, size_t &missing);
+
+    /**
+     * @brief Drop every buffered byte, e.g. a partial frame whose end is read
+     * by other means.
+     */
+    void discard();
+
+    /**
+     * @brief Get the bytes received and not decoded yet, e.g. to resume the
+     * stream in another process (fed to its decoder).
+     */
+    string_view buffered() const;
+
+    /**
+     * @brief Get the nicknames bound by the peer, by id (empty if not bound).
+     */
+    const vector<string> &boundNicknames() const;
+
+    /**
+     * @brief Take over the nicknames bound on a resumed stream.
+     *
+     * @note The ids must be allowed first (see allowNicknameIds).
+     *
+     * @return bool False if there are more than the ids allowed.
+     */
+    bool bindNicknames(vector<string> nicknames);
+
+    /**
+     * @brief Get the window of the compressed messages of the stream.
+     *
+     * @return StreamDecompressor* nullptr if compression is not allowed.
+     */
+    StreamDecompressor *decompressor() const;
+
+    /**
+     * @brief Whether the buffer has no free space left at its end, e.g. the
+     * last fill may have left bytes in the socket.
+     */
+    bool full() const;
+};
+
+#endif // FRAME_DECODER_HPP
@@ -0,0 +1,50 @@
+/**
+ * @file header.cpp
+ * @author Lucas Verbeiren (Main developer)
+ * @brief Source file of the frame headers of every protocol version
+ * @date 2024
+ *
+ */
+
+#include "header.hpp"
+
+#include <cstring>
+#include <netinet/in.h>
+
+using namespace std;
+
+size_t encodeVarint(char *out, size_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out[size++] = static_cast<char>(value);
+    return size;
+}
+
+size_t encodeHeader(char *out, uint8_t version, size_t nicknameSize,
+                    size_t messageSize, uint8_t flags,
+                    uint32_t nicknameId) {
+    if (version == PROTOCOL_V1) {
+        PacketHeader header{
+            version,
+            htons(static_cast<uint16_t>(sizeof(PacketHeader) + nicknameSize
+                                        + messageSize)),
+            static_cast<uint8_t>(nicknameSize)};
+        memcpy(out, &header, sizeof(header));
+        return sizeof(header);
+    }
+
+    out[0] = static_cast<char>(version);
+    out[1] = static_cast<char>(flags);
+    size_t size = 2;
+    if (flags & (FRAME_NICKNAME_ID | FRAME_NICKNAME_BIND)) {
+        size += encodeVarint(out + size, nicknameId);
+    }
+    if (not(flags & FRAME_NICKNAME_ID)) {
+        size += encodeVarint(out + size, nicknameSize);
+    }
+    size += encodeVarint(out + size, messageSize);
+    return size;
+}
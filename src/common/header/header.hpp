@@ -1,7 +1,8 @@
 /**
  * @file header.hpp
  * @author Lucas Verbeiren (Main developer)
- * @brief Header file of the PacketHeader struct
+ * @brief Header file of the PacketHeader struct and of the frame headers of
+ * every protocol version
  * @date 2024
  *
  */
@@ -9,8 +10,57 @@
 #ifndef HEADER_HPP
 #define HEADER_HPP
 
+#include <cstddef>
 #include <cstdint>
 
+/**
+ * @brief Frames made of a PacketHeader, a nickname and a message. The
+ * handshake always uses this layout, so that any server can read it.
+ */
+constexpr uint8_t PROTOCOL_V1 = 1;
+
+/**
+ * @brief Frames made of [version][flags][nickname size][message size]
+ * [nickname][message], the sizes being varints (7 bits per byte, least
+ * significant first, high bit set on every byte but the last).
+ */
+constexpr uint8_t PROTOCOL_V2 = 2;
+
+constexpr uint8_t FRAME_MORE = 0x01; //< v2 flag: the message goes on
+
+/**
+ * @brief v2 flag: the header holds a varint nickname id instead of the
+ * nickname size, and the frame has no nickname: it is the one bound to the id.
+ */
+constexpr uint8_t FRAME_NICKNAME_ID = 0x02;
+
+/**
+ * @brief v2 flag: the header holds a varint nickname id before the sizes, and
+ * the nickname of the frame is bound to it for the following frames.
+ */
+constexpr uint8_t FRAME_NICKNAME_BIND = 0x04;
+
+/**
+ * @brief v2 flag: the message is compressed (see StreamCompressor), its size
+ * being the compressed one.
+ */
+constexpr uint8_t FRAME_COMPRESSED = 0x08;
+
+/**
+ * @brief Handshake capability: nickname ids may be used in both directions.
+ *
+ * @details The byte of the handshake message and the server's response hold
+ * a version in their low nibble and capabilities in their high one.
+ */
+constexpr uint8_t CAP_NICKNAME_IDS = 0x10;
+constexpr uint8_t CAP_COMPRESSION = 0x20; //< Messages may be compressed
+constexpr uint8_t VERSION_MASK = 0x0f;
+
+constexpr uint32_t MAX_NICKNAME_IDS = 1 << 14; //< Ids fit in 2 varint bytes
+constexpr uint32_t MAX_CLIENT_NICKNAME_IDS = 256; //< Bound by a client
+constexpr size_t MAX_VARINT_SIZE = 4; //< Bytes, so sizes below 2^28
+constexpr size_t MAX_HEADER_SIZE = 2 + 3 * MAX_VARINT_SIZE; //< Any version
+
 /**
  * @brief Represent the header of a packet.
  *
@@ -23,4 +73,30 @@ struct __attribute__((packed)) PacketHeader {
     uint8_t nicknameSize;
 };
 
+/**
+ * @brief Write a varint.
+ *
+ * @param out Room for MAX_VARINT_SIZE bytes.
+ * @param value The value, below 2^28.
+ *
+ * @return size_t The number of bytes written.
+ */
+size_t encodeVarint(char *out, size_t value);
+
+/**
+ * @brief Write the header of a frame.
+ *
+ * @param out Room for MAX_HEADER_SIZE bytes.
+ * @param version The version of the frame (PROTOCOL_V1 drops the flags).
+ * @param nicknameSize The size of the nickname.
+ * @param messageSize The size of the message.
+ * @param flags The v2 flags.
+ * @param nicknameId The id, with FRAME_NICKNAME_ID or FRAME_NICKNAME_BIND.
+ *
+ * @return size_t The size of the header.
+ */
+size_t encodeHeader(char *out, uint8_t version, size_t nicknameSize,
+                    size_t messageSize, uint8_t flags = 0,
+                    uint32_t nicknameId = 0);
+
 #endif // HEADER_HPP
@@ -0,0 +1,214 @@
+/**
+ * @file scan.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file of the vectorized scanning of messages
+ * @date 2024
+ *
+ */
+
+#include "scan.hpp"
+
+#include <atomic>
+#include <cstring>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/**
+ * @brief The kernels of a level
+ *
+ * @note The AVX2 ones never call the others: returning to SSE code with the
+ * upper halves of the registers dirty costs more than the scan.
+ */
+struct ScanKernels {
+    ScanLevel level;
+    void (*masks)(const char *block, char first, char second,
+                  uint32_t &firsts, uint32_t &seconds); //< SCAN_BLOCK bytes
+    void (*replace)(char *data, size_t size, char from, char to);
+};
+
+// ### Scalar ###
+
+void masksScalar(const char *block, char first, char second,
+                 uint32_t &firsts, uint32_t &seconds) {
+    firsts = seconds = 0;
+    for (size_t i = 0; i < SCAN_BLOCK; ++i) {
+        firsts |= uint32_t(block[i] == first) << i;
+        seconds |= uint32_t(block[i] == second) << i;
+    }
+}
+
+void replaceScalar(char *data, size_t size, char from, char to) {
+    for (char *end = data + size; data < end; ++data)
+        if (*data == from) *data = to;
+}
+
+constexpr ScanKernels SCALAR = {ScanLevel::SCALAR, masksScalar,
+                                replaceScalar};
+
+#ifdef __x86_64__
+
+// ### SSE2 (always there on x86-64) ###
+
+uint32_t mask16(const char *data, char chr) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(chr)));
+}
+
+void masksSse2(const char *block, char first, char second, uint32_t &firsts,
+               uint32_t &seconds) {
+    firsts = mask16(block, first) | mask16(block + 16, first) << 16;
+    seconds = mask16(block, second) | mask16(block + 16, second) << 16;
+}
+
+/**
+ * @brief Replace in the 16 bytes at data (inlined in the AVX2 kernel too)
+ */
+inline __attribute__((always_inline)) void replace16(char *data, char from,
+                                                     char to) {
+    __m128i *at = reinterpret_cast<__m128i *>(data);
+    __m128i chunk = _mm_loadu_si128(at);
+    __m128i found = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(from));
+    if (_mm_movemask_epi8(found) == 0) return;
+    _mm_storeu_si128(at, _mm_or_si128(_mm_and_si128(found, _mm_set1_epi8(to)),
+                                      _mm_andnot_si128(found, chunk)));
+}
+
+void replaceSse2(char *data, size_t size, char from, char to) {
+    if (size < 16) return replaceScalar(data, size, from, to);
+    for (size_t i = 0; i + 16 <= size; i += 16) replace16(data + i, from, to);
+    // The last bytes again with the ones before: replaced already
+    if (size % 16 != 0) replace16(data + size - 16, from, to);
+}
+
+constexpr ScanKernels SSE2 = {ScanLevel::SSE2, masksSse2, replaceSse2};
+
+// ### AVX2 (if the CPU has it) ###
+
+__attribute__((target("avx2"))) void masksAvx2(const char *block, char first,
+                                               char second, uint32_t &firsts,
+                                               uint32_t &seconds) {
+    __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+    firsts = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(first)));
+    seconds = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(second)));
+}
+
+__attribute__((target("avx2"))) inline void replace32(char *data, char from,
+                                                      char to) {
+    __m256i *at = reinterpret_cast<__m256i *>(data);
+    __m256i chunk = _mm256_loadu_si256(at);
+    __m256i found = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(from));
+    if (_mm256_movemask_epi8(found) == 0) return;
+    _mm256_storeu_si256(
+        at, _mm256_blendv_epi8(chunk, _mm256_set1_epi8(to), found));
+}
+
+__attribute__((target("avx2"))) void replaceAvx2(char *data, size_t size,
+                                                 char from, char to) {
+    if (size < 16) {
+        for (char *end = data + size; data < end; ++data)
+            if (*data == from) *data = to;
+    } else if (size < 32) {
+        replace16(data, from, to);
+        replace16(data + size - 16, from, to);
+    } else {
+        for (size_t i = 0; i + 32 <= size; i += 32)
+            replace32(data + i, from, to);
+        if (size % 32 != 0) replace32(data + size - 32, from, to);
+    }
+}
+
+constexpr ScanKernels AVX2 = {ScanLevel::AVX2, masksAvx2, replaceAvx2};
+
+#endif
+
+// ### Dispatch ###
+
+const ScanKernels *bestKernels() {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return &AVX2;
+    return &SSE2;
+#else
+    return &SCALAR;
+#endif
+}
+
+atomic<const ScanKernels *> current{nullptr}; //< Chosen on the first scan
+
+const ScanKernels &kernels() {
+    const ScanKernels *chosen = current.load(memory_order_relaxed);
+    if (chosen == nullptr) {
+        chosen = bestKernels();
+        current.store(chosen, memory_order_relaxed);
+    }
+    return *chosen;
+}
+
+} // namespace
+
+// ### CharScanner ###
+
+CharScanner::CharScanner(string_view data, char first, char second)
+    : data_(data), first_(first), second_(second) {}
+
+void CharScanner::load(size_t block) {
+    block_ = block;
+    size_t size = data_.size() - block;
+    if (size >= SCAN_BLOCK) {
+        kernels().masks(data_.data() + block, first_, second_, firsts_,
+                        seconds_);
+        return;
+    }
+
+    // The end of the data: copied, not to read past it
+    char tail[SCAN_BLOCK] = {};
+    memcpy(tail, data_.data() + block, size);
+    kernels().masks(tail, first_, second_, firsts_, seconds_);
+    uint32_t inData = (uint32_t(1) << size) - 1;
+    firsts_ &= inData;
+    seconds_ &= inData;
+}
+
+// ### Functions ###
+
+size_t scanByte(string_view data, size_t from, char chr) {
+    // glibc already picks a vectorized memchr for the CPU
+    if (from >= data.size()) return string_view::npos;
+    const void *found = memchr(data.data() + from, chr, data.size() - from);
+    return found ? static_cast<const char *>(found) - data.data()
+                 : string_view::npos;
+}
+
+void replaceByte(char *data, size_t size, char from, char to) {
+    kernels().replace(data, size, from, to);
+}
+
+ScanLevel scanLevel() { return bestKernels()->level; }
+
+void forceScanLevel(ScanLevel level) {
+    const ScanKernels *chosen = bestKernels();
+#ifdef __x86_64__
+    if (level == ScanLevel::SSE2 and chosen->level == ScanLevel::AVX2)
+        chosen = &SSE2;
+#endif
+    if (level == ScanLevel::SCALAR) chosen = &SCALAR;
+    current.store(chosen, memory_order_relaxed);
+}
+
+const char *scanLevelName(ScanLevel level) {
+    switch (level) {
+    case ScanLevel::AVX2:
+        return "avx2";
+    case ScanLevel::SSE2:
+        return "sse2";
+    default:
+        return "scalaire";
+    }
+}
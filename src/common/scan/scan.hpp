@@ -0,0 +1,94 @@
+/**
+ * @file scan.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file of the vectorized scanning of messages
+ * @date 2024
+ *
+ */
+
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+using namespace std;
+
+constexpr size_t SCAN_BLOCK = 32; //< Bytes compared at once by a scanner
+
+/**
+ * @brief The instruction sets of the scanning kernels
+ */
+enum class ScanLevel {
+    SCALAR,
+    SSE2, //< 16 bytes at a time
+    AVX2, //< 32 bytes at a time
+};
+
+/**
+ * @brief Finds two characters in some data, comparing a whole block of
+ * SCAN_BLOCK bytes at once and keeping its masks for the next searches.
+ */
+class CharScanner {
+  private:
+    string_view data_;
+    char first_, second_;
+    size_t block_ = string_view::npos; //< Start of the block of the masks
+    uint32_t firsts_ = 0, seconds_ = 0; //< Bit i: data_[block_ + i] matches
+
+    /**
+     * @brief Compute the masks of the block starting at data_[block].
+     */
+    void load(size_t block);
+
+  public:
+    CharScanner(string_view data, char first, char second);
+
+    /**
+     * @brief Find the first first (or second, if both) at or after from.
+     *
+     * @return size_t Its index, or the data size if none.
+     */
+    size_t next(size_t from, bool both) {
+        while (from < data_.size()) {
+            size_t block = from & ~(SCAN_BLOCK - 1);
+            if (block != block_) load(block);
+            uint32_t mask = (firsts_ | (both ? seconds_ : 0))
+                            & (~uint32_t(0) << (from - block));
+            if (mask != 0) return block + __builtin_ctz(mask);
+            from = block + SCAN_BLOCK;
+        }
+        return data_.size();
+    }
+};
+
+/**
+ * @brief Find the first chr of data at or after from.
+ *
+ * @return size_t Its index, or string_view::npos if none.
+ */
+size_t scanByte(string_view data, size_t from, char chr);
+
+/**
+ * @brief Replace every from of the size bytes of data by to.
+ */
+void replaceByte(char *data, size_t size, char from, char to);
+
+/**
+ * @brief The best level supported by the CPU, chosen on the first scan.
+ */
+ScanLevel scanLevel();
+
+/**
+ * @brief Use the kernels of a level instead (no higher than scanLevel()),
+ * to compare them.
+ */
+void forceScanLevel(ScanLevel level);
+
+/**
+ * @brief The name of a level, as reported by the microbenchmarks.
+ */
+const char *scanLevelName(ScanLevel level);
+
+#endif
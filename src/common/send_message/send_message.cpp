@@ -23,24 +23,28 @@
 
 using namespace std;
 
-SendMessageReturnVal sendMessage(int sockFd, const string &nickname,
-                                 const string &message, uint8_t version) {
+SendMessageReturnVal sendMessage(int sockFd, string_view nickname,
+                                 string_view message, uint8_t version,
+                                 uint8_t flags, uint32_t nicknameId) {
 
-    uint8_t nicknameSize = nickname.size();
-    uint16_t messageSize = message.size();
-    uint16_t totalSize = sizeof(PacketHeader) + messageSize + nicknameSize;
+    if (version >= PROTOCOL_V2 and (flags & FRAME_NICKNAME_ID)) nickname = {};
+    size_t nicknameSize = nickname.size();
+    size_t messageSize = message.size();
 
-    PacketHeader header{version, htons(totalSize), nicknameSize};
+    char header[MAX_HEADER_SIZE];
+    size_t headerSize =
+        encodeHeader(header, version, nicknameSize, messageSize, flags,
+                     nicknameId);
 
     struct iovec iov[3];
-    iov[0].iov_base = &header;
-    iov[0].iov_len = sizeof(header);
+    iov[0].iov_base = header;
+    iov[0].iov_len = headerSize;
     iov[1].iov_base = const_cast<char *>(nickname.data());
     iov[1].iov_len = nicknameSize;
     iov[2].iov_base = const_cast<char *>(message.data());
     iov[2].iov_len = messageSize;
 
-    size_t numBytes = sizeof(PacketHeader) + nicknameSize + messageSize,
+    size_t numBytes = headerSize + nicknameSize + messageSize,
            iovcnt = sizeof(iov) / sizeof(struct iovec);
 
     int bytesWritten = writev(sockFd, iov, iovcnt);
@@ -56,3 +60,15 @@ SendMessageReturnVal sendMessage(int sockFd, const string &nickname,
 
     return SendMessageReturnVal::COULD_NOT_WRITE_ALL_BYTES;
 }
+
+void appendMessage(string &out, string_view nickname, string_view message,
+                   uint8_t version, uint8_t flags, uint32_t nicknameId) {
+    if (version >= PROTOCOL_V2 and (flags & FRAME_NICKNAME_ID)) nickname = {};
+
+    char header[MAX_HEADER_SIZE];
+    size_t headerSize = encodeHeader(header, version, nickname.size(),
+                                     message.size(), flags, nicknameId);
+    out.append(header, headerSize);
+    out.append(nickname);
+    out.append(message);
+}
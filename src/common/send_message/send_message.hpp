@@ -16,6 +16,7 @@
 #include <netinet/in.h>
 #include <pthread.h>
 #include <string>
+#include <string_view>
 #include <sys/uio.h>
 #include <unistd.h>
 
@@ -37,10 +38,26 @@ enum class SendMessageReturnVal {
  *
  * @param sockFd The recipient's socket.
  * @param nickname The nickname associated with the message.
- * @param nickname The message.
- * @param nickname The protocol version.
+ * @param message The message.
+ * @param version The protocol version.
+ * @param flags The v2 flags, ignored by v1 (with FRAME_NICKNAME_ID, the
+ * nickname is not sent).
+ * @param nicknameId The nickname's id, with FRAME_NICKNAME_ID or
+ * FRAME_NICKNAME_BIND.
  */
-SendMessageReturnVal sendMessage(int sockFd, const string &nickname,
-                                 const string &message, uint8_t version);
+SendMessageReturnVal sendMessage(int sockFd, string_view nickname,
+                                 string_view message, uint8_t version,
+                                 uint8_t flags = 0, uint32_t nicknameId = 0);
+
+/**
+ * @brief Append the frame sendMessage would send to a buffer, so that many of
+ * them are sent in one write.
+ *
+ * @param out The buffer.
+ * @see sendMessage for the other parameters.
+ */
+void appendMessage(string &out, string_view nickname, string_view message,
+                   uint8_t version, uint8_t flags = 0,
+                   uint32_t nicknameId = 0);
 
 #endif
@@ -17,6 +17,7 @@ bool setSigMask(bool block) {
     sigaddset(&emptySet, SIGINT);
     sigaddset(&emptySet, SIGPIPE);
     sigaddset(&emptySet, SIGTERM);
+    sigaddset(&emptySet, SIGUSR2); //< Hot upgrade of the server
     if (pthread_sigmask(block ? SIG_BLOCK : SIG_UNBLOCK, &emptySet, NULL)
         != 0) {
         cerr << "Err: Le programme ne peut altérater son masque de signaux."
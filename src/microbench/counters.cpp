@@ -0,0 +1,96 @@
+/**
+ * @file counters.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the allocation and system call counters of the
+ * microbenchmarks
+ * @date 2024
+ *
+ */
+
+#include "counters.hpp"
+
+#include <cstdlib>
+#include <new>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+atomic<uint64_t> allocationCount = 0;
+atomic<uint64_t> syscallCount = 0;
+
+// ### Allocations ###
+
+#ifndef __SANITIZE_THREAD__
+void *operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) throw bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+void operator delete[](void *ptr) noexcept { free(ptr); }
+
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+#endif
+
+// ### System calls (linked with -Wl,--wrap=<name>) ###
+
+extern "C" {
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+ssize_t __real_recv(int fd, void *buf, size_t len, int flags);
+ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __real_recvmsg(int fd, struct msghdr *msg, int flags);
+ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_write(fd, buf, count);
+}
+
+ssize_t __wrap_readv(int fd, const struct iovec *iov, int iovcnt) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_readv(fd, iov, iovcnt);
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_writev(fd, iov, iovcnt);
+}
+
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_recv(fd, buf, len, flags);
+}
+
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_send(fd, buf, len, flags);
+}
+
+ssize_t __wrap_recvmsg(int fd, struct msghdr *msg, int flags) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_recvmsg(fd, msg, flags);
+}
+
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags) {
+    syscallCount.fetch_add(1, memory_order_relaxed);
+    return __real_sendmsg(fd, msg, flags);
+}
+}
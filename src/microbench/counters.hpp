@@ -0,0 +1,34 @@
+/**
+ * @file counters.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the allocation and system call counters of the
+ * microbenchmarks
+ * @date 2024
+ *
+ */
+
+#ifndef COUNTERS_HPP
+#define COUNTERS_HPP
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * @brief Number of calls to operator new since the program started (always 0
+ * in ThreadSanitizer builds, which own the allocator).
+ */
+extern atomic<uint64_t> allocationCount;
+
+/**
+ * @brief Number of I/O system calls made by the Linkly code since the program
+ * started.
+ *
+ * @note Counted by wrapping read, write, readv, writev, recv, send, recvmsg
+ * and sendmsg at link time (-Wl,--wrap), so the calls made by the C and C++
+ * libraries themselves are not counted.
+ */
+extern atomic<uint64_t> syscallCount;
+
+#endif // COUNTERS_HPP
@@ -0,0 +1,353 @@
+/**
+ * @file main.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Microbenchmarks of the protocol, queue and formatting hot paths
+ * @date 2024
+ *
+ */
+
+#include "../chat/client.hpp"
+#include "../chat/message_queue/message_queue.hpp"
+#include "../chat/output_writer/output_writer.hpp"
+#include "../chat/text.hpp"
+#include "../common/compression/compression.hpp"
+#include "../common/frame_decoder/frame_decoder.hpp"
+#include "../common/safe_read/safe_read.hpp"
+#include "../common/scan/scan.hpp"
+#include "../common/safe_write/safe_write.hpp"
+#include "../common/send_message/send_message.hpp"
+#include "microbench.hpp"
+#include "relay.hpp"
+
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned BATCH = 16;    //< Frames written before decoding them
+
+volatile size_t sink; //< Keeps the results of the operations alive
+
+/**
+ * @brief A connected pair of stream sockets, closed on destruction.
+ */
+struct SocketPair {
+    int fds[2] = {-1, -1};
+
+    SocketPair() {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+            perror("socketpair");
+        }
+    }
+    ~SocketPair() {
+        close(fds[0]);
+        close(fds[1]);
+    }
+};
+
+// ### Protocol ###
+
+void benchFrames(Microbench &bench, size_t messageSize) {
+    const string suffix = "/" + to_string(messageSize) + "B";
+    const string nickname = "destinataire";
+    const string message(messageSize, 'x');
+
+    bench.run("frame/send+decode" + suffix, 100000, [&](uint64_t ops) {
+        SocketPair pair;
+        FrameDecoder decoder(CURRENT_VERSION, MAX_LENGTH_PSEUDO,
+                             BUFFER_SIZE_MESSAGE);
+        FrameView frame;
+        for (uint64_t i = 0; i < ops; ++i) {
+            sendMessage(pair.fds[0], nickname, message, CURRENT_VERSION);
+            if (decodeFrame(decoder, pair.fds[1], frame)) {
+                sink = frame.message.size();
+            }
+        }
+    });
+
+    bench.run("frame/send+decode-batch" + suffix, 100000, [&](uint64_t ops) {
+        SocketPair pair;
+        FrameDecoder decoder(CURRENT_VERSION, MAX_LENGTH_PSEUDO,
+                             BUFFER_SIZE_MESSAGE);
+        FrameView frame;
+        for (uint64_t i = 0; i < ops; i += BATCH) {
+            for (unsigned j = 0; j < BATCH; ++j) {
+                sendMessage(pair.fds[0], nickname, message, CURRENT_VERSION);
+            }
+            for (unsigned j = 0; j < BATCH; ++j) {
+                if (decodeFrame(decoder, pair.fds[1], frame)) {
+                    sink = frame.message.size();
+                }
+            }
+        }
+    });
+
+    // Same, the nickname bound to an id by the first frame
+    bench.run("frame/send+decode-batch-ids" + suffix, 100000,
+              [&](uint64_t ops) {
+        SocketPair pair;
+        FrameDecoder decoder(CURRENT_VERSION, MAX_LENGTH_PSEUDO,
+                             BUFFER_SIZE_MESSAGE);
+        decoder.allowNicknameIds(MAX_NICKNAME_IDS);
+        FrameView frame;
+        uint8_t flags = FRAME_NICKNAME_BIND;
+        for (uint64_t i = 0; i < ops; i += BATCH) {
+            for (unsigned j = 0; j < BATCH; ++j) {
+                sendMessage(pair.fds[0], nickname, message, CURRENT_VERSION,
+                            flags, 0);
+                flags = FRAME_NICKNAME_ID;
+            }
+            for (unsigned j = 0; j < BATCH; ++j) {
+                if (decodeFrame(decoder, pair.fds[1], frame)) {
+                    sink = frame.nickname.size() + frame.message.size();
+                }
+            }
+        }
+    });
+}
+
+void benchCompression(Microbench &bench) {
+    // Messages of a bot: the same template, a few fields changing
+    vector<string> messages;
+    for (unsigned i = 0; i < 64; ++i) {
+        messages.push_back("[capteur-" + to_string(i % 3) + "] temperature="
+                           + to_string(20 + i % 7) + " humidite="
+                           + to_string(40 + i % 11)
+                           + " statut=OK site=bruxelles-nord");
+    }
+
+    bench.run("compress/template", 300000, [&](uint64_t ops) {
+        StreamCompressor compressor(BUFFER_SIZE_MESSAGE);
+        char out[BUFFER_SIZE_MESSAGE];
+        for (uint64_t i = 0; i < ops; ++i) {
+            sink = compressor.compress(messages[i % messages.size()], out);
+        }
+    });
+
+    bench.run("compress/template+decompress", 300000, [&](uint64_t ops) {
+        StreamCompressor compressor(BUFFER_SIZE_MESSAGE);
+        StreamDecompressor decompressor(BUFFER_SIZE_MESSAGE);
+        char out[BUFFER_SIZE_MESSAGE];
+        string_view message;
+        for (uint64_t i = 0; i < ops; ++i) {
+            size_t size =
+                compressor.compress(messages[i % messages.size()], out);
+            if (size > 0) {
+                decompressor.decompress(string_view(out, size), message);
+            }
+            sink = message.size();
+        }
+    });
+}
+
+void benchSafeIo(Microbench &bench) {
+    bench.run("safe/write+read/64B", 100000, [&](uint64_t ops) {
+        SocketPair pair;
+        char out[64] = {}, in[64];
+        for (uint64_t i = 0; i < ops; ++i) {
+            safeWrite(pair.fds[0], out, sizeof(out));
+            safeRead(pair.fds[1], in, sizeof(in));
+        }
+        sink = in[0];
+    });
+}
+
+// ### Client queue ###
+
+struct QueueBench {
+    MessageQueue queue;
+    uint64_t ops;
+};
+
+void *produce(void *arg) {
+    QueueBench *bench = static_cast<QueueBench *>(arg);
+    const string sender = "expediteur", content = "un message assez court";
+    for (uint64_t i = 0; i < bench->ops; ++i) {
+        while (not bench->queue.push(sender, content)) sched_yield();
+    }
+    return nullptr;
+}
+
+void benchQueue(Microbench &bench) {
+    bench.run("queue/push+pop", 1000000, [&](uint64_t ops) {
+        MessageQueue queue;
+        const string sender = "expediteur", content = "un message assez court";
+        Message message;
+        for (uint64_t i = 0; i < ops; ++i) {
+            queue.push(sender, content);
+            queue.pop(message);
+            sink = message.content.size();
+        }
+    });
+
+    // The receiving thread pushes while the main one prints
+    bench.run("queue/push+pop-threads", 300000, [&](uint64_t ops) {
+        QueueBench shared;
+        shared.ops = ops;
+        pthread_t producer;
+        pthread_create(&producer, nullptr, produce, &shared);
+
+        Message message;
+        for (uint64_t popped = 0; popped < ops;) {
+            if (not shared.queue.pop(message)) {
+                sched_yield();
+                continue;
+            }
+            sink = message.content.size();
+            ++popped;
+        }
+        pthread_join(producer, nullptr);
+    });
+}
+
+// ### Formatting ###
+
+/**
+ * @brief Read a pipe until it is closed (thread function).
+ */
+void *drainPipe(void *arg) {
+    int fd = *static_cast<int *>(arg);
+    char buffer[64 * 1024];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+    return nullptr;
+}
+
+// As the client displays the messages: formatted into a reused buffer
+void benchText(Microbench &bench) {
+    const string nickname = "expediteur";
+    const string plain =
+        "Salut, est-ce que tu as vu le dernier message sur le canal ?";
+    const string tagged = "Salut, \\red{est-ce que} tu as vu le \\bold{dernier "
+                          "\\underline{message}} sur le "
+                          "\\link{canal}{https://example.org} ?";
+    string out;
+
+    bench.run("text/plain", 1000000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; ++i) {
+            out.clear();
+            Text::format(out, nickname, plain, false, false);
+            sink = out.size();
+        }
+    });
+
+    // Balise mode, but no tag in the message
+    bench.run("text/balise-plain", 1000000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; ++i) {
+            out.clear();
+            Text::format(out, nickname, plain, false, true);
+            sink = out.size();
+        }
+    });
+
+    bench.run("text/balise", 300000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; ++i) {
+            out.clear();
+            Text::format(out, nickname, tagged, false, true);
+            sink = out.size();
+        }
+    });
+
+    bench.run("text/balise-bot", 300000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; ++i) {
+            out.clear();
+            Text::format(out, nickname, tagged, true, true);
+            sink = out.size();
+        }
+    });
+
+    // A tag left open: text, found at the end of the message
+    const string unclosed = "\\bold{" + tagged;
+    bench.run("text/balise-unclosed", 300000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; ++i) {
+            out.clear();
+            Text::format(out, nickname, unclosed, false, true);
+            sink = out.size();
+        }
+    });
+
+    // The whole display of a received message, to a pipe: written in bulk by
+    // the thread of the writer
+    if (bench.selected("text/output-writer")) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            perror("pipe");
+            return;
+        }
+        pthread_t drain;
+        pthread_create(&drain, nullptr, drainPipe, &fds[0]);
+        {
+            OutputWriter output(fds[1]);
+            output.start();
+            bench.run("text/output-writer", 1000000, [&](uint64_t ops) {
+                for (uint64_t i = 0; i < ops; ++i) {
+                    output.writeMessage(nickname, tagged, false, true);
+                }
+            });
+        }
+        close(fds[1]);
+        pthread_join(drain, nullptr);
+        close(fds[0]);
+    }
+}
+
+void benchScan(Microbench &bench) {
+    // A long message without markup, a '}' at its end
+    string message(BUFFER_SIZE_MESSAGE, 'x');
+    message.back() = '}';
+    string nickname = "un-pseudo-avec-des-tirets";
+
+    const ScanLevel best = scanLevel();
+    for (ScanLevel level : {ScanLevel::SCALAR, ScanLevel::SSE2,
+                            ScanLevel::AVX2}) {
+        if (level > best) break;
+        forceScanLevel(level);
+        const string suffix = string("/") + scanLevelName(level);
+
+        bench.run("scan/tags" + suffix, 100000, [&](uint64_t ops) {
+            for (uint64_t i = 0; i < ops; ++i) {
+                sink = CharScanner(message, '\\', '}').next(0, true);
+            }
+        });
+
+        bench.run("scan/hyphens" + suffix, 1000000, [&](uint64_t ops) {
+            for (uint64_t i = 0; i < ops; ++i) {
+                string copy = nickname;
+                replaceByte(copy.data(), copy.size(), '-', ' ');
+                sink = copy.size();
+            }
+        });
+    }
+    forceScanLevel(best);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [filtre]\n", argv[0]);
+        return 1;
+    }
+
+    Microbench bench(argc == 2 ? argv[1] : "");
+    bench.requireAllocationFree("text/");
+    bench.requireAllocationFree("relay/");
+    Microbench::reportHeader();
+
+    benchFrames(bench, 32);
+    benchFrames(bench, BUFFER_SIZE_MESSAGE);
+    benchCompression(bench);
+    benchSafeIo(bench);
+    benchQueue(bench);
+    benchText(bench);
+    benchScan(bench);
+    benchRelay(bench);
+    return bench.passed() ? 0 : 1;
+}
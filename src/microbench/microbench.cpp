@@ -0,0 +1,67 @@
+/**
+ * @file microbench.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the harness of the microbenchmarks
+ * @date 2024
+ *
+ */
+
+#include "microbench.hpp"
+
+#include <cstdio>
+
+using namespace std;
+
+// ### Constructor ###
+Microbench::Microbench(const string &filter) : filter_(filter) {}
+
+// ### Private methods ###
+
+void Microbench::finish(const MicrobenchResult &result) {
+    report(result);
+    if (result.allocationsPerOp == 0) return;
+    for (const string &prefix : allocationFree_) {
+        if (result.name.compare(0, prefix.size(), prefix) == 0) {
+            fprintf(stderr,
+                    "Err: %s alloue (%.4f allocations par opération).\n",
+                    result.name.c_str(), result.allocationsPerOp);
+            failed_ = true;
+            return;
+        }
+    }
+}
+
+// ### Public methods ###
+
+bool Microbench::selected(const string &name) const {
+    return name.find(filter_) != string::npos;
+}
+
+void Microbench::requireAllocationFree(const string &prefix) {
+    allocationFree_.push_back(prefix);
+}
+
+bool Microbench::passed() const { return not failed_; }
+
+void Microbench::report(const MicrobenchResult &result) {
+    printf("%-32s %12.1f %12.2f %12.2f\n", result.name.c_str(),
+           result.nsPerOp, result.allocationsPerOp, result.syscallsPerOp);
+    fflush(stdout);
+}
+
+void Microbench::reportHeader() {
+    printf("%-32s %12s %12s %12s\n", "benchmark", "ns/op", "allocs/op",
+           "syscalls/op");
+}
+
+// ### Helpers ###
+
+bool decodeFrame(FrameDecoder &decoder, int fd, FrameView &frame) {
+    while (true) {
+        DecodeReturnVal ret = decoder.next(frame);
+        if (ret == DecodeReturnVal::FRAME_READY) return true;
+        if (ret != DecodeReturnVal::NEED_MORE or decoder.fill(fd) <= 0) {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,132 @@
+/**
+ * @file microbench.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the harness of the microbenchmarks
+ * @date 2024
+ *
+ */
+
+#ifndef MICROBENCH_HPP
+#define MICROBENCH_HPP
+
+#include "../common/frame_decoder/frame_decoder.hpp"
+#include "counters.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+constexpr unsigned MICROBENCH_REPETITIONS = 5; //< The median one is kept
+
+/**
+ * @brief The cost of one operation of a benchmark.
+ */
+struct MicrobenchResult {
+    string name;
+    double nsPerOp;
+    double allocationsPerOp;
+    double syscallsPerOp;
+};
+
+/**
+ * @class Microbench
+ * @brief Runs benchmarks and reports what one operation costs.
+ *
+ * @details Every benchmark is warmed up, then run MICROBENCH_REPETITIONS
+ * times; the median time is reported, with the allocations and system calls
+ * counted over all the repetitions.
+ *
+ * The benchmarks of the paths that must not allocate are checked: the
+ * program fails if one of them does.
+ */
+class Microbench {
+  private:
+    string filter_; //< Only the benchmarks whose name contains it are run
+    vector<string> allocationFree_; //< Prefixes of the checked benchmarks
+    bool failed_ = false;           //< A checked benchmark allocated
+
+    /**
+     * @brief Report a result and check it.
+     */
+    void finish(const MicrobenchResult &result);
+
+  public:
+    /**
+     * @brief Construct a new Microbench object.
+     *
+     * @param filter Substring selecting the benchmarks to run.
+     */
+    explicit Microbench(const string &filter = "");
+
+    /**
+     * @brief Check whether a benchmark is filtered out, to skip its setup.
+     */
+    bool selected(const string &name) const;
+
+    /**
+     * @brief Make the benchmarks whose name starts with prefix fail if they
+     * allocate.
+     */
+    void requireAllocationFree(const string &prefix);
+
+    /**
+     * @brief Whether every checked benchmark run so far allocated nothing.
+     */
+    bool passed() const;
+
+    /**
+     * @brief Run a benchmark, unless it is filtered out.
+     *
+     * @param name The name of the benchmark.
+     * @param ops The number of operations per repetition.
+     * @param run Callable performing the given number of operations.
+     */
+    template <typename Run>
+    void run(const string &name, uint64_t ops, Run run) {
+        if (not selected(name)) return;
+
+        run(ops / 10 + 1);
+
+        vector<double> times;
+        times.reserve(MICROBENCH_REPETITIONS); //< Not counted
+        uint64_t allocations = allocationCount;
+        uint64_t syscalls = syscallCount;
+        for (unsigned i = 0; i < MICROBENCH_REPETITIONS; ++i) {
+            auto start = chrono::steady_clock::now();
+            run(ops);
+            chrono::duration<double, nano> elapsed =
+                chrono::steady_clock::now() - start;
+            times.push_back(elapsed.count() / ops);
+        }
+        double total = static_cast<double>(ops) * MICROBENCH_REPETITIONS;
+        allocations = allocationCount - allocations;
+        syscalls = syscallCount - syscalls;
+
+        sort(times.begin(), times.end());
+        finish({name, times[times.size() / 2], allocations / total,
+                syscalls / total});
+    }
+
+    /**
+     * @brief Print a result as a row of the table.
+     */
+    static void report(const MicrobenchResult &result);
+
+    /**
+     * @brief Print the header of the table.
+     */
+    static void reportHeader();
+};
+
+/**
+ * @brief Decode the next frame, reading the socket when needed.
+ *
+ * @return bool False if the socket failed or the frame was invalid.
+ */
+bool decodeFrame(FrameDecoder &decoder, int fd, FrameView &frame);
+
+#endif // MICROBENCH_HPP
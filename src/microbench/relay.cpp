@@ -0,0 +1,198 @@
+/**
+ * @file relay.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the microbenchmarks of the server relay path
+ * @date 2024
+ *
+ */
+
+#include "relay.hpp"
+
+#include "../common/safe_read/safe_read.hpp"
+#include "../common/header/header.hpp"
+#include "../common/send_message/send_message.hpp"
+#include "../common/signal/mask.hpp"
+#include "../serveur/server.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned BATCH = 16;           //< Frames sent before receiving them
+constexpr unsigned CONNECT_ATTEMPTS = 200; //< 10 ms apart
+const size_t RELAY_SIZES[] = {32, MAX_LENGTH_MESSAGE}; //< Message bytes
+const string NOTICE_NAME = "relay/notice";
+
+volatile size_t sink; //< Keeps the results of the operations alive
+
+void *runServer(void *) {
+    Server::getInstance().run();
+    return nullptr;
+}
+
+/**
+ * @brief Connect to the server and log on, retrying while it starts.
+ *
+ * @return int The socket, or -1 on failure.
+ */
+int logOn(const string &nickname) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(getenv("PORT_SERVEUR")));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (unsigned i = 0; i < CONNECT_ATTEMPTS; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) break;
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+            == 0) {
+            uint8_t response = 0;
+            if (sendMessage(fd, nickname, "", PROTOCOL_V1)
+                    == SendMessageReturnVal::SUCCESS
+                and safeRead(fd, reinterpret_cast<char *>(&response),
+                             sizeof(response))
+                and response == 1) {
+                return fd;
+            }
+            close(fd);
+            break;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    fprintf(stderr, "relay: connexion de %s impossible\n", nickname.c_str());
+    return -1;
+}
+
+/**
+ * @brief Write a whole buffer, whatever the server reads at once.
+ */
+void writeAll(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, buffer, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            return;
+        }
+        buffer += written;
+        size -= written;
+    }
+}
+
+string name(const string &kind, size_t messageSize) {
+    return "relay/" + kind + "/" + to_string(messageSize) + "B";
+}
+
+void benchSize(Microbench &bench, int alice, int bob, size_t messageSize) {
+    const string nickname = "bob";
+    FrameDecoder decoder(CURRENT_VERSION, MAX_LENGTH_NICKNAME,
+                         MAX_LENGTH_MESSAGE);
+    FrameView frame;
+
+    // Encoded once: the client side of the loop only writes and decodes
+    PacketHeader header{
+        PROTOCOL_V1,
+        htons(static_cast<uint16_t>(sizeof(header) + nickname.size()
+                                    + messageSize)),
+        static_cast<uint8_t>(nickname.size())};
+    string encoded(reinterpret_cast<const char *>(&header), sizeof(header));
+    encoded += nickname;
+    encoded.append(messageSize, 'x');
+    string batch;
+    for (unsigned i = 0; i < BATCH; ++i) batch += encoded;
+
+    bench.run(name("send+receive", messageSize), 20000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; ++i) {
+            writeAll(alice, encoded.data(), encoded.size());
+            if (decodeFrame(decoder, bob, frame)) {
+                sink = frame.message.size();
+            }
+        }
+    });
+
+    const string batchName = name("send+receive-batch", messageSize);
+    bench.run(batchName, 20000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; i += BATCH) {
+            writeAll(alice, batch.data(), batch.size());
+            for (unsigned j = 0; j < BATCH; ++j) {
+                if (decodeFrame(decoder, bob, frame)) {
+                    sink = frame.message.size();
+                }
+            }
+        }
+    });
+}
+
+// A message to a client that is not logged on, answered by a notice
+void benchNotice(Microbench &bench, int alice) {
+    const string nickname = "absent";
+    FrameDecoder decoder(CURRENT_VERSION, MAX_LENGTH_NICKNAME,
+                         MAX_LENGTH_MESSAGE);
+    FrameView frame;
+
+    PacketHeader header{
+        PROTOCOL_V1,
+        htons(static_cast<uint16_t>(sizeof(header) + nickname.size() + 32)),
+        static_cast<uint8_t>(nickname.size())};
+    string encoded(reinterpret_cast<const char *>(&header), sizeof(header));
+    encoded += nickname;
+    encoded.append(32, 'x');
+
+    bench.run(NOTICE_NAME, 20000, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; ++i) {
+            writeAll(alice, encoded.data(), encoded.size());
+            if (decodeFrame(decoder, alice, frame)) {
+                sink = frame.message.size();
+            }
+        }
+    });
+}
+
+} // namespace
+
+void benchRelay(Microbench &bench) {
+    // The server is only started if one of the benchmarks is selected
+    bool selected = bench.selected(NOTICE_NAME);
+    for (size_t size : RELAY_SIZES) {
+        selected = selected or bench.selected(name("send+receive", size))
+                   or bench.selected(name("send+receive-batch", size));
+    }
+    if (not selected) return;
+
+    setenv("PORT_SERVEUR", RELAY_PORT, 0);
+    setenv("IO_SERVEUR", "epoll", 1);
+    setenv("THREADS_SERVEUR", "1", 1);
+
+    // The exit signal must reach the server thread, which unblocks it
+    Server &server = Server::getInstance();
+    if (not setSigMask(true) or not server.init()) return;
+    pthread_t serverThread;
+    if (pthread_create(&serverThread, nullptr, runServer, nullptr) != 0) {
+        perror("pthread_create");
+        return;
+    }
+
+    int alice = logOn("alice");
+    int bob = alice < 0 ? -1 : logOn("bob");
+    if (bob >= 0) {
+        for (size_t size : RELAY_SIZES) benchSize(bench, alice, bob, size);
+        benchNotice(bench, alice);
+    }
+    if (alice >= 0) close(alice);
+    if (bob >= 0) close(bob);
+
+    pthread_kill(serverThread, SIGTERM);
+    pthread_join(serverThread, nullptr);
+}
@@ -0,0 +1,29 @@
+/**
+ * @file relay.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the microbenchmarks of the server relay path
+ * @date 2024
+ *
+ */
+
+#ifndef RELAY_HPP
+#define RELAY_HPP
+
+#include "microbench.hpp"
+
+constexpr const char *RELAY_PORT = "47321"; //< Unless PORT_SERVEUR is set
+
+/**
+ * @brief Relay frames between two clients of an in-process server.
+ *
+ * @details The server runs on its own thread with a single epoll reactor; one
+ * operation is a frame sent by a client and received by the other, so the
+ * allocations reported are those of the whole relay loop, server included
+ * (0 once its pools are warm, which the harness checks). Messages to a client
+ * that is not logged on are measured as well, with the notice they get.
+ *
+ * @param bench The harness.
+ */
+void benchRelay(Microbench &bench);
+
+#endif // RELAY_HPP
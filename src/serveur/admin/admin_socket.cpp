@@ -0,0 +1,151 @@
+/**
+ * @file admin_socket.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the local administration socket of the server
+ * @date 2024
+ *
+ */
+
+#include "admin_socket.hpp"
+#include "../../common/safe_write/safe_write.hpp"
+#include "../../common/signal/mask.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// ### Destructor ###
+AdminSocket::~AdminSocket() { stop(); }
+
+// ### Private methods ###
+
+void *AdminSocket::threadFunc(void *arg) {
+    AdminSocket *admin = static_cast<AdminSocket *>(arg);
+
+    while (admin->running_) {
+        int clientFd = accept4(admin->listenFd_, nullptr, nullptr,
+                               SOCK_CLOEXEC);
+        if (clientFd < 0) {
+            // stop() shuts the socket down, which ends the accept
+            if (admin->running_ and errno != EINTR
+                and errno != ECONNABORTED) {
+                cerr << "Err: Échec de l'acceptation d'un client "
+                        "d'administration - "
+                     << strerror(errno) << endl;
+            }
+            continue;
+        }
+        admin->serve(clientFd);
+        if (::close(clientFd) != 0) {
+            perror("close");
+        }
+    }
+    return nullptr;
+}
+
+void AdminSocket::serve(int clientFd) {
+    // A client that never asks (or never reads) must not stall the others
+    struct timeval timeout = {ADMIN_REQUEST_TIMEOUT_MS / 1000,
+                              (ADMIN_REQUEST_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    string request;
+    char buffer[ADMIN_MAX_REQUEST];
+    while (request.size() < ADMIN_MAX_REQUEST
+           and request.find('\n') == string::npos) {
+        ssize_t bytesRead = recv(clientFd, buffer, sizeof(buffer), 0);
+        if (bytesRead < 0 and errno == EINTR) continue;
+        if (bytesRead <= 0) break; //< EOF ends an empty request too
+        request.append(buffer, bytesRead);
+    }
+    request = request.substr(0, request.find('\n'));
+    while (not request.empty() and isspace(request.back())) {
+        request.pop_back();
+    }
+
+    string response;
+    if (request.empty() or request == "text") {
+        response = report_(AdminFormat::TEXT);
+    } else if (request == "json") {
+        response = report_(AdminFormat::JSON);
+    } else {
+        response = "Err: Requête inconnue (text ou json).\n";
+    }
+    // The client may be gone already: nothing else to do
+    safeWrite(clientFd, response.data(), response.size());
+}
+
+// ### Public methods ###
+
+bool AdminSocket::open(const string &path, AdminReport report) {
+    struct sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        cerr << "Err: Le chemin du socket d'administration est trop long."
+             << endl;
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) {
+        cerr << "Err: Le socket d'administration n'a pas pu être créé - "
+             << strerror(errno) << endl;
+        return false;
+    }
+
+    // Left behind by a server that did not stop cleanly
+    unlink(path.c_str());
+    // Restricted before listening: nobody else can connect in between
+    if (bind(listenFd_, reinterpret_cast<struct sockaddr *>(&address),
+             sizeof(address))
+            != 0
+        or chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0
+        or listen(listenFd_, SOMAXCONN) != 0) {
+        cerr << "Err: Le socket d'administration " << path
+             << " n'a pas pu être ouvert - " << strerror(errno) << endl;
+        ::close(listenFd_);
+        listenFd_ = -1;
+        return false;
+    }
+    path_ = path;
+    report_ = move(report);
+
+    // Signals are handled by the main thread only
+    if (not setSigMask(true)) return false;
+    running_ = true;
+    int ret = pthread_create(&thread_, nullptr, threadFunc, this);
+    bool unmasked = setSigMask(false);
+    if (ret != 0) {
+        cerr << "Err: Impossible de créer le thread d'administration."
+             << endl;
+        running_ = false;
+        thread_ = 0;
+        return false;
+    }
+    return unmasked;
+}
+
+void AdminSocket::stop() {
+    if (thread_ != 0) {
+        running_ = false;
+        shutdown(listenFd_, SHUT_RDWR);
+        pthread_join(thread_, nullptr);
+        thread_ = 0;
+    }
+    if (listenFd_ >= 0) {
+        if (::close(listenFd_) != 0) {
+            perror("close");
+        }
+        unlink(path_.c_str());
+        listenFd_ = -1;
+    }
+}
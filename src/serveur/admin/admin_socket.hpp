@@ -0,0 +1,96 @@
+/**
+ * @file admin_socket.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the local administration socket of the server
+ * @date 2024
+ *
+ */
+
+#ifndef ADMIN_SOCKET_HPP
+#define ADMIN_SOCKET_HPP
+
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <string>
+
+using namespace std;
+
+constexpr int ADMIN_REQUEST_TIMEOUT_MS = 1000; //< Per read or write
+constexpr size_t ADMIN_MAX_REQUEST = 64;
+
+/**
+ * @brief The formats a report can be asked in.
+ */
+enum class AdminFormat { TEXT, JSON };
+
+/**
+ * @brief Builds the report sent to an administration client.
+ */
+using AdminReport = function<string(AdminFormat)>;
+
+/**
+ * @class AdminSocket
+ * @brief A Unix domain socket answering the requests of local administration
+ * tools, on its own thread.
+ *
+ * @details A client connects, writes one line ("text" or "json"; an empty
+ * request means "text"), reads the report and is disconnected, e.g.
+ * `echo json | socat - UNIX-CONNECT:<path>`. Requests are handled one at a
+ * time, so the thread never competes with the reactors for long.
+ */
+class AdminSocket {
+  private:
+    string path_;
+    int listenFd_ = -1;
+    pthread_t thread_ = 0;
+    atomic<bool> running_ = false;
+    AdminReport report_;
+
+    /**
+     * @brief Thread function answering the clients.
+     *
+     * @param arg A pointer to the AdminSocket object.
+     * @return void* Return a pointer to void.
+     */
+    static void *threadFunc(void *arg);
+
+    /**
+     * @brief Read the request of a client and answer it.
+     *
+     * @param clientFd The client, closed by the caller.
+     */
+    void serve(int clientFd);
+
+  public:
+    /**
+     * @brief Construct a new, closed AdminSocket object.
+     */
+    AdminSocket() = default;
+
+    /**
+     * @brief Destroy the AdminSocket object, stopping it.
+     */
+    ~AdminSocket();
+
+    AdminSocket(const AdminSocket &) = delete;
+    AdminSocket &operator=(const AdminSocket &) = delete;
+
+    /**
+     * @brief Create the socket (only reachable by this user) and start the
+     * thread answering it.
+     *
+     * @param path The path of the socket, replaced if it already exists.
+     * @param report Builds the reports, called from the admin thread.
+     *
+     * @return bool If the operation succeded
+     */
+    bool open(const string &path, AdminReport report);
+
+    /**
+     * @brief Stop the thread and remove the socket.
+     */
+    void stop();
+};
+
+#endif // ADMIN_SOCKET_HPP
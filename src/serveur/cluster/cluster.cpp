@@ -0,0 +1,655 @@
+/**
+ * @file cluster.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the links between the nodes of a cluster of servers
+ * @date 2024
+ *
+ */
+
+#include "cluster.hpp"
+#include "../../common/header/header.hpp"
+#include "../../common/signal/mask.hpp"
+#include "../server.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr int UNKNOWN_NODE = -1;  //< Inbound::node until HELLO
+constexpr int REPLACED_LINK = -2; //< Once a newer link from the node said HELLO
+
+constexpr size_t MAX_RECORD_SIZE = //< A MESSAGE, the largest record
+    2 + 3 * MAX_VARINT_SIZE + 2 * MAX_LENGTH_NICKNAME + MAX_LENGTH_MESSAGE;
+
+/**
+ * @brief Result of reading a varint of a record.
+ */
+enum class VarintReturnVal {
+    READ = 0,
+    NEED_MORE, //< The data ends first
+    INVALID    //< Longer than MAX_VARINT_SIZE
+};
+
+/**
+ * @brief Read a varint of a record.
+ */
+VarintReturnVal readVarint(string_view data, size_t &pos, size_t &value) {
+    value = 0;
+    for (size_t shift = 0; pos < data.size(); shift += 7) {
+        uint8_t byte = data[pos++];
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (not(byte & 0x80)) return VarintReturnVal::READ;
+        if (shift >= 7 * (MAX_VARINT_SIZE - 1)) {
+            return VarintReturnVal::INVALID;
+        }
+    }
+    return VarintReturnVal::NEED_MORE;
+}
+
+/**
+ * @brief Write the head of a JOIN or LEAVE record, followed by the nickname.
+ *
+ * @return string_view The head, in buffer.
+ */
+string_view nicknameHead(char (&buffer)[1 + MAX_VARINT_SIZE],
+                         ClusterRecord type, string_view nickname) {
+    buffer[0] = static_cast<char>(type);
+    return string_view(buffer, 1 + encodeVarint(buffer + 1, nickname.size()));
+}
+
+} // namespace
+
+// ### Constructor ###
+
+Cluster::Cluster() {
+    for (auto &shard : owners_) shard = new Owners();
+}
+
+// ### Destructor ###
+
+Cluster::~Cluster() {
+    stop();
+    for (auto &shard : owners_) delete shard.load();
+}
+
+// ### Private methods ###
+
+void *Cluster::threadFunc(void *arg) {
+    static_cast<Cluster *>(arg)->loop();
+    return nullptr;
+}
+
+void Cluster::loop() {
+    vector<struct pollfd> fds;
+    vector<unsigned> polledPeers;
+    while (running_) {
+        // Connect to the peers that are down, once their delay is over
+        auto now = chrono::steady_clock::now();
+        int timeout = -1;
+        for (unsigned node = 0; node < nodes_.size(); ++node) {
+            Peer &peer = peers_[node];
+            if (node == self_ or peer.fd >= 0) continue;
+            if (now >= peer.retryAt) connectPeer(node);
+            if (peer.fd < 0) {
+                auto wait = chrono::duration_cast<chrono::milliseconds>(
+                                peer.retryAt - now)
+                                .count();
+                wait = max<long long>(wait, 1);
+                timeout = timeout < 0 ? wait : min<long long>(timeout, wait);
+            }
+        }
+
+        fds.clear();
+        polledPeers.clear();
+        fds.push_back({wakeFd_, POLLIN, 0});
+        fds.push_back({listenFd_, POLLIN, 0});
+        for (unsigned node = 0; node < nodes_.size(); ++node) {
+            Peer &peer = peers_[node];
+            if (node == self_ or peer.fd < 0) continue;
+            // The peer never writes on our link: readable means closed
+            short events = POLLIN;
+            if (not peer.up or peer.written < peer.writing.size()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({peer.fd, events, 0});
+            polledPeers.push_back(node);
+        }
+        for (const Inbound &link : inbound_) {
+            fds.push_back({link.fd, POLLIN, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(wakeFd_, &count, sizeof(count)) < 0 and errno != EAGAIN) {
+                perror("read");
+            }
+        }
+
+        for (size_t i = 0; i < polledPeers.size(); ++i) {
+            unsigned node = polledPeers[i];
+            short revents = fds[2 + i].revents;
+            if (revents & (POLLIN | POLLERR | POLLHUP)) {
+                closePeer(node);
+            } else if ((revents & POLLOUT) and not peers_[node].up) {
+                int error = 0;
+                socklen_t size = sizeof(error);
+                getsockopt(peers_[node].fd, SOL_SOCKET, SO_ERROR, &error,
+                           &size);
+                if (error == 0) greetPeer(node);
+                else closePeer(node);
+            }
+        }
+
+        // Links from the peers, the oldest first (new ones are appended)
+        size_t first = 2 + polledPeers.size();
+        for (size_t i = inbound_.size(); i-- > 0;) {
+            short revents = fds[first + i].revents;
+            if (revents != 0 and not readInbound(inbound_[i])) {
+                closeInbound(i);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(listenFd_, nullptr, nullptr,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC))
+                   >= 0) {
+                inbound_.push_back({fd, UNKNOWN_NODE, {}});
+            }
+        }
+
+        // The batches appended since the last round, many records per write
+        for (unsigned node = 0; node < nodes_.size(); ++node) {
+            if (node != self_ and peers_[node].up) flushPeer(node);
+        }
+    }
+}
+
+void Cluster::connectPeer(unsigned node) {
+    Peer &peer = peers_[node];
+    peer.retryAt =
+        chrono::steady_clock::now() + chrono::milliseconds(CLUSTER_RETRY_MS);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return;
+    }
+    // Records are batched already
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    if (connect(fd, reinterpret_cast<sockaddr *>(&peer.address),
+                sizeof(peer.address))
+            != 0
+        and errno != EINPROGRESS) {
+        close(fd); //< Not started yet: tried again later
+        return;
+    }
+    peer.fd = fd;
+}
+
+void Cluster::greetPeer(unsigned node) {
+    Peer &peer = peers_[node];
+    char hello[1 + MAX_VARINT_SIZE];
+    hello[0] = static_cast<char>(ClusterRecord::HELLO);
+    size_t size = 1 + encodeVarint(hello + 1, self_);
+
+    // Listed under the lock: a client logging on or leaving meanwhile is
+    // announced after the list, never before
+    pthread_mutex_lock(&peer.mtx);
+    peer.up = true;
+    peer.batch.assign(hello, size);
+    for (const string &nickname : nicknames_()) {
+        char head[1 + MAX_VARINT_SIZE];
+        peer.batch += nicknameHead(head, ClusterRecord::JOIN, nickname);
+        peer.batch += nickname;
+    }
+    pthread_mutex_unlock(&peer.mtx);
+
+    linksUp_.fetch_add(1, memory_order_relaxed);
+    cerr << "Le nœud est relié au nœud " << node << " (" << nodes_[node]
+         << ")." << endl;
+}
+
+void Cluster::closePeer(unsigned node) {
+    Peer &peer = peers_[node];
+    if (peer.up) {
+        linksUp_.fetch_sub(1, memory_order_relaxed);
+        cerr << "Err: Le lien vers le nœud " << node << " est coupé." << endl;
+    }
+    close(peer.fd);
+    peer.fd = -1;
+
+    // Said to be forwarded: their senders are told
+    string batch;
+    pthread_mutex_lock(&peer.mtx);
+    peer.up = false;
+    swap(batch, peer.batch);
+    pthread_mutex_unlock(&peer.mtx);
+    loseMessages(peer.writing, peer.written);
+    loseMessages(batch, 0);
+    peer.writing.clear();
+    peer.written = 0;
+}
+
+void Cluster::loseMessages(string_view records, size_t sent) {
+    // Built by us: every record is complete and valid
+    size_t pos = 0;
+    while (pos < records.size()) {
+        auto type = static_cast<ClusterRecord>(records[pos++]);
+        size_t size;
+        if (type != ClusterRecord::MESSAGE) {
+            readVarint(records, pos, size);
+            if (type != ClusterRecord::HELLO) pos += size;
+            continue;
+        }
+
+        bool more = records[pos++] & FRAME_MORE;
+        size_t destSize, senderSize, messageSize;
+        readVarint(records, pos, destSize);
+        readVarint(records, pos, senderSize);
+        readVarint(records, pos, messageSize);
+        string_view dest = records.substr(pos, destSize);
+        string_view sender = records.substr(pos + destSize, senderSize);
+        string_view message =
+            records.substr(pos + destSize + senderSize, messageSize);
+        pos += destSize + senderSize + messageSize;
+
+        if (pos > sent) {
+            lose_(dest, sender, message, more);
+            lost_.fetch_add(1, memory_order_relaxed);
+        }
+    }
+}
+
+void Cluster::flushPeer(unsigned node) {
+    Peer &peer = peers_[node];
+    while (true) {
+        if (peer.written == peer.writing.size()) {
+            peer.writing.clear();
+            peer.written = 0;
+            pthread_mutex_lock(&peer.mtx);
+            swap(peer.writing, peer.batch);
+            pthread_mutex_unlock(&peer.mtx);
+            if (peer.writing.empty()) return;
+        }
+
+        ssize_t ret = send(peer.fd, peer.writing.data() + peer.written,
+                           peer.writing.size() - peer.written, MSG_NOSIGNAL);
+        if (ret > 0) {
+            peer.written += ret;
+        } else if (ret < 0 and errno == EINTR) {
+            continue;
+        } else if (ret < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+            return; //< Goes on once writable
+        } else {
+            closePeer(node);
+            return;
+        }
+    }
+}
+
+bool Cluster::readInbound(Inbound &link) {
+    size_t kept = link.buffer.size();
+    link.buffer.resize(kept + CLUSTER_READ_SIZE);
+    ssize_t ret;
+    do {
+        ret = recv(link.fd, link.buffer.data() + kept, CLUSTER_READ_SIZE, 0);
+    } while (ret < 0 and errno == EINTR);
+    if (ret < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+        link.buffer.resize(kept);
+        return true;
+    }
+    if (ret <= 0) return false;
+    link.buffer.resize(kept + ret);
+
+    size_t handled = handleRecords(link, link.buffer);
+    if (handled == SIZE_MAX) {
+        cerr << "Err: Le nœud " << link.node << " a envoyé des données "
+             << "invalides." << endl;
+        return false;
+    }
+    link.buffer.erase(0, handled);
+    return true;
+}
+
+size_t Cluster::handleRecords(Inbound &link, string_view data) {
+    // Whatever is left on a replaced link is outdated
+    if (link.node == REPLACED_LINK) return data.size();
+
+    size_t handled = 0;
+    while (handled < data.size()) {
+        size_t pos = handled + 1;
+        auto type = static_cast<ClusterRecord>(data[handled]);
+        if (link.node == UNKNOWN_NODE and type != ClusterRecord::HELLO) {
+            return SIZE_MAX;
+        }
+
+        if (type == ClusterRecord::HELLO) {
+            size_t node;
+            VarintReturnVal read = readVarint(data, pos, node);
+            if (read == VarintReturnVal::INVALID) return SIZE_MAX;
+            if (read == VarintReturnVal::NEED_MORE) break;
+            if (node >= nodes_.size() or node == self_) return SIZE_MAX;
+
+            // Replaces an older link from the same node, and what it said
+            for (Inbound &other : inbound_) {
+                if (other.node == static_cast<int>(node)) {
+                    other.node = REPLACED_LINK;
+                }
+            }
+            forgetNode(node);
+            link.node = node;
+
+        } else if (type == ClusterRecord::JOIN
+                   or type == ClusterRecord::LEAVE) {
+            size_t size;
+            VarintReturnVal read = readVarint(data, pos, size);
+            if (read == VarintReturnVal::INVALID) return SIZE_MAX;
+            if (read == VarintReturnVal::NEED_MORE) break;
+            if (size > MAX_LENGTH_NICKNAME) return SIZE_MAX;
+            if (data.size() - pos < size) break;
+            string nickname(data.substr(pos, size));
+            pos += size;
+
+            size_t shard = shardOf(nickname);
+            const Owners *current = owners_[shard].load();
+            auto owner = current->find(nickname);
+            uint64_t bit = uint64_t(1) << link.node;
+            bool claimed = owner != current->end() and (owner->second & bit);
+            if (type == ClusterRecord::JOIN and not claimed) {
+                Owners *next = new Owners(*current);
+                (*next)[nickname] |= bit;
+                publish(shard, next);
+                // Published first: a client logging on here meanwhile sees it
+                if (static_cast<unsigned>(link.node) < self_) {
+                    conflict_(nickname, link.node);
+                }
+            } else if (type == ClusterRecord::LEAVE and claimed) {
+                Owners *next = new Owners(*current);
+                if (owner->second == bit) next->erase(nickname);
+                else (*next)[nickname] &= ~bit;
+                publish(shard, next);
+            }
+
+        } else if (type == ClusterRecord::MESSAGE) {
+            if (data.size() - pos < 1) break;
+            bool more = data[pos++] & FRAME_MORE;
+            size_t destSize, senderSize, messageSize;
+            VarintReturnVal read = readVarint(data, pos, destSize);
+            if (read == VarintReturnVal::READ) {
+                read = readVarint(data, pos, senderSize);
+            }
+            if (read == VarintReturnVal::READ) {
+                read = readVarint(data, pos, messageSize);
+            }
+            if (read == VarintReturnVal::INVALID) return SIZE_MAX;
+            if (read == VarintReturnVal::NEED_MORE) break;
+            if (destSize > MAX_LENGTH_NICKNAME
+                or senderSize > MAX_LENGTH_NICKNAME
+                or messageSize > MAX_LENGTH_MESSAGE) {
+                return SIZE_MAX;
+            }
+            if (data.size() - pos < destSize + senderSize + messageSize) break;
+            string_view dest = data.substr(pos, destSize);
+            string_view sender = data.substr(pos + destSize, senderSize);
+            string_view message =
+                data.substr(pos + destSize + senderSize, messageSize);
+            pos += destSize + senderSize + messageSize;
+
+            deliver_(dest, sender, message, more);
+            received_.fetch_add(1, memory_order_relaxed);
+
+        } else {
+            return SIZE_MAX;
+        }
+        handled = pos;
+    }
+
+    // An incomplete record never grows past the largest one
+    if (data.size() - handled > MAX_RECORD_SIZE) return SIZE_MAX;
+    return handled;
+}
+
+void Cluster::closeInbound(size_t index) {
+    Inbound &link = inbound_[index];
+    if (link.node >= 0) {
+        cerr << "Err: Le lien depuis le nœud " << link.node << " est coupé."
+             << endl;
+        forgetNode(link.node);
+    }
+    close(link.fd);
+    inbound_.erase(inbound_.begin() + index);
+}
+
+size_t Cluster::shardOf(string_view nickname) {
+    return hash<string_view>()(nickname) % CLUSTER_OWNER_SHARDS;
+}
+
+void Cluster::publish(size_t shard, const Owners *next) {
+    const Owners *previous = owners_[shard].exchange(next);
+    epoch_.retire([previous]() { delete previous; });
+}
+
+int Cluster::ownerOf(string_view nickname) const {
+    thread_local string key;
+    key.assign(nickname);
+
+    Epoch::Guard guard(epoch_);
+    const Owners *current = owners_[shardOf(nickname)].load();
+    auto owner = current->find(key);
+    return owner == current->end() ? -1 : __builtin_ctzll(owner->second);
+}
+
+void Cluster::forgetNode(unsigned node) {
+    uint64_t bit = uint64_t(1) << node;
+    auto claimedByNode = [bit](const Owners::value_type &owner) {
+        return (owner.second & bit) != 0;
+    };
+    for (size_t shard = 0; shard < CLUSTER_OWNER_SHARDS; ++shard) {
+        const Owners *current = owners_[shard].load();
+        if (none_of(current->begin(), current->end(), claimedByNode)) continue;
+
+        Owners *next = new Owners();
+        for (const auto &owner : *current) {
+            uint64_t others = owner.second & ~bit;
+            if (others != 0) next->emplace(owner.first, others);
+        }
+        publish(shard, next);
+    }
+}
+
+void Cluster::broadcast(initializer_list<string_view> parts) {
+    for (unsigned node = 0; node < nodes_.size(); ++node) {
+        if (node != self_) append(node, parts);
+    }
+}
+
+bool Cluster::append(unsigned node, initializer_list<string_view> parts) {
+    Peer &peer = peers_[node];
+    pthread_mutex_lock(&peer.mtx);
+    if (not peer.up or peer.batch.size() > CLUSTER_BACKLOG) {
+        pthread_mutex_unlock(&peer.mtx);
+        return false;
+    }
+
+    // Only the first record of a batch wakes the thread up
+    bool wake = peer.batch.empty();
+    for (string_view part : parts) peer.batch += part;
+    pthread_mutex_unlock(&peer.mtx);
+    if (wake) {
+        uint64_t one = 1;
+        if (write(wakeFd_, &one, sizeof(one)) < 0 and errno != EAGAIN) {
+            perror("write");
+        }
+    }
+    return true;
+}
+
+// ### Public methods ###
+
+bool Cluster::open(const vector<string> &nodes, unsigned self,
+                   ClusterDelivery deliver, ClusterNicknames nicknames,
+                   ClusterConflict conflict, ClusterLoss lose) {
+    nodes_ = nodes;
+    self_ = self;
+    deliver_ = move(deliver);
+    nicknames_ = move(nicknames);
+    conflict_ = move(conflict);
+    lose_ = move(lose);
+    for (unsigned node = 0; node < nodes_.size(); ++node) {
+        if (not parseNodeAddress(nodes_[node], peers_[node].address)) {
+            cerr << "Err: Adresse de nœud invalide: " << nodes_[node]
+                 << " (ip:port attendu)." << endl;
+            return false;
+        }
+    }
+
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int opt = 1;
+    if (listenFd_ < 0
+        or setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))
+               != 0
+        or bind(listenFd_,
+                reinterpret_cast<sockaddr *>(&peers_[self_].address),
+                sizeof(peers_[self_].address))
+               != 0
+        or listen(listenFd_, MAX_CLUSTER_NODES) != 0) {
+        cerr << "Err: Le port du nœud (" << nodes_[self_]
+             << ") n'a pas pu être ouvert - " << strerror(errno) << endl;
+        stop();
+        return false;
+    }
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        perror("eventfd");
+        stop();
+        return false;
+    }
+
+    // Signals are handled by the main thread only
+    if (not setSigMask(true)) return false;
+    running_ = true;
+    int ret = pthread_create(&thread_, nullptr, threadFunc, this);
+    bool unmasked = setSigMask(false);
+    if (ret != 0) {
+        cerr << "Err: Impossible de créer le thread du cluster." << endl;
+        running_ = false;
+        thread_ = 0;
+        stop();
+        return false;
+    }
+    cerr << "Le serveur est le nœud " << self_ << " du cluster ("
+         << nodes_[self_] << ")." << endl;
+    return unmasked;
+}
+
+void Cluster::stop() {
+    if (thread_ != 0) {
+        running_ = false;
+        uint64_t one = 1;
+        if (write(wakeFd_, &one, sizeof(one)) < 0) perror("write");
+        pthread_join(thread_, nullptr);
+        thread_ = 0;
+    }
+    for (int *fd : {&listenFd_, &wakeFd_}) {
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+    }
+    for (Inbound &link : inbound_) close(link.fd);
+    inbound_.clear();
+
+    // The reactors may still append: the peers stay, down
+    for (unsigned node = 0; node < nodes_.size(); ++node) {
+        Peer &peer = peers_[node];
+        if (peer.fd >= 0) close(peer.fd);
+        peer.fd = -1;
+        peer.writing.clear();
+        peer.written = 0;
+        pthread_mutex_lock(&peer.mtx);
+        peer.up = false;
+        peer.batch.clear();
+        pthread_mutex_unlock(&peer.mtx);
+    }
+    for (size_t shard = 0; shard < CLUSTER_OWNER_SHARDS; ++shard) {
+        if (not owners_[shard].load()->empty()) publish(shard, new Owners());
+    }
+    linksUp_ = 0;
+}
+
+bool Cluster::enabled() const { return running_; }
+
+bool Cluster::knows(string_view nickname) {
+    return running_ and ownerOf(nickname) >= 0;
+}
+
+void Cluster::announce(string_view nickname, bool joined) {
+    if (not running_) return;
+    char head[1 + MAX_VARINT_SIZE];
+    broadcast({nicknameHead(head,
+                            joined ? ClusterRecord::JOIN : ClusterRecord::LEAVE,
+                            nickname),
+               nickname});
+}
+
+ForwardReturnVal Cluster::forward(string_view dest, string_view sender,
+                                  string_view message, bool more) {
+    if (not running_) return ForwardReturnVal::UNKNOWN;
+    int owner = ownerOf(dest);
+    if (owner < 0) return ForwardReturnVal::UNKNOWN;
+
+    char head[2 + 3 * MAX_VARINT_SIZE];
+    head[0] = static_cast<char>(ClusterRecord::MESSAGE);
+    head[1] = more ? FRAME_MORE : 0;
+    size_t size = 2 + encodeVarint(head + 2, dest.size());
+    size += encodeVarint(head + size, sender.size());
+    size += encodeVarint(head + size, message.size());
+
+    return append(owner, {string_view(head, size), dest, sender, message})
+               ? ForwardReturnVal::FORWARDED
+               : ForwardReturnVal::UNREACHABLE;
+}
+
+uint64_t Cluster::received() const {
+    return received_.load(memory_order_relaxed);
+}
+
+uint64_t Cluster::linksUp() const {
+    return linksUp_.load(memory_order_relaxed);
+}
+
+uint64_t Cluster::lost() const { return lost_.load(memory_order_relaxed); }
+
+// ### Functions ###
+
+bool parseNodeAddress(const string &node, sockaddr_in &address) {
+    size_t colon = node.rfind(':');
+    if (colon == string::npos) return false;
+    string ip = node.substr(0, colon);
+    int port = atoi(node.c_str() + colon + 1);
+    if (port <= 0 or port >= 65536) return false;
+
+    address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    return inet_pton(AF_INET, ip.c_str(), &address.sin_addr) == 1;
+}
@@ -0,0 +1,341 @@
+/**
+ * @file cluster.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the links between the nodes of a cluster of servers
+ * @date 2024
+ *
+ */
+
+#ifndef CLUSTER_HPP
+#define CLUSTER_HPP
+
+#include "../registry/epoch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t MAX_CLUSTER_NODES = 64;
+constexpr size_t CLUSTER_BACKLOG = 4 * 1024 * 1024; //< Bytes queued per peer
+constexpr size_t CLUSTER_READ_SIZE = 64 * 1024;     //< Per read from a peer
+constexpr int CLUSTER_RETRY_MS = 500; //< Between connections to a peer
+constexpr size_t CLUSTER_OWNER_SHARDS = 256; //< Copied one at a time
+
+/**
+ * @brief The records sent on a link, each starting with its type byte.
+ *
+ * @details HELLO [varint node]; JOIN and LEAVE [varint size][nickname];
+ * MESSAGE [flags][varint dest size][varint sender size][varint message size]
+ * [dest][sender][message], flags being FRAME_MORE or 0.
+ */
+enum class ClusterRecord : uint8_t { HELLO = 1, JOIN, LEAVE, MESSAGE };
+
+/**
+ * @brief Result of forwarding a message to another node.
+ */
+enum class ForwardReturnVal {
+    FORWARDED = 0,
+    UNKNOWN,    //< No node has the destination (or no cluster)
+    UNREACHABLE //< Its node has it, but the link is down or too far behind
+};
+
+/**
+ * @brief Hands a message received from another node to a local client (from
+ * the cluster's thread).
+ */
+using ClusterDelivery =
+    function<void(string_view dest, string_view sender, string_view message,
+                  bool more)>;
+
+/**
+ * @brief Reports a message forwarded to a peer, then dropped with its link
+ * before being written (from the cluster's thread).
+ */
+using ClusterLoss =
+    function<void(string_view dest, string_view sender, string_view message,
+                  bool more)>;
+
+/**
+ * @brief Lists the nicknames logged on to this node, announced to a peer
+ * when its link (re)connects.
+ */
+using ClusterNicknames = function<vector<string>()>;
+
+/**
+ * @brief Logs out the local client with a nickname a node listed before us
+ * claims too (from the cluster's thread).
+ */
+using ClusterConflict = function<void(string_view nickname, unsigned node)>;
+
+/**
+ * @class Cluster
+ * @brief The links between the nodes of a cluster, on their own thread:
+ * messages to a client logged on to another node are forwarded to it.
+ *
+ * @details Every node lists all the nodes in the same order and connects to
+ * every other one: the link to a peer only carries records to it, so a pair
+ * of nodes shares two TCP connections. Each node announces its clients on
+ * its links (JOIN and LEAVE, all of them when a link connects) and keeps a
+ * directory of the clients of its peers, forgotten when their link closes.
+ *
+ * Two nodes may accept the same nickname at once, each before hearing of the
+ * other: the directory keeps every node claiming a nickname, and the first
+ * one in the list owns it. The others log their client out once they hear of
+ * that node, so that every node routes to the same one.
+ *
+ * Records are appended to the peer's batch by the reactors, under the lock of
+ * that peer only, and written by the cluster's thread, many per write,
+ * without waiting for the peer: the messages of a sender reach a destination
+ * in order. When a link breaks, the messages not written yet are handed back
+ * to be reported to their senders; those the peer did not read are lost.
+ *
+ * The directory is split into CLUSTER_OWNER_SHARDS immutable snapshots, like
+ * the Registry: looking up the node of a destination never locks, while the
+ * cluster's thread, its only writer, copies the shard of each nickname
+ * announced.
+ */
+class Cluster {
+  private:
+    /**
+     * @brief Another node, and our link to it.
+     */
+    struct Peer {
+        pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER; //< Guards up, batch
+        sockaddr_in address{};
+        int fd = -1;                //< Connected or connecting (we write)
+        bool up = false;            //< Connected and greeted (thread writes)
+        string batch;               //< Records not written yet
+        string writing;             //< Records being written (thread only)
+        size_t written = 0;         //< Bytes of writing already written
+        chrono::steady_clock::time_point retryAt; //< Next connection
+    };
+
+    /**
+     * @brief A link from another node (we read).
+     */
+    struct Inbound {
+        int fd;
+        int node;      //< Once it said HELLO
+        string buffer; //< Bytes of the records not complete yet
+    };
+
+    vector<string> nodes_; //< "ip:port" of every node, us included
+    unsigned self_ = 0;    //< Our index in nodes_
+    ClusterDelivery deliver_;
+    ClusterNicknames nicknames_;
+    ClusterConflict conflict_;
+    ClusterLoss lose_;
+
+    int listenFd_ = -1;
+    int wakeFd_ = -1; //< eventfd, written when a batch starts
+    pthread_t thread_ = 0;
+    atomic<bool> running_ = false;
+
+    /**
+     * @brief One immutable version of a shard of the directory: nickname ->
+     * nodes claiming it (a bit per node, the lowest owning it).
+     */
+    using Owners = unordered_map<string, uint64_t>;
+
+    Peer peers_[MAX_CLUSTER_NODES]; //< By node, ours unused
+    mutable Epoch epoch_;
+    atomic<const Owners *> owners_[CLUSTER_OWNER_SHARDS];
+    vector<Inbound> inbound_; //< Cluster thread only
+
+    atomic<uint64_t> received_ = 0; //< Messages delivered from peers
+    atomic<uint64_t> linksUp_ = 0;  //< Peers we are connected to
+    atomic<uint64_t> lost_ = 0;     //< Messages dropped with their link
+
+    /**
+     * @brief Thread function driving the links.
+     *
+     * @param arg A pointer to the Cluster object.
+     * @return void* Return a pointer to void.
+     */
+    static void *threadFunc(void *arg);
+
+    void loop();
+
+    /**
+     * @brief Start connecting to a peer (non-blocking).
+     */
+    void connectPeer(unsigned node);
+
+    /**
+     * @brief Greet a peer whose link just connected, and announce every
+     * local client to it.
+     */
+    void greetPeer(unsigned node);
+
+    /**
+     * @brief Close the link to a peer and drop its batch, reporting the
+     * messages in it, to connect again later.
+     */
+    void closePeer(unsigned node);
+
+    /**
+     * @brief Report the MESSAGE records of records that end past sent, the
+     * bytes of it already written.
+     */
+    void loseMessages(string_view records, size_t sent);
+
+    /**
+     * @brief Write the batch of a peer, as far as its socket accepts.
+     */
+    void flushPeer(unsigned node);
+
+    /**
+     * @brief Read from a link and handle its complete records.
+     *
+     * @return bool False if the link must be closed.
+     */
+    bool readInbound(Inbound &link);
+
+    /**
+     * @brief Handle the records at the start of data.
+     *
+     * @return size_t The bytes of the complete records handled, or SIZE_MAX
+     * if the data is invalid.
+     */
+    size_t handleRecords(Inbound &link, string_view data);
+
+    /**
+     * @brief Close a link from a peer, forgetting its clients unless a newer
+     * link from it replaced it.
+     */
+    void closeInbound(size_t index);
+
+    /**
+     * @brief Get the shard of the directory of a nickname.
+     */
+    static size_t shardOf(string_view nickname);
+
+    /**
+     * @brief Make next the current version of a shard of the directory and
+     * retire the previous one (cluster's thread only).
+     */
+    void publish(size_t shard, const Owners *next);
+
+    /**
+     * @brief Get the node a client is logged on to, as far as we know.
+     *
+     * @return int The node, or -1 if none has it.
+     */
+    int ownerOf(string_view nickname) const;
+
+    /**
+     * @brief Forget the clients of a node (cluster's thread only).
+     */
+    void forgetNode(unsigned node);
+
+    /**
+     * @brief Append a record, made of parts, to the batch of every peer up.
+     */
+    void broadcast(initializer_list<string_view> parts);
+
+    /**
+     * @brief Append a record, made of parts, to the batch of a peer.
+     *
+     * @return bool False if the peer is down or too far behind.
+     */
+    bool append(unsigned node, initializer_list<string_view> parts);
+
+  public:
+    /**
+     * @brief Construct a new, stopped Cluster object.
+     */
+    Cluster();
+
+    /**
+     * @brief Destroy the Cluster object, stopping it.
+     */
+    ~Cluster();
+
+    Cluster(const Cluster &) = delete;
+    Cluster &operator=(const Cluster &) = delete;
+
+    /**
+     * @brief Listen for the links of the other nodes and start connecting to
+     * them.
+     *
+     * @param nodes "ip:port" of every node, in the same order on all of them.
+     * @param self Our index in nodes.
+     * @param deliver Hands the messages forwarded to us to local clients.
+     * @param nicknames Lists the local clients.
+     * @param conflict Logs out the local clients another node won.
+     * @param lose Reports the messages dropped with a link.
+     *
+     * @return bool If the operation succeded
+     */
+    bool open(const vector<string> &nodes, unsigned self,
+              ClusterDelivery deliver, ClusterNicknames nicknames,
+              ClusterConflict conflict, ClusterLoss lose);
+
+    /**
+     * @brief Stop the thread and close every link (open may be called
+     * again).
+     */
+    void stop();
+
+    /**
+     * @brief Whether the node is part of a cluster.
+     */
+    bool enabled() const;
+
+    /**
+     * @brief Whether a client with this nickname is logged on to another
+     * node, as far as we know (from any thread).
+     *
+     * @note Checked once the local client is registered, a nickname claimed
+     * meanwhile is seen either here or by the conflict callback.
+     */
+    bool knows(string_view nickname);
+
+    /**
+     * @brief Tell the other nodes that a client logged on to this one or left
+     * it (from any thread).
+     */
+    void announce(string_view nickname, bool joined);
+
+    /**
+     * @brief Forward a message to the node of its destination (from any
+     * thread).
+     */
+    ForwardReturnVal forward(string_view dest, string_view sender,
+                             string_view message, bool more);
+
+    /**
+     * @brief The messages delivered from the other nodes so far.
+     */
+    uint64_t received() const;
+
+    /**
+     * @brief The peers we are connected to.
+     */
+    uint64_t linksUp() const;
+
+    /**
+     * @brief The messages forwarded, then dropped with their link so far.
+     */
+    uint64_t lost() const;
+};
+
+/**
+ * @brief Parse an "ip:port" node address.
+ *
+ * @return bool False if it is not one.
+ */
+bool parseNodeAddress(const string &node, sockaddr_in &address);
+
+#endif // CLUSTER_HPP
@@ -0,0 +1,27 @@
+/**
+ * @file connection.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the per-client connection state
+ * @date 2024
+ *
+ */
+
+#include "connection.hpp"
+#include "../server.hpp"
+
+#include <atomic>
+
+using namespace std;
+
+namespace {
+
+atomic<uint64_t> nextSerial = 0;
+
+} // namespace
+
+Connection::Connection(int sockFd, const string &name)
+    : serial(nextSerial.fetch_add(1, memory_order_relaxed)), fd(sockFd),
+      nickname(name),
+      decoder(PROTOCOL_V1, MAX_LENGTH_NICKNAME, MAX_LENGTH_MESSAGE) {}
+
+Connection::~Connection() = default;
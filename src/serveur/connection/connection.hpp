@@ -0,0 +1,136 @@
+/**
+ * @file connection.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the per-client connection state
+ * @date 2024
+ *
+ */
+
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include "../../common/compression/compression.hpp"
+#include "../../common/frame_decoder/frame_decoder.hpp"
+#include "../../common/header/header.hpp"
+#include "../frame_queue/frame_queue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+class Reactor;
+
+/**
+ * @brief Compact identifier of a logged-on client, given by the Registry.
+ */
+using NicknameId = uint32_t;
+
+constexpr NicknameId NO_NICKNAME_ID = UINT32_MAX;
+
+/**
+ * @brief State of one connected client, driven by a Reactor.
+ *
+ * @details The socket is non-blocking, so a frame may arrive in several
+ * pieces: the decoder keeps the bytes of an incomplete frame until the rest
+ * is received.
+ *
+ * @note Only the reactor's thread may touch a connection, except for serial,
+ * nickname, nicknameId, version, nicknameIds and reactor, which are set before
+ * the client can be found in the registry and then only read by any thread,
+ * and for congested, queuedBytes and received, which are atomic.
+ */
+struct Connection : enable_shared_from_this<Connection> {
+    const uint64_t serial; //< Unique to the connection, never reused
+    int fd;
+    string nickname;
+    NicknameId nicknameId = NO_NICKNAME_ID; //< Set once registered
+    uint8_t version = PROTOCOL_V1; //< Of the frames sent to the client
+    bool nicknameIds = false;      //< Negotiated CAP_NICKNAME_IDS
+
+    /**
+     * @brief Compresses the frames sent to the client, if CAP_COMPRESSION
+     * was negotiated (only used by the reactor's thread).
+     */
+    unique_ptr<StreamCompressor> compressor;
+
+    /**
+     * @brief Serials of the clients our nickname id was bound for: the next
+     * frames to them only carry the id.
+     */
+    unordered_set<uint64_t> boundTo;
+    bool loggedOn = false;                  //< Whether the handshake is over
+    Reactor *reactor = nullptr; //< The reactor driving the connection
+
+    // ### Read side ###
+    FrameDecoder decoder; //< Frames received and not handled yet
+
+    // ### Write side ###
+    bool closed = false; //< The socket is closed (or about to be)
+
+    /**
+     * @brief Frames waiting for the socket to be writable, bounded by the
+     * server's output limit.
+     *
+     * @note Linked, so that dropping frames never moves the ones a pending
+     * write points to.
+     */
+    FrameQueue outQueue;
+    size_t outOffset = 0;   //< Bytes of outQueue.front() already written
+    size_t outBytes = 0;    //< Total size of the frames in outQueue
+    size_t outInFlight = 0; //< Leading frames used by a pending write
+    bool flushPending = false; //< Listed to be flushed at the end of the batch
+    bool socketFull = false;   //< Not writable until the next EPOLLOUT
+    bool replaying = false;    //< Offline messages left once the queue drains
+    bool dropping = false;     //< Frames dropped since the queue last drained
+
+    // ### Metrics (written by the reactor, read by the admin thread) ###
+    atomic<uint64_t> queuedBytes = 0; //< Copy of outBytes
+    atomic<uint64_t> received = 0;    //< Frames queued for the client
+
+    // ### Backpressure (blocking overflow policy) ###
+
+    /**
+     * @brief The output queue went over the limit and has not drained yet:
+     * senders must pause (read by the senders' reactors).
+     */
+    atomic<bool> congested = false;
+    bool paused = false; //< Not read until a congested destination drains
+
+    /**
+     * @brief Paused senders waiting for this connection's queue to drain.
+     */
+    vector<shared_ptr<Connection>> waiters;
+
+    // ### Completion-based I/O (io_uring) ###
+    bool recvArmed = false;     //< A multishot recv is pending
+    bool writeInFlight = false; //< A sendmsg of outQueue is pending
+    bool closing = false;       //< Not read anymore, closed once flushed
+    vector<struct iovec> outIov;
+    struct msghdr outMsg{}; //< The pending sendmsg, pointing to outIov
+    string pending; //< Bytes received while paused
+
+    /**
+     * @brief Construct a new Connection object.
+     *
+     * @param sockFd The (non-blocking) client socket.
+     * @param name The client's nickname.
+     */
+    Connection(int sockFd, const string &name);
+
+    /**
+     * @brief Destroy the Connection object.
+     */
+    virtual ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+};
+
+#endif // CONNECTION_HPP
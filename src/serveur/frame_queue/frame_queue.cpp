@@ -0,0 +1,68 @@
+/**
+ * @file frame_queue.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the pooled frames and the queues linking them
+ * @date 2024
+ *
+ */
+
+#include "frame_queue.hpp"
+
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+// ### FrameBuffer ###
+
+FrameBuffer *FrameBuffer::create(SlabPool *pool, const struct iovec *iov,
+                                 int iovcnt) {
+    size_t size = 0;
+    for (int i = 0; i < iovcnt; ++i) size += iov[i].iov_len;
+
+    FrameBuffer *frame = new (SlabPool::allocate(
+        pool, sizeof(FrameBuffer) + size)) FrameBuffer;
+    frame->size = size;
+    char *out = frame->data();
+    for (int i = 0; i < iovcnt; ++i) {
+        memcpy(out, iov[i].iov_base, iov[i].iov_len);
+        out += iov[i].iov_len;
+    }
+    return frame;
+}
+
+void FrameBuffer::release(FrameBuffer *frame) { SlabPool::release(frame); }
+
+// ### FrameQueue ###
+
+FrameQueue::~FrameQueue() { clear(); }
+
+void FrameQueue::push(FrameBuffer *frame) {
+    frame->next = nullptr;
+    if (tail_ == nullptr) head_ = frame;
+    else tail_->next = frame;
+    tail_ = frame;
+    ++size_;
+}
+
+FrameBuffer *FrameQueue::removeAfter(FrameBuffer *prev) {
+    FrameBuffer *frame = prev == nullptr ? head_ : prev->next;
+    if (frame == nullptr) return nullptr;
+
+    if (prev == nullptr) head_ = frame->next;
+    else prev->next = frame->next;
+    if (tail_ == frame) tail_ = prev;
+    --size_;
+    frame->next = nullptr;
+    return frame;
+}
+
+void FrameQueue::clear() {
+    while (head_ != nullptr) {
+        FrameBuffer *frame = head_;
+        head_ = frame->next;
+        FrameBuffer::release(frame);
+    }
+    tail_ = nullptr;
+    size_ = 0;
+}
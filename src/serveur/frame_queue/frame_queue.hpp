@@ -0,0 +1,105 @@
+/**
+ * @file frame_queue.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the pooled frames and the queues linking them
+ * @date 2024
+ *
+ */
+
+#ifndef FRAME_QUEUE_HPP
+#define FRAME_QUEUE_HPP
+
+#include "../slab_pool/slab_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+
+using namespace std;
+
+/**
+ * @struct FrameBuffer
+ * @brief A frame ready to be written, stored right after this header in a
+ * block of a SlabPool.
+ */
+struct FrameBuffer {
+    FrameBuffer *next = nullptr; //< In a FrameQueue
+    uint32_t size = 0;
+
+    /**
+     * @brief Gather the parts of a frame into a new buffer.
+     *
+     * @param pool The pool of the calling thread (may be nullptr).
+     * @param iov The parts of the frame.
+     * @param iovcnt The number of parts.
+     *
+     * @return FrameBuffer* The frame, to be given back with release().
+     */
+    static FrameBuffer *create(SlabPool *pool, const struct iovec *iov,
+                               int iovcnt);
+
+    /**
+     * @brief Give a frame back to its pool (from any thread).
+     */
+    static void release(FrameBuffer *frame);
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+    const char *data() const {
+        return reinterpret_cast<const char *>(this + 1);
+    }
+};
+
+/**
+ * @class FrameQueue
+ * @brief FIFO of frames linked through their headers: queuing never
+ * allocates, and dropping frames never moves the other ones.
+ */
+class FrameQueue {
+  private:
+    FrameBuffer *head_ = nullptr;
+    FrameBuffer *tail_ = nullptr;
+    size_t size_ = 0;
+
+  public:
+    /**
+     * @brief Construct a new, empty FrameQueue object.
+     */
+    FrameQueue() = default;
+
+    /**
+     * @brief Destroy the FrameQueue object, releasing its frames.
+     */
+    ~FrameQueue();
+
+    FrameQueue(const FrameQueue &) = delete;
+    FrameQueue &operator=(const FrameQueue &) = delete;
+
+    bool empty() const { return head_ == nullptr; }
+    size_t size() const { return size_; }
+
+    /**
+     * @brief Get the oldest frame (nullptr if empty); the next ones follow
+     * its next pointer.
+     */
+    FrameBuffer *front() const { return head_; }
+
+    /**
+     * @brief Append a frame, now owned by the queue.
+     */
+    void push(FrameBuffer *frame);
+
+    /**
+     * @brief Unlink the frame following prev, or the oldest one if prev is
+     * nullptr.
+     *
+     * @return FrameBuffer* The frame, now owned by the caller.
+     */
+    FrameBuffer *removeAfter(FrameBuffer *prev);
+
+    /**
+     * @brief Release all the frames.
+     */
+    void clear();
+};
+
+#endif // FRAME_QUEUE_HPP
@@ -0,0 +1,414 @@
+/**
+ * @file handoff.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the handover of a running server to a new binary
+ * @date 2024
+ *
+ */
+
+#include "handoff.hpp"
+#include "../../common/safe_read/safe_read.hpp"
+#include "../server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+extern char **environ;
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 20; //< Magic, version, fds, state size
+
+/**
+ * @brief Bound the blocking reads and writes on the socket, so that a stuck
+ * peer never stops the handover forever.
+ */
+bool setTimeouts(int sock) {
+    struct timeval timeout;
+    timeout.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))
+            != 0
+        or setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))
+               != 0) {
+        perror("setsockopt");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Write all the bytes (safeWrite gives up after a partial write).
+ */
+bool writeAll(int sock, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(sock, data, size);
+        if (written < 0 and errno == EINTR) continue;
+        if (written <= 0) {
+            perror("write");
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+void appendLe(string &out, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+uint64_t readLe(const char *in, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        value |= uint64_t(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Write a compression window: its position, then its bytes.
+ */
+void putWindow(HandoffWriter &out, const CompressionWindow &window) {
+    out.putU64(window.position());
+    out.putBytes(window.window());
+}
+
+/**
+ * @brief Read a compression window into a compressor (which hashes it) or a
+ * decompressor.
+ */
+template <class Window> bool getWindow(HandoffReader &in, Window &window) {
+    uint64_t position = in.getU64();
+    string_view bytes = in.getBytes();
+    return not in.failed() and bytes.size() <= position
+           and window.resume(bytes, position);
+}
+
+} // namespace
+
+// ### HandoffWriter ###
+
+void HandoffWriter::putU8(uint8_t value) { appendLe(data_, value, 1); }
+
+void HandoffWriter::putU32(uint32_t value) { appendLe(data_, value, 4); }
+
+void HandoffWriter::putU64(uint64_t value) { appendLe(data_, value, 8); }
+
+void HandoffWriter::putBytes(string_view bytes) {
+    putU32(bytes.size());
+    data_.append(bytes);
+}
+
+void HandoffWriter::putFd(int fd) {
+    putU32(fds_.size());
+    fds_.push_back(fd);
+}
+
+bool HandoffWriter::send(int sock) const {
+    if (not setTimeouts(sock)) return false;
+
+    string header;
+    appendLe(header, HANDOFF_MAGIC, 4);
+    appendLe(header, HANDOFF_VERSION, 4);
+    appendLe(header, fds_.size(), 4);
+    appendLe(header, data_.size(), 8);
+    if (not writeAll(sock, header.data(), header.size())) return false;
+
+    // One byte carries each group of descriptors
+    for (size_t sent = 0; sent < fds_.size();
+         sent += HANDOFF_FDS_PER_MESSAGE) {
+        size_t count = min(HANDOFF_FDS_PER_MESSAGE, fds_.size() - sent);
+        char byte = 0;
+        struct iovec iov = {&byte, 1};
+        alignas(struct cmsghdr) char
+            control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)] = {};
+
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds_.data() + sent, sizeof(int) * count);
+
+        ssize_t ret;
+        do {
+            ret = sendmsg(sock, &msg, 0);
+        } while (ret < 0 and errno == EINTR);
+        if (ret != 1) {
+            perror("sendmsg");
+            return false;
+        }
+    }
+
+    return writeAll(sock, data_.data(), data_.size());
+}
+
+// ### HandoffReader ###
+
+HandoffReader::~HandoffReader() {
+    for (int fd : fds_) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+bool HandoffReader::receive(int sock) {
+    if (not setTimeouts(sock)) return false;
+
+    char header[HEADER_SIZE];
+    if (not safeRead(sock, header, sizeof(header))) return false;
+    if (readLe(header, 4) != HANDOFF_MAGIC
+        or readLe(header + 4, 4) != HANDOFF_VERSION) {
+        cerr << "Err: L'état reçu n'a pas été écrit par une version "
+                "compatible du serveur."
+             << endl;
+        return false;
+    }
+    size_t numFds = readLe(header + 8, 4);
+    size_t size = readLe(header + 12, 8);
+
+    while (fds_.size() < numFds) {
+        size_t count = min(HANDOFF_FDS_PER_MESSAGE, numFds - fds_.size());
+        char byte;
+        struct iovec iov = {&byte, 1};
+        alignas(struct cmsghdr) char
+            control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)];
+
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t ret;
+        do {
+            ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        } while (ret < 0 and errno == EINTR);
+        if (ret != 1) {
+            if (ret < 0) perror("recvmsg");
+            return false;
+        }
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != nullptr and cmsg->cmsg_level == SOL_SOCKET
+            and cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            size_t first = fds_.size();
+            fds_.resize(first + received);
+            memcpy(fds_.data() + first, CMSG_DATA(cmsg),
+                   sizeof(int) * received);
+            if (received != count) return false;
+        } else {
+            return false;
+        }
+        if (msg.msg_flags & MSG_CTRUNC) {
+            cerr << "Err: Des sockets du serveur précédent ont été perdus."
+                 << endl;
+            return false;
+        }
+    }
+
+    data_.resize(size);
+    return safeRead(sock, data_.data(), size);
+}
+
+const char *HandoffReader::take(size_t size) {
+    if (failed_ or data_.size() - pos_ < size) {
+        failed_ = true;
+        return nullptr;
+    }
+    const char *at = data_.data() + pos_;
+    pos_ += size;
+    return at;
+}
+
+uint8_t HandoffReader::getU8() {
+    const char *at = take(1);
+    return at ? readLe(at, 1) : 0;
+}
+
+uint32_t HandoffReader::getU32() {
+    const char *at = take(4);
+    return at ? readLe(at, 4) : 0;
+}
+
+uint64_t HandoffReader::getU64() {
+    const char *at = take(8);
+    return at ? readLe(at, 8) : 0;
+}
+
+string_view HandoffReader::getBytes() {
+    uint32_t size = getU32();
+    const char *at = take(size);
+    return at ? string_view(at, size) : string_view();
+}
+
+int HandoffReader::takeFd() {
+    uint32_t index = getU32();
+    if (failed_ or index >= fds_.size() or fds_[index] < 0) {
+        failed_ = true;
+        return -1;
+    }
+    int fd = fds_[index];
+    fds_[index] = -1;
+    return fd;
+}
+
+bool HandoffReader::failed() const { return failed_; }
+
+bool HandoffReader::done() const {
+    return not failed_ and pos_ == data_.size();
+}
+
+// ### Functions ###
+
+pid_t spawnSuccessor(const string &path, int sock) {
+    // Built beforehand: the child of a threaded process may only exec
+    string handoffVar = HANDOFF_ENV + "=" + to_string(sock);
+    vector<char *> env;
+    for (char **var = environ; *var != nullptr; ++var) {
+        if (strncmp(*var, handoffVar.c_str(), HANDOFF_ENV.size() + 1) != 0) {
+            env.push_back(*var);
+        }
+    }
+    env.push_back(handoffVar.data());
+    env.push_back(nullptr);
+    char *argv[] = {const_cast<char *>(path.c_str()), nullptr};
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+    } else if (pid == 0) {
+        // The only descriptor kept across exec
+        int flags = fcntl(sock, F_GETFD);
+        if (flags >= 0 and fcntl(sock, F_SETFD, flags & ~FD_CLOEXEC) == 0) {
+            execve(argv[0], argv, env.data());
+        }
+        _exit(127);
+    }
+    return pid;
+}
+
+bool acknowledgeHandoff(int sock) {
+    return writeAll(sock, &HANDOFF_ACK, 1);
+}
+
+bool waitHandoffAck(int sock) {
+    char ack;
+    return safeRead(sock, &ack, 1) and ack == HANDOFF_ACK;
+}
+
+void saveConnection(HandoffWriter &out, const Connection &conn,
+                    const vector<const FrameBuffer *> &posted) {
+    out.putFd(conn.fd);
+    out.putU64(conn.serial);
+    out.putBytes(conn.nickname);
+    out.putU32(conn.nicknameId); //< Kept: the clients it is bound to use it
+    out.putU8(conn.loggedOn);
+    out.putU8(conn.version);
+    out.putU8(conn.nicknameIds);
+    out.putU8(conn.replaying);
+
+    // Read side: the bytes of the next frames, and what decodes them
+    out.putBytes(conn.decoder.buffered());
+    const vector<string> &bound = conn.decoder.boundNicknames();
+    out.putU32(bound.size());
+    for (const string &nickname : bound) out.putBytes(nickname);
+    StreamDecompressor *decompressor = conn.decoder.decompressor();
+    out.putU8(decompressor != nullptr);
+    if (decompressor) putWindow(out, *decompressor);
+
+    // Write side
+    out.putU8(conn.compressor != nullptr);
+    if (conn.compressor) putWindow(out, *conn.compressor);
+    out.putU32(conn.boundTo.size());
+    for (uint64_t serial : conn.boundTo) out.putU64(serial);
+
+    out.putU64(conn.outOffset);
+    out.putU32(conn.outQueue.size() + posted.size());
+    for (const FrameBuffer *frame = conn.outQueue.front(); frame != nullptr;
+         frame = frame->next) {
+        out.putBytes(string_view(frame->data(), frame->size));
+    }
+    for (const FrameBuffer *frame : posted) {
+        out.putBytes(string_view(frame->data(), frame->size));
+    }
+}
+
+shared_ptr<Connection> loadConnection(HandoffReader &in, uint64_t &serial) {
+    int fd = in.takeFd();
+    serial = in.getU64();
+    string nickname(in.getBytes());
+    if (in.failed()) return nullptr;
+
+    // Closes the socket if the rest is invalid
+    auto conn = make_shared<Connection>(fd, nickname);
+    conn->nicknameId = in.getU32();
+    conn->loggedOn = in.getU8();
+    conn->version = in.getU8();
+    conn->nicknameIds = in.getU8();
+    conn->replaying = in.getU8();
+
+    string_view buffered = in.getBytes();
+    vector<string> bound(in.getU32());
+    if (in.failed() or bound.size() > MAX_CLIENT_NICKNAME_IDS) {
+        close(fd);
+        return nullptr;
+    }
+    for (string &nickname : bound) nickname = in.getBytes();
+    conn->decoder.setVersion(conn->version);
+    if (conn->nicknameIds) {
+        conn->decoder.allowNicknameIds(MAX_CLIENT_NICKNAME_IDS);
+    }
+    bool valid = conn->decoder.bindNicknames(move(bound));
+    if (in.getU8()) {
+        conn->decoder.allowCompression();
+        valid = valid and getWindow(in, *conn->decoder.decompressor());
+    }
+    valid = valid
+            and conn->decoder.feed(buffered.data(), buffered.size())
+                    == buffered.size();
+
+    if (in.getU8()) {
+        conn->compressor = make_unique<StreamCompressor>(MAX_LENGTH_MESSAGE);
+        valid = valid and getWindow(in, *conn->compressor);
+    }
+    for (uint32_t count = in.getU32(); count > 0 and not in.failed();
+         --count) {
+        conn->boundTo.insert(in.getU64());
+    }
+
+    conn->outOffset = in.getU64();
+    for (uint32_t count = in.getU32(); count > 0 and not in.failed();
+         --count) {
+        string_view bytes = in.getBytes();
+        struct iovec iov = {const_cast<char *>(bytes.data()), bytes.size()};
+        conn->outQueue.push(FrameBuffer::create(nullptr, &iov, 1));
+        conn->outBytes += bytes.size();
+    }
+    conn->queuedBytes = conn->outBytes;
+
+    if (not valid or in.failed()
+        or (conn->outQueue.empty() ? conn->outOffset != 0
+                                   : conn->outOffset
+                                         >= conn->outQueue.front()->size)) {
+        close(fd);
+        return nullptr;
+    }
+    return conn;
+}
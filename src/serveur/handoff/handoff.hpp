@@ -0,0 +1,163 @@
+/**
+ * @file handoff.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the handover of a running server to a new binary
+ * @date 2024
+ *
+ */
+
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include "../connection/connection.hpp"
+#include "../frame_queue/frame_queue.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t HANDOFF_MAGIC = 0x4f484b4c; //< "LKHO"
+constexpr uint32_t HANDOFF_VERSION = 2;        //< Of the state's layout
+constexpr int HANDOFF_TIMEOUT_MS = 10000;      //< Per read or write
+constexpr size_t HANDOFF_FDS_PER_MESSAGE = 250; //< Below SCM_MAX_FD
+constexpr char HANDOFF_ACK = 'A';
+const string HANDOFF_ENV = "HANDOFF_FD_SERVEUR"; //< Set for the new binary
+
+/**
+ * @class HandoffWriter
+ * @brief The state of a server, serialized to be handed over with its
+ * sockets.
+ *
+ * @details On the Unix socket to the new binary: a header (magic, version,
+ * number of descriptors, size of the state), the descriptors by groups of
+ * HANDOFF_FDS_PER_MESSAGE with SCM_RIGHTS, then the state, whose fields refer
+ * to the descriptors by index.
+ */
+class HandoffWriter {
+  private:
+    string data_;
+    vector<int> fds_;
+
+  public:
+    void putU8(uint8_t value);
+    void putU32(uint32_t value);
+    void putU64(uint64_t value);
+    void putBytes(string_view bytes); //< Prefixed with their size
+    void putFd(int fd);               //< Sent with SCM_RIGHTS
+
+    /**
+     * @brief Send the descriptors and the state.
+     *
+     * @return bool If the operation succeded
+     */
+    bool send(int sock) const;
+};
+
+/**
+ * @class HandoffReader
+ * @brief The state received from the previous server, read in the order it
+ * was written.
+ *
+ * @details Reading past the end or a descriptor twice makes the reader fail:
+ * the values read are then meaningless. The descriptors not taken are closed
+ * with the reader.
+ */
+class HandoffReader {
+  private:
+    string data_;
+    size_t pos_ = 0;
+    bool failed_ = false;
+    vector<int> fds_;
+
+    /**
+     * @brief Take size bytes of the state.
+     *
+     * @return const char* nullptr if there are not as many left.
+     */
+    const char *take(size_t size);
+
+  public:
+    HandoffReader() = default;
+    ~HandoffReader();
+
+    HandoffReader(const HandoffReader &) = delete;
+    HandoffReader &operator=(const HandoffReader &) = delete;
+
+    /**
+     * @brief Receive the descriptors and the state.
+     *
+     * @return bool If the operation succeded
+     */
+    bool receive(int sock);
+
+    uint8_t getU8();
+    uint32_t getU32();
+    uint64_t getU64();
+    string_view getBytes(); //< Valid as long as the reader
+    int takeFd();           //< Now owned by the caller (-1 if invalid)
+
+    /**
+     * @brief Whether a read failed.
+     */
+    bool failed() const;
+
+    /**
+     * @brief Whether the whole state was read without failing.
+     */
+    bool done() const;
+};
+
+/**
+ * @brief Run the binary at path in a new process, with the socket to the
+ * current one in HANDOFF_ENV (the other descriptors are closed on exec).
+ *
+ * @return pid_t The new process, or -1 in case of error.
+ */
+pid_t spawnSuccessor(const string &path, int sock);
+
+/**
+ * @brief Tell the previous server that its state was taken over: it stops.
+ *
+ * @return bool If the operation succeded
+ */
+bool acknowledgeHandoff(int sock);
+
+/**
+ * @brief Wait for the new server to take the state over.
+ *
+ * @return bool False if it failed, exited or did not answer in time.
+ */
+bool waitHandoffAck(int sock);
+
+/**
+ * @brief Write the state of a connection.
+ *
+ * @param out The state.
+ * @param conn The connection, whose reactor is stopped.
+ * @param posted The frames posted to it and not queued yet, queued after
+ * the others by the new server.
+ */
+void saveConnection(HandoffWriter &out, const Connection &conn,
+                    const vector<const FrameBuffer *> &posted);
+
+/**
+ * @brief Read the state of a connection.
+ *
+ * @note Its boundTo still holds the serials of the previous server, to be
+ * translated once every connection is read.
+ *
+ * @param in The state.
+ * @param serial Its serial in the previous server.
+ *
+ * @return shared_ptr<Connection> The connection, or nullptr if the state is
+ * invalid.
+ */
+shared_ptr<Connection> loadConnection(HandoffReader &in, uint64_t &serial);
+
+#endif // HANDOFF_HPP
@@ -0,0 +1,193 @@
+/**
+ * @file metrics.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the live metrics of the server
+ * @date 2024
+ *
+ */
+
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+
+/**
+ * @brief Append a string to a JSON document, quoted and escaped.
+ */
+void appendJsonString(string &out, const string &value) {
+    out += '"';
+    for (unsigned char c : value) {
+        if (c == '"' or c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+/**
+ * @brief Format a latency in microseconds.
+ */
+string formatMicros(double micros) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", micros);
+    return buffer;
+}
+
+} // namespace
+
+// ### ShardMetrics ###
+
+void ShardMetrics::recordLatency(chrono::steady_clock::time_point receivedAt) {
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(
+                       chrono::steady_clock::now() - receivedAt)
+                       .count();
+
+    // floor(log2(elapsed)), the last bucket taking everything above
+    unsigned bucket = 0;
+    if (elapsed > 1) {
+        bucket = 63 - __builtin_clzll(static_cast<uint64_t>(elapsed));
+    }
+    bump(latency[min(bucket, LATENCY_BUCKETS - 1)]);
+}
+
+// ### MetricsSnapshot ###
+
+void MetricsSnapshot::add(const ShardMetrics &shard) {
+    messagesRouted += shard.messagesRouted.load(memory_order_relaxed);
+    undeliverable += shard.undeliverable.load(memory_order_relaxed);
+    storedOffline += shard.storedOffline.load(memory_order_relaxed);
+    sendFailures += shard.sendFailures.load(memory_order_relaxed);
+    dropped += shard.dropped.load(memory_order_relaxed);
+    forwarded += shard.forwarded.load(memory_order_relaxed);
+    unreachable += shard.unreachable.load(memory_order_relaxed);
+    spliced += shard.spliced.load(memory_order_relaxed);
+    compressed += shard.compressed.load(memory_order_relaxed);
+    bytesSaved += shard.bytesSaved.load(memory_order_relaxed);
+    tooLong += shard.tooLong.load(memory_order_relaxed);
+    bytesIn += shard.bytesIn.load(memory_order_relaxed);
+    bytesOut += shard.bytesOut.load(memory_order_relaxed);
+    connectionsOpened += shard.connectionsOpened.load(memory_order_relaxed);
+    connectionsClosed += shard.connectionsClosed.load(memory_order_relaxed);
+    acceptFailures += shard.acceptFailures.load(memory_order_relaxed);
+    handshakeTimeouts += shard.handshakeTimeouts.load(memory_order_relaxed);
+    for (unsigned i = 0; i < LATENCY_BUCKETS; ++i) {
+        latency[i] += shard.latency[i].load(memory_order_relaxed);
+    }
+}
+
+void MetricsSnapshot::sortQueues() {
+    auto deeper = [](const QueueDepth &a, const QueueDepth &b) {
+        if (a.bytes != b.bytes) return a.bytes > b.bytes;
+        return a.received > b.received;
+    };
+    size_t kept = min(queues.size(), METRICS_TOP_QUEUES);
+    partial_sort(queues.begin(), queues.begin() + kept, queues.end(), deeper);
+    queues.resize(kept);
+}
+
+double MetricsSnapshot::latencyPercentile(double fraction) const {
+    uint64_t total = 0;
+    for (uint64_t count : latency) total += count;
+    if (total == 0) return 0;
+
+    uint64_t rank = static_cast<uint64_t>(fraction * (total - 1)) + 1;
+    uint64_t seen = 0;
+    unsigned bucket = 0;
+    for (; bucket < LATENCY_BUCKETS - 1; ++bucket) {
+        seen += latency[bucket];
+        if (seen >= rank) break;
+    }
+    return static_cast<double>(uint64_t(1) << (bucket + 1)) / 1000;
+}
+
+string MetricsSnapshot::toText() const {
+    uint64_t active = connectionsOpened - connectionsClosed;
+    string out;
+    out += "connections_active " + to_string(active) + "\n";
+    out += "connections_opened " + to_string(connectionsOpened) + "\n";
+    out += "clients_logged_on " + to_string(loggedOn) + "\n";
+    out += "accept_failures " + to_string(acceptFailures) + "\n";
+    out += "handshake_timeouts " + to_string(handshakeTimeouts) + "\n";
+    out += "messages_routed " + to_string(messagesRouted) + "\n";
+    out += "messages_undeliverable " + to_string(undeliverable) + "\n";
+    out += "messages_stored_offline " + to_string(storedOffline) + "\n";
+    out += "messages_send_failed " + to_string(sendFailures) + "\n";
+    out += "messages_dropped " + to_string(dropped) + "\n";
+    out += "messages_forwarded " + to_string(forwarded) + "\n";
+    out += "messages_unreachable " + to_string(unreachable) + "\n";
+    out += "messages_from_peers " + to_string(fromPeers) + "\n";
+    out += "peer_links " + to_string(peerLinks) + "\n";
+    out += "messages_lost_on_links " + to_string(lostOnLinks) + "\n";
+    out += "messages_spliced " + to_string(spliced) + "\n";
+    out += "messages_compressed " + to_string(compressed) + "\n";
+    out += "messages_too_long " + to_string(tooLong) + "\n";
+    out += "bytes_in " + to_string(bytesIn) + "\n";
+    out += "bytes_out " + to_string(bytesOut) + "\n";
+    out += "bytes_saved_compression " + to_string(bytesSaved) + "\n";
+    out += "latency_us p50=" + formatMicros(latencyPercentile(0.5))
+           + " p99=" + formatMicros(latencyPercentile(0.99))
+           + " p999=" + formatMicros(latencyPercentile(0.999)) + "\n";
+    for (const QueueDepth &queue : queues) {
+        out += "queue " + queue.nickname + " bytes=" + to_string(queue.bytes)
+               + " received=" + to_string(queue.received) + "\n";
+    }
+    return out;
+}
+
+string MetricsSnapshot::toJson() const {
+    uint64_t active = connectionsOpened - connectionsClosed;
+    string out = "{";
+    out += "\"connections_active\":" + to_string(active);
+    out += ",\"connections_opened\":" + to_string(connectionsOpened);
+    out += ",\"clients_logged_on\":" + to_string(loggedOn);
+    out += ",\"accept_failures\":" + to_string(acceptFailures);
+    out += ",\"handshake_timeouts\":" + to_string(handshakeTimeouts);
+    out += ",\"messages_routed\":" + to_string(messagesRouted);
+    out += ",\"messages_undeliverable\":" + to_string(undeliverable);
+    out += ",\"messages_stored_offline\":" + to_string(storedOffline);
+    out += ",\"messages_send_failed\":" + to_string(sendFailures);
+    out += ",\"messages_dropped\":" + to_string(dropped);
+    out += ",\"messages_forwarded\":" + to_string(forwarded);
+    out += ",\"messages_unreachable\":" + to_string(unreachable);
+    out += ",\"messages_from_peers\":" + to_string(fromPeers);
+    out += ",\"peer_links\":" + to_string(peerLinks);
+    out += ",\"messages_lost_on_links\":" + to_string(lostOnLinks);
+    out += ",\"messages_spliced\":" + to_string(spliced);
+    out += ",\"messages_compressed\":" + to_string(compressed);
+    out += ",\"messages_too_long\":" + to_string(tooLong);
+    out += ",\"bytes_in\":" + to_string(bytesIn);
+    out += ",\"bytes_out\":" + to_string(bytesOut);
+    out += ",\"bytes_saved_compression\":" + to_string(bytesSaved);
+
+    out += ",\"latency_us\":{\"p50\":" + formatMicros(latencyPercentile(0.5))
+           + ",\"p99\":" + formatMicros(latencyPercentile(0.99))
+           + ",\"p999\":" + formatMicros(latencyPercentile(0.999))
+           + ",\"buckets_ns\":[";
+    for (unsigned i = 0; i < LATENCY_BUCKETS; ++i) {
+        if (i > 0) out += ',';
+        out += to_string(latency[i]);
+    }
+    out += "]}";
+
+    out += ",\"queues\":[";
+    for (size_t i = 0; i < queues.size(); ++i) {
+        if (i > 0) out += ',';
+        out += "{\"nickname\":";
+        appendJsonString(out, queues[i].nickname);
+        out += ",\"bytes\":" + to_string(queues[i].bytes)
+               + ",\"received\":" + to_string(queues[i].received) + "}";
+    }
+    out += "]}\n";
+    return out;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file metrics.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the live metrics of the server
+ * @date 2024
+ *
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+constexpr unsigned LATENCY_BUCKETS = 32; //< Bucket i: [2^i, 2^(i+1)) ns
+constexpr size_t METRICS_TOP_QUEUES = 10; //< Destinations listed
+
+/**
+ * @brief Add to a counter only ever written by the calling thread.
+ *
+ * @note A plain load and store: no locked instruction on the hot path, while
+ * other threads may still read the counter at any time.
+ */
+inline void bump(atomic<uint64_t> &counter, uint64_t n = 1) {
+    counter.store(counter.load(memory_order_relaxed) + n,
+                  memory_order_relaxed);
+}
+
+/**
+ * @struct ShardMetrics
+ * @brief The counters of one reactor, written by its thread only.
+ *
+ * @details Aligned on a cache line, so that the reactors never write to the
+ * same line; the admin thread sums the shards when asked for a report.
+ */
+struct alignas(64) ShardMetrics {
+    atomic<uint64_t> messagesRouted = 0; //< Handed to a logged-on client
+    atomic<uint64_t> undeliverable = 0;  //< Destination not logged on
+    atomic<uint64_t> storedOffline = 0;  //< Undeliverable but stored
+    atomic<uint64_t> sendFailures = 0;   //< Destination closing or dropped
+    atomic<uint64_t> dropped = 0;        //< By the drop-oldest policy
+    atomic<uint64_t> forwarded = 0;      //< To the node of the destination
+    atomic<uint64_t> unreachable = 0;    //< Its node's link down or full
+    atomic<uint64_t> spliced = 0;        //< Routed, body spliced (epoll)
+    atomic<uint64_t> compressed = 0;     //< Frames sent compressed
+    atomic<uint64_t> bytesSaved = 0;     //< By compressing them
+    atomic<uint64_t> tooLong = 0;        //< Rejected, over the max length
+    atomic<uint64_t> bytesIn = 0;
+    atomic<uint64_t> bytesOut = 0;
+    atomic<uint64_t> connectionsOpened = 0;
+    atomic<uint64_t> connectionsClosed = 0;
+    atomic<uint64_t> acceptFailures = 0; //< Including the clients refused
+    atomic<uint64_t> handshakeTimeouts = 0; //< Closed before logging on
+
+    /**
+     * @brief Log-bucketed time spent by messages inside the server, from
+     * being decoded to being queued for their destination.
+     */
+    atomic<uint64_t> latency[LATENCY_BUCKETS] = {};
+
+    /**
+     * @brief Count the time spent by a message inside the server.
+     *
+     * @param receivedAt When the message was decoded.
+     */
+    void recordLatency(chrono::steady_clock::time_point receivedAt);
+};
+
+/**
+ * @brief The output queue of one logged-on client.
+ */
+struct QueueDepth {
+    string nickname;
+    size_t bytes;      //< Bytes queued and not written yet
+    uint64_t received; //< Frames queued since the client logged on
+};
+
+/**
+ * @struct MetricsSnapshot
+ * @brief The sum of the counters of every shard at a given time.
+ */
+struct MetricsSnapshot {
+    uint64_t messagesRouted = 0;
+    uint64_t undeliverable = 0;
+    uint64_t storedOffline = 0;
+    uint64_t sendFailures = 0;
+    uint64_t dropped = 0;
+    uint64_t forwarded = 0;
+    uint64_t unreachable = 0;
+    uint64_t spliced = 0;
+    uint64_t compressed = 0;
+    uint64_t bytesSaved = 0;
+    uint64_t tooLong = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t connectionsOpened = 0;
+    uint64_t connectionsClosed = 0;
+    uint64_t acceptFailures = 0;
+    uint64_t handshakeTimeouts = 0;
+    uint64_t latency[LATENCY_BUCKETS] = {};
+
+    size_t loggedOn = 0;       //< Clients registered
+    uint64_t fromPeers = 0;    //< Messages forwarded to us by other nodes
+    uint64_t peerLinks = 0;    //< Other nodes we are connected to
+    uint64_t lostOnLinks = 0;  //< Forwarded, then dropped with their link
+    vector<QueueDepth> queues; //< Deepest queues first
+
+    /**
+     * @brief Add the counters of a shard.
+     */
+    void add(const ShardMetrics &shard);
+
+    /**
+     * @brief Keep the METRICS_TOP_QUEUES deepest queues (then the busiest
+     * clients), deepest first.
+     */
+    void sortQueues();
+
+    /**
+     * @brief Estimate a latency percentile, from the upper bound of the bucket
+     * it falls in.
+     *
+     * @param fraction The percentile, between 0 and 1.
+     *
+     * @return double The latency in microseconds (0 if nothing was measured).
+     */
+    double latencyPercentile(double fraction) const;
+
+    /**
+     * @brief Render the snapshot as "name value" lines.
+     */
+    string toText() const;
+
+    /**
+     * @brief Render the snapshot as a JSON object.
+     */
+    string toJson() const;
+};
+
+#endif // METRICS_HPP
@@ -0,0 +1,669 @@
+/**
+ * @file offline_store.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the store of the messages sent to offline clients
+ * @date 2024
+ *
+ */
+
+#include "offline_store.hpp"
+#include "../../common/header/header.hpp"
+#include "../../common/signal/mask.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t SEGMENT_MAGIC = 0x4c4b4f46; //< "LKOF"
+
+/**
+ * @brief Size of the fixed part of a record: its size, its time and the size
+ * of the sender's nickname.
+ */
+constexpr size_t RECORD_HEADER_SIZE =
+    sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint8_t);
+
+/**
+ * @brief Bit of the sender's size set on the fragments of a message going on
+ * in the next record (nicknames are shorter than 128 bytes).
+ */
+constexpr uint8_t RECORD_MORE = 0x80;
+
+/**
+ * @brief Turn a nickname (any bytes) into a directory name.
+ */
+string toDirName(const string &nickname) {
+    static const char digits[] = "0123456789abcdef";
+    string ret;
+    ret.reserve(nickname.size() * 2);
+    for (unsigned char c : nickname) {
+        ret += digits[c >> 4];
+        ret += digits[c & 0xf];
+    }
+    return ret;
+}
+
+/**
+ * @brief Inverse of toDirName.
+ *
+ * @return bool False if name is not a valid directory name.
+ */
+bool fromDirName(const string &name, string &nickname) {
+    if (name.empty() or name.size() % 2 != 0) return false;
+
+    auto digit = [](char c) {
+        if (c >= '0' and c <= '9') return c - '0';
+        if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    nickname.clear();
+    for (size_t i = 0; i < name.size(); i += 2) {
+        int high = digit(name[i]);
+        int low = digit(name[i + 1]);
+        if (high < 0 or low < 0) return false;
+        nickname += static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
+
+/**
+ * @brief The path of the segment file number seq in dir.
+ */
+string segmentPath(const string &dir, uint64_t seq) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016" PRIu64 ".seg", seq);
+    return dir + "/" + name;
+}
+
+/**
+ * @brief Write a record at the given address.
+ */
+void writeRecord(char *record, string_view sender, string_view message,
+                 bool more, int64_t now) {
+    uint32_t size = RECORD_HEADER_SIZE + sender.size() + message.size();
+    uint8_t senderSize = sender.size() | (more ? RECORD_MORE : 0);
+    memcpy(record, &size, sizeof(size));
+    memcpy(record + sizeof(size), &now, sizeof(now));
+    memcpy(record + sizeof(size) + sizeof(now), &senderSize,
+           sizeof(senderSize));
+    memcpy(record + RECORD_HEADER_SIZE, sender.data(), sender.size());
+    memcpy(record + RECORD_HEADER_SIZE + sender.size(), message.data(),
+           message.size());
+}
+
+} // namespace
+
+// ### Destructor ###
+OfflineStore::Segment::~Segment() {
+    if (munmap(map, OFFLINE_SEGMENT_SIZE) != 0) perror("munmap");
+}
+
+OfflineStore::Mailbox::~Mailbox() { pthread_mutex_destroy(&mtx); }
+
+OfflineStore::Shard::~Shard() { pthread_mutex_destroy(&mtx); }
+
+OfflineStore::~OfflineStore() {
+    close();
+
+    if (pthread_cond_destroy(&syncCond_) != 0
+        or pthread_mutex_destroy(&mtx_) != 0
+        or pthread_mutex_destroy(&dirtyMtx_) != 0) {
+        cerr << "Err: échec de la destruction du mutex." << endl;
+    }
+}
+
+// ### Private methods ###
+
+void *OfflineStore::syncThreadFunc(void *arg) {
+    OfflineStore *store = static_cast<OfflineStore *>(arg);
+
+    pthread_mutex_lock(&store->mtx_);
+    while (not store->stopping_) {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += OFFLINE_SYNC_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (OFFLINE_SYNC_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&store->syncCond_, &store->mtx_, &deadline);
+
+        pthread_mutex_unlock(&store->mtx_);
+        store->sync();
+        pthread_mutex_lock(&store->mtx_);
+    }
+    pthread_mutex_unlock(&store->mtx_);
+    return nullptr;
+}
+
+void OfflineStore::load(const string &name) {
+    string nickname;
+    if (not fromDirName(name, nickname)) return;
+
+    auto mailbox = make_shared<Mailbox>();
+    mailbox->dir = dir_ + "/" + name;
+
+    DIR *dir = opendir(mailbox->dir.c_str());
+    if (dir == nullptr) return;
+    vector<uint64_t> seqs;
+    while (dirent *entry = readdir(dir)) {
+        unsigned long long seq;
+        char end;
+        if (sscanf(entry->d_name, "%llu.se%c", &seq, &end) == 2
+            and end == 'g') {
+            seqs.push_back(seq);
+        }
+    }
+    closedir(dir);
+    sort(seqs.begin(), seqs.end());
+
+    for (uint64_t seq : seqs) {
+        string path = segmentPath(mailbox->dir, seq);
+        mailbox->nextSeq = seq + 1;
+
+        shared_ptr<Segment> segment = mapSegment(path, false);
+        if (segment == nullptr) continue;
+        if (segment->header->readOffset >= segment->header->writeOffset) {
+            unlink(path.c_str()); //< Replayed before the server stopped
+            continue;
+        }
+        mailbox->bytes +=
+            segment->header->writeOffset - segment->header->readOffset;
+        mailbox->segments.push_back(move(segment));
+        segmentBytes_ += OFFLINE_SEGMENT_SIZE; //< Even over maxBytes_
+    }
+
+    if (mailbox->segments.empty()) {
+        rmdir(mailbox->dir.c_str());
+    } else {
+        ++recipients_;
+        shards_[shardOf(nickname)].mailboxes.emplace(nickname, move(mailbox));
+    }
+}
+
+size_t OfflineStore::shardOf(string_view recipient) {
+    return hash<string_view>()(recipient) % OFFLINE_SHARDS;
+}
+
+shared_ptr<OfflineStore::Mailbox>
+OfflineStore::lockMailbox(string_view recipient, bool create) {
+    thread_local string key; //< Reused: looked up without allocating
+    key.assign(recipient);
+    Shard &shard = shards_[shardOf(recipient)];
+
+    while (true) {
+        shared_ptr<Mailbox> mailbox;
+        pthread_mutex_lock(&shard.mtx);
+        auto it = shard.mailboxes.find(key);
+        if (it != shard.mailboxes.end()) {
+            mailbox = it->second;
+        } else if (create and recipients_.fetch_add(1) < maxRecipients_) {
+            mailbox = make_shared<Mailbox>();
+            mailbox->dir = dir_ + "/" + toDirName(key);
+            // Locked before the others can see it, until its directory exists
+            pthread_mutex_lock(&mailbox->mtx);
+            shard.mailboxes.emplace(key, mailbox);
+            pthread_mutex_unlock(&shard.mtx);
+            if (mkdir(mailbox->dir.c_str(), 0700) != 0 and errno != EEXIST) {
+                perror("mkdir");
+            }
+            return mailbox;
+        } else if (create) {
+            --recipients_;
+        }
+        pthread_mutex_unlock(&shard.mtx);
+        if (mailbox == nullptr) return nullptr;
+
+        // Not locked with the shard, so that lookups never wait for it
+        pthread_mutex_lock(&mailbox->mtx);
+        if (not mailbox->removed) return mailbox;
+        pthread_mutex_unlock(&mailbox->mtx); //< Forgotten meanwhile
+    }
+}
+
+void OfflineStore::unlockMailbox(string_view recipient, Mailbox &mailbox) {
+    bool empty = mailbox.segments.empty() and mailbox.pending.empty();
+    pthread_mutex_unlock(&mailbox.mtx);
+    if (not empty) return;
+
+    // Locked again after the shard, in the same order as the lookups
+    thread_local string key;
+    key.assign(recipient);
+    Shard &shard = shards_[shardOf(recipient)];
+    pthread_mutex_lock(&shard.mtx);
+    pthread_mutex_lock(&mailbox.mtx);
+    if (not mailbox.removed and mailbox.segments.empty()
+        and mailbox.pending.empty()) {
+        mailbox.removed = true;
+        rmdir(mailbox.dir.c_str());
+        --recipients_;
+        shard.mailboxes.erase(key); //< mailbox is still referenced
+    }
+    pthread_mutex_unlock(&mailbox.mtx);
+    pthread_mutex_unlock(&shard.mtx);
+}
+
+shared_ptr<OfflineStore::Segment>
+OfflineStore::createSegment(Mailbox &mailbox) {
+    // Counted first, as other mailboxes may create theirs at the same time
+    if (segmentBytes_.fetch_add(OFFLINE_SEGMENT_SIZE) + OFFLINE_SEGMENT_SIZE
+        > maxBytes_) {
+        segmentBytes_ -= OFFLINE_SEGMENT_SIZE;
+        return nullptr;
+    }
+    shared_ptr<Segment> segment =
+        mapSegment(segmentPath(mailbox.dir, mailbox.nextSeq++), true);
+    if (segment == nullptr) segmentBytes_ -= OFFLINE_SEGMENT_SIZE;
+    return segment;
+}
+
+shared_ptr<OfflineStore::Segment> OfflineStore::mapSegment(const string &path,
+                                                           bool create) {
+    int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+    int fd = ::open(path.c_str(), flags, 0600);
+    if (fd < 0) {
+        cerr << "Err: " << path << " - " << strerror(errno) << endl;
+        return nullptr;
+    }
+
+    struct stat st;
+    if ((create and ftruncate(fd, OFFLINE_SEGMENT_SIZE) != 0)
+        or fstat(fd, &st) != 0
+        or static_cast<size_t>(st.st_size) != OFFLINE_SEGMENT_SIZE) {
+        cerr << "Err: Segment invalide: " << path << endl;
+        ::close(fd);
+        return nullptr;
+    }
+
+    void *map = mmap(nullptr, OFFLINE_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    ::close(fd); //< The mapping keeps the file open
+    if (map == MAP_FAILED) {
+        cerr << "Err: mmap - " << strerror(errno) << endl;
+        return nullptr;
+    }
+
+    auto segment = make_shared<Segment>();
+    segment->path = path;
+    segment->map = static_cast<char *>(map);
+    segment->header = static_cast<SegmentHeader *>(map);
+
+    SegmentHeader &header = *segment->header;
+    if (create) {
+        header.magic = SEGMENT_MAGIC;
+        header.readOffset = header.writeOffset = sizeof(SegmentHeader);
+        header.lastTime = 0;
+    } else if (header.magic != SEGMENT_MAGIC
+               or header.readOffset < sizeof(SegmentHeader)
+               or header.writeOffset > OFFLINE_SEGMENT_SIZE) {
+        cerr << "Err: Segment invalide: " << path << endl;
+        return nullptr;
+    }
+    return segment;
+}
+
+void OfflineStore::dropFront(Mailbox &mailbox) {
+    Segment &segment = *mailbox.segments.front();
+    mailbox.bytes -=
+        segment.header->writeOffset
+        - min(segment.header->readOffset, segment.header->writeOffset);
+    if (unlink(segment.path.c_str()) != 0) perror("unlink");
+    mailbox.segments.pop_front();
+    segmentBytes_ -= OFFLINE_SEGMENT_SIZE;
+}
+
+bool OfflineStore::storeWhole(Mailbox &mailbox, string_view sender,
+                              const Pending *pending, string_view last,
+                              int64_t now) {
+    size_t fixedSize = RECORD_HEADER_SIZE + sender.size();
+    // The first fragments are already counted in pendingBytes
+    if (mailbox.bytes + mailbox.pendingBytes + fixedSize + last.size()
+        > limit_) {
+        return false;
+    }
+
+    auto forEachFragment = [&](auto fn) {
+        if (pending != nullptr) {
+            const string &fragments = pending->fragments;
+            for (size_t offset = 0; offset < fragments.size();) {
+                uint32_t size;
+                memcpy(&size, fragments.data() + offset, sizeof(size));
+                offset += sizeof(size);
+                fn(string_view(fragments.data() + offset, size), true);
+                offset += size;
+            }
+        }
+        fn(last, false);
+    };
+
+    // The segments it needs are created first, so that it is stored whole or
+    // not at all
+    size_t segmentCount = mailbox.segments.size();
+    size_t room = segmentCount == 0
+                      ? 0
+                      : OFFLINE_SEGMENT_SIZE
+                            - mailbox.segments.back()->header->writeOffset;
+    bool mapped = true;
+    forEachFragment([&](string_view message, bool) {
+        size_t size = fixedSize + message.size();
+        if (not mapped) return;
+        if (size <= room) {
+            room -= size;
+            return;
+        }
+        shared_ptr<Segment> segment = createSegment(mailbox);
+        mapped = segment != nullptr;
+        if (mapped) mailbox.segments.push_back(move(segment));
+        room = OFFLINE_SEGMENT_SIZE - sizeof(SegmentHeader) - size;
+    });
+    if (not mapped) {
+        while (mailbox.segments.size() > segmentCount) {
+            if (unlink(mailbox.segments.back()->path.c_str()) != 0) {
+                perror("unlink");
+            }
+            mailbox.segments.pop_back();
+            segmentBytes_ -= OFFLINE_SEGMENT_SIZE;
+        }
+        return false;
+    }
+
+    size_t index = segmentCount == 0 ? 0 : segmentCount - 1;
+    forEachFragment([&](string_view message, bool more) {
+        size_t size = fixedSize + message.size();
+        if (OFFLINE_SEGMENT_SIZE
+                - mailbox.segments[index]->header->writeOffset
+            < size) {
+            ++index;
+        }
+        Segment &segment = *mailbox.segments[index];
+        writeRecord(segment.map + segment.header->writeOffset, sender,
+                    message, more, now);
+        // Published after the record, so that a crash never exposes half of
+        // it
+        segment.header->writeOffset += size;
+        segment.header->lastTime = now;
+        mailbox.bytes += size;
+        markDirty(mailbox.segments[index]);
+    });
+    return true;
+}
+
+void OfflineStore::markDirty(const shared_ptr<Segment> &segment) {
+    if (segment->dirty.exchange(true)) return;
+    pthread_mutex_lock(&dirtyMtx_);
+    dirty_.push_back(segment);
+    pthread_mutex_unlock(&dirtyMtx_);
+}
+
+void OfflineStore::sync() {
+    vector<shared_ptr<Segment>> dirty;
+    time_t now = time(nullptr);
+
+    // Cleared before the msync: a record written after it marks it again
+    pthread_mutex_lock(&dirtyMtx_);
+    dirty.swap(dirty_);
+    for (auto &segment : dirty) segment->dirty = false;
+    pthread_mutex_unlock(&dirtyMtx_);
+
+    for (Shard &shard : shards_) {
+        pthread_mutex_lock(&shard.mtx);
+        for (auto it = shard.mailboxes.begin(); it != shard.mailboxes.end();) {
+            Mailbox &mailbox = *it->second;
+            pthread_mutex_lock(&mailbox.mtx);
+            // Every record of a segment is older than its last one. The
+            // message a replay is in goes on whole
+            while (not mailbox.segments.empty() and not mailbox.midMessage
+                   and mailbox.segments.front()->header->lastTime + ttl_
+                           < now) {
+                dropFront(mailbox);
+            }
+            // Senders gone before the last fragment of their message
+            for (auto pending = mailbox.pending.begin();
+                 pending != mailbox.pending.end();) {
+                if (pending->second.since + OFFLINE_PENDING_TIMEOUT < now) {
+                    mailbox.pendingBytes -= pending->second.bytes;
+                    pending = mailbox.pending.erase(pending);
+                } else {
+                    ++pending;
+                }
+            }
+            bool empty =
+                mailbox.segments.empty() and mailbox.pending.empty();
+            if (empty) {
+                mailbox.removed = true;
+                rmdir(mailbox.dir.c_str());
+                --recipients_;
+            }
+            pthread_mutex_unlock(&mailbox.mtx);
+            it = empty ? shard.mailboxes.erase(it) : next(it);
+        }
+        pthread_mutex_unlock(&shard.mtx);
+    }
+
+    // Outside the locks: the segments stay mapped while referenced here
+    for (auto &segment : dirty) {
+        if (msync(segment->map, OFFLINE_SEGMENT_SIZE, MS_SYNC) != 0) {
+            perror("msync");
+        }
+    }
+}
+
+// ### Public methods ###
+
+bool OfflineStore::open(const string &dir, size_t limit, time_t ttl,
+                        size_t maxRecipients, size_t maxBytes) {
+    dir_ = dir;
+    limit_ = limit;
+    ttl_ = ttl;
+    maxRecipients_ = maxRecipients;
+    maxBytes_ = maxBytes;
+
+    if (mkdir(dir_.c_str(), 0700) != 0 and errno != EEXIST) {
+        cerr << "Err: Le dossier " << dir_
+             << " n'a pas pu être créé - " << strerror(errno) << endl;
+        return false;
+    }
+    DIR *root = opendir(dir_.c_str());
+    if (root == nullptr) {
+        cerr << "Err: Le dossier " << dir_
+             << " n'a pas pu être ouvert - " << strerror(errno) << endl;
+        return false;
+    }
+    while (dirent *entry = readdir(root)) {
+        if (entry->d_name[0] != '.') load(entry->d_name);
+    }
+    closedir(root);
+
+    // Signals are handled by the main thread only
+    if (not setSigMask(true)) return false;
+    int ret = pthread_create(&syncThread_, nullptr, syncThreadFunc, this);
+    bool unmasked = setSigMask(false);
+    if (ret != 0) {
+        cerr << "Err: Impossible de créer le thread de synchronisation."
+             << endl;
+        syncThread_ = 0;
+        return false;
+    }
+
+    enabled_ = true;
+    return unmasked;
+}
+
+void OfflineStore::close() {
+    if (syncThread_ != 0) {
+        pthread_mutex_lock(&mtx_);
+        stopping_ = true;
+        pthread_cond_signal(&syncCond_);
+        pthread_mutex_unlock(&mtx_);
+        pthread_join(syncThread_, nullptr);
+        syncThread_ = 0;
+        stopping_ = false;
+    }
+    if (not enabled_) return;
+    sync();
+
+    // The segments are unmapped with their last reference
+    for (Shard &shard : shards_) {
+        pthread_mutex_lock(&shard.mtx);
+        shard.mailboxes.clear();
+        pthread_mutex_unlock(&shard.mtx);
+    }
+    pthread_mutex_lock(&dirtyMtx_);
+    dirty_.clear();
+    pthread_mutex_unlock(&dirtyMtx_);
+    recipients_ = 0;
+    segmentBytes_ = 0;
+    enabled_ = false;
+}
+
+bool OfflineStore::reopen() {
+    return dir_.empty()
+           or open(dir_, limit_, ttl_, maxRecipients_, maxBytes_);
+}
+
+bool OfflineStore::enabled() const { return enabled_; }
+
+bool OfflineStore::store(string_view recipient, string_view sender,
+                         string_view message, bool more) {
+    if (not enabled_) return false;
+
+    size_t recordSize = RECORD_HEADER_SIZE + sender.size() + message.size();
+    bool tooLong = recordSize > OFFLINE_SEGMENT_SIZE - sizeof(SegmentHeader);
+    int64_t now = time(nullptr);
+    thread_local string senderKey;
+    senderKey.assign(sender);
+
+    shared_ptr<Mailbox> locked = lockMailbox(recipient, true);
+    if (locked == nullptr) return false; //< Too many recipients
+    Mailbox &mailbox = *locked;
+
+    bool stored;
+    if (more) {
+        // Kept until the last fragment: the whole message is stored or none
+        Pending &pending = mailbox.pending[senderKey];
+        pending.since = now;
+        if (not pending.discarding
+            and (tooLong
+                 or mailbox.bytes + mailbox.pendingBytes + recordSize
+                        > limit_)) {
+            mailbox.pendingBytes -= pending.bytes;
+            pending = Pending{{}, 0, now, true};
+        }
+        if (not pending.discarding) {
+            uint32_t size = message.size();
+            pending.fragments.append(reinterpret_cast<const char *>(&size),
+                                     sizeof(size));
+            pending.fragments.append(message);
+            pending.bytes += recordSize;
+            mailbox.pendingBytes += recordSize;
+        }
+        stored = not pending.discarding;
+    } else {
+        auto pendingIt = mailbox.pending.find(senderKey);
+        const Pending *pending =
+            pendingIt == mailbox.pending.end() ? nullptr : &pendingIt->second;
+        stored = not tooLong
+                 and (pending == nullptr or not pending->discarding)
+                 and storeWhole(mailbox, sender, pending, message, now);
+        if (pending != nullptr) {
+            mailbox.pendingBytes -= pending->bytes;
+            mailbox.pending.erase(pendingIt);
+        }
+    }
+
+    unlockMailbox(recipient, mailbox);
+    return stored;
+}
+
+bool OfflineStore::replay(string_view recipient, size_t budget,
+                          const OfflineDeliver &deliver) {
+    if (not enabled_) return false;
+
+    shared_ptr<Mailbox> locked = lockMailbox(recipient, false);
+    if (locked == nullptr) return false;
+    Mailbox &mailbox = *locked;
+    time_t now = time(nullptr);
+
+    // Handed out once unlocked: the records stay mapped while their segments
+    // are referenced here, and are never written again
+    struct Replayed {
+        string_view sender;
+        string_view message;
+        bool more;
+    };
+    thread_local vector<Replayed> replayed;
+    thread_local vector<shared_ptr<Segment>> mapped;
+    bool left = false;
+
+    while (not left and not mailbox.segments.empty()) {
+        shared_ptr<Segment> &segment = mailbox.segments.front();
+        SegmentHeader &header = *segment->header;
+
+        while (header.readOffset < header.writeOffset) {
+            const char *record = segment->map + header.readOffset;
+            uint32_t size;
+            int64_t storedAt;
+            uint8_t senderSize;
+            memcpy(&size, record, sizeof(size));
+            memcpy(&storedAt, record + sizeof(size), sizeof(storedAt));
+            memcpy(&senderSize, record + sizeof(size) + sizeof(storedAt),
+                   sizeof(senderSize));
+            bool more = senderSize & RECORD_MORE;
+            senderSize &= ~RECORD_MORE;
+
+            if (size < RECORD_HEADER_SIZE + senderSize
+                or size > header.writeOffset - header.readOffset) {
+                cerr << "Err: Segment corrompu: " << segment->path << endl;
+                break;
+            }
+
+            // The fragments of a message have the same time: it is either
+            // expired whole, or going on from a previous replay
+            if (mailbox.midMessage or storedAt + ttl_ >= now) {
+                size_t messageSize = size - RECORD_HEADER_SIZE - senderSize;
+                size_t frameSize =
+                    MAX_HEADER_SIZE + senderSize + messageSize;
+                if (frameSize > budget) {
+                    markDirty(segment);
+                    left = true;
+                    break;
+                }
+                budget -= frameSize;
+
+                const char *senderData = record + RECORD_HEADER_SIZE;
+                replayed.push_back(
+                    {string_view(senderData, senderSize),
+                     string_view(senderData + senderSize, messageSize),
+                     more});
+                if (mapped.empty() or mapped.back() != segment) {
+                    mapped.push_back(segment);
+                }
+                mailbox.midMessage = more;
+            }
+            header.readOffset += size;
+            mailbox.bytes -= size;
+        }
+        if (not left) dropFront(mailbox);
+    }
+    unlockMailbox(recipient, mailbox);
+
+    for (const Replayed &message : replayed) {
+        deliver(message.sender, message.message, message.more);
+    }
+    replayed.clear();
+    mapped.clear();
+    return left;
+}
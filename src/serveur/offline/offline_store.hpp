@@ -0,0 +1,313 @@
+/**
+ * @file offline_store.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the store of the messages sent to offline clients
+ * @date 2024
+ *
+ */
+
+#ifndef OFFLINE_STORE_HPP
+#define OFFLINE_STORE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t OFFLINE_SEGMENT_SIZE = 256 * 1024;   //< Bytes per file
+constexpr size_t DEFAULT_OFFLINE_LIMIT = 1024 * 1024; //< Bytes per recipient
+constexpr size_t DEFAULT_OFFLINE_RECIPIENTS = 4096;   //< Mailboxes at most
+constexpr size_t DEFAULT_OFFLINE_TOTAL = 1024 * 1024 * 1024; //< All segments
+constexpr size_t OFFLINE_SHARDS = 64; //< Locked one at a time
+constexpr time_t DEFAULT_OFFLINE_TTL = 7 * 24 * 3600; //< Seconds
+constexpr unsigned OFFLINE_SYNC_INTERVAL_MS = 1000;   //< Between two fsync
+constexpr time_t OFFLINE_PENDING_TIMEOUT = 60; //< Seconds a fragment waits
+
+/**
+ * @brief Called for every message replayed: the sender, the message and
+ * whether it is a fragment going on in the next one.
+ */
+using OfflineDeliver = function<void(string_view, string_view, bool)>;
+
+/**
+ * @class OfflineStore
+ * @brief Durable per-recipient queues of the messages sent to clients that
+ * are not logged on.
+ *
+ * @details Every recipient has a directory of append-only segment files, each
+ * mapped in memory: storing a message is a memcpy into the last segment. The
+ * header of a segment is its index: the offsets of the first record not
+ * replayed yet and of the end of the records, and the time of the last one.
+ * Records are length-prefixed, so replaying walks them from the read offset.
+ *
+ * The fragments of a message are kept in memory until its last one, then
+ * stored together with the same time: a message is stored and expires whole,
+ * never cut by the size limit or the lifetime.
+ *
+ * The mailboxes are split into OFFLINE_SHARDS tables by the hash of their
+ * recipient, each with its lock held for lookups only: every mailbox has its
+ * own lock, so storing for different recipients never waits. The number of
+ * mailboxes and the size of all the segments are capped, so that messages to
+ * made-up nicknames cannot fill the disk.
+ *
+ * Nothing is synced by the callers: a thread msyncs the modified segments
+ * every OFFLINE_SYNC_INTERVAL_MS and removes the expired ones, so a crash
+ * loses at most the messages of the last interval.
+ */
+class OfflineStore {
+  private:
+    /**
+     * @brief The index at the start of every segment file.
+     */
+    struct SegmentHeader {
+        uint32_t magic;
+        uint32_t readOffset;  //< First record not replayed yet
+        uint32_t writeOffset; //< End of the records
+        uint32_t reserved;
+        int64_t lastTime; //< When the last record was stored
+    };
+
+    /**
+     * @brief A mapped segment file, unmapped when the last reference drops.
+     */
+    struct Segment {
+        string path;
+        char *map;
+        SegmentHeader *header;      //< At the start of map
+        atomic<bool> dirty = false; //< Modified since the last msync
+
+        ~Segment();
+    };
+
+    /**
+     * @brief The first fragments of a message from a sender, waiting for its
+     * last one.
+     */
+    struct Pending {
+        string fragments;        //< Each one: its size (uint32_t), its bytes
+        size_t bytes = 0;        //< Size of their records once stored
+        time_t since = 0;        //< When the last one arrived
+        bool discarding = false; //< Over the limit: dropped until the last one
+    };
+
+    /**
+     * @brief The segments of a recipient, oldest first.
+     *
+     * @note Everything but mtx is protected by mtx.
+     */
+    struct Mailbox {
+        pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+        bool removed = false; //< Forgotten by its shard: look it up again
+        string dir;
+        uint64_t nextSeq = 0;    //< Number of the next segment file
+        size_t bytes = 0;        //< Size of the records not replayed yet
+        size_t pendingBytes = 0; //< Size of the fragments of pending
+        bool midMessage = false; //< The replay stopped inside a message
+        deque<shared_ptr<Segment>> segments;
+        unordered_map<string, Pending> pending; //< By sender
+
+        ~Mailbox();
+    };
+
+    /**
+     * @brief The mailboxes of the recipients with the same hash.
+     */
+    struct Shard {
+        pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+        unordered_map<string, shared_ptr<Mailbox>> mailboxes; //< By mtx
+
+        ~Shard();
+    };
+
+    string dir_;
+    size_t limit_ = DEFAULT_OFFLINE_LIMIT;
+    time_t ttl_ = DEFAULT_OFFLINE_TTL;
+    size_t maxRecipients_ = DEFAULT_OFFLINE_RECIPIENTS;
+    size_t maxBytes_ = DEFAULT_OFFLINE_TOTAL;
+    bool enabled_ = false;
+
+    Shard shards_[OFFLINE_SHARDS];
+    atomic<size_t> recipients_ = 0;   //< Mailboxes in the shards
+    atomic<size_t> segmentBytes_ = 0; //< Size of their segment files
+
+    pthread_mutex_t dirtyMtx_ = PTHREAD_MUTEX_INITIALIZER;
+    vector<shared_ptr<Segment>> dirty_; //< Protected by dirtyMtx_
+
+    pthread_mutex_t mtx_ = PTHREAD_MUTEX_INITIALIZER; //< For syncCond_
+    pthread_t syncThread_ = 0;
+    pthread_cond_t syncCond_ = PTHREAD_COND_INITIALIZER;
+    bool stopping_ = false; //< Protected by mtx_
+
+    /**
+     * @brief Thread function syncing the segments on a timer.
+     *
+     * @param arg A pointer to the OfflineStore object.
+     * @return void* Return a pointer to void.
+     */
+    static void *syncThreadFunc(void *arg);
+
+    /**
+     * @brief Map the segments of a recipient found on disk.
+     *
+     * @param name The name of the recipient's directory.
+     */
+    void load(const string &name);
+
+    /**
+     * @brief Get the shard of a recipient.
+     */
+    static size_t shardOf(string_view recipient);
+
+    /**
+     * @brief Find the mailbox of a recipient, creating it if asked to, and
+     * lock it.
+     *
+     * @return shared_ptr<Mailbox> The locked mailbox; nullptr if there is
+     * none, or if there are already as many as allowed.
+     */
+    shared_ptr<Mailbox> lockMailbox(string_view recipient, bool create);
+
+    /**
+     * @brief Unlock a mailbox, forgetting it if it holds nothing anymore.
+     */
+    void unlockMailbox(string_view recipient, Mailbox &mailbox);
+
+    /**
+     * @brief Create the next segment file of a mailbox, if the size of all
+     * the segments allows it.
+     *
+     * @note The mailbox's lock must be held.
+     *
+     * @return shared_ptr<Segment> The segment; nullptr if it is not allowed
+     * or in case of error.
+     */
+    shared_ptr<Segment> createSegment(Mailbox &mailbox);
+
+    /**
+     * @brief Map a segment file, creating it if asked to.
+     *
+     * @return shared_ptr<Segment> The segment; nullptr in case of error.
+     */
+    shared_ptr<Segment> mapSegment(const string &path, bool create);
+
+    /**
+     * @brief Delete a segment file and forget it.
+     *
+     * @note The mailbox's lock must be held and the segment must be its
+     * first.
+     */
+    void dropFront(Mailbox &mailbox);
+
+    /**
+     * @brief Store a message whole, after its first fragments, all with the
+     * same time.
+     *
+     * @note The mailbox's lock must be held.
+     *
+     * @param pending The first fragments; nullptr if it is not fragmented.
+     * @param last The last fragment (or the whole message).
+     *
+     * @return bool False if it is over the limit or a segment could not be
+     * created: nothing is stored then.
+     */
+    bool storeWhole(Mailbox &mailbox, string_view sender,
+                    const Pending *pending, string_view last, int64_t now);
+
+    /**
+     * @brief Remember that a segment must be synced.
+     */
+    void markDirty(const shared_ptr<Segment> &segment);
+
+    /**
+     * @brief Sync the modified segments and remove the expired ones.
+     */
+    void sync();
+
+  public:
+    /**
+     * @brief Construct a new, disabled OfflineStore object.
+     */
+    OfflineStore() = default;
+
+    /**
+     * @brief Destroy the OfflineStore object, syncing it one last time.
+     */
+    ~OfflineStore();
+
+    OfflineStore(const OfflineStore &) = delete;
+    OfflineStore &operator=(const OfflineStore &) = delete;
+
+    /**
+     * @brief Enable the store, loading the messages already in the directory,
+     * and start the sync thread.
+     *
+     * @param dir The directory of the store, created if needed.
+     * @param limit Max bytes stored for a recipient.
+     * @param ttl Seconds after which a message is not replayed anymore.
+     * @param maxRecipients Max number of recipients with messages stored.
+     * @param maxBytes Max size of the segment files of all the recipients.
+     *
+     * @return bool If the operation succeded
+     */
+    bool open(const string &dir, size_t limit, time_t ttl,
+              size_t maxRecipients = DEFAULT_OFFLINE_RECIPIENTS,
+              size_t maxBytes = DEFAULT_OFFLINE_TOTAL);
+
+    /**
+     * @brief Sync the store one last time and stop using its directory (which
+     * another process may then open), until reopen is called.
+     */
+    void close();
+
+    /**
+     * @brief Open the directory of the store again, after close (nothing to
+     * do if it was never opened).
+     *
+     * @return bool If the operation succeded
+     */
+    bool reopen();
+
+    /**
+     * @brief Whether open succeeded.
+     */
+    bool enabled() const;
+
+    /**
+     * @brief Store a message for a recipient that is not logged on.
+     *
+     * @param recipient The recipient's nickname.
+     * @param sender The sender's nickname.
+     * @param message The message.
+     * @param more Whether the message is a fragment going on in the next one.
+     *
+     * @return bool False if the store is disabled, the recipient's queue or
+     * the store is full (for a fragment: if its message will not be stored).
+     */
+    bool store(string_view recipient, string_view sender,
+               string_view message, bool more = false);
+
+    /**
+     * @brief Hand the stored messages of a recipient out, oldest first, and
+     * forget them.
+     *
+     * @param recipient The recipient's nickname.
+     * @param budget Max bytes of frames to hand out.
+     * @param deliver Called for every message, with nothing locked.
+     *
+     * @return bool True if messages are left because of the budget.
+     */
+    bool replay(string_view recipient, size_t budget,
+                const OfflineDeliver &deliver);
+};
+
+#endif // OFFLINE_STORE_HPP
@@ -0,0 +1,494 @@
+/**
+ * @file epoll_reactor.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the epoll event loop driving client sockets
+ * @date 2024
+ *
+ */
+
+#include "epoll_reactor.hpp"
+#include "../server.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+// ### Constructor ###
+EpollReactor::EpollReactor(unsigned index, int listenFd)
+    : Reactor(index, listenFd) {}
+
+// ### Destructor ###
+EpollReactor::~EpollReactor() {
+    stop();
+    if (epollFd_ != -1 and close(epollFd_) != 0) perror("close");
+    if (wakeFd_ != -1 and close(wakeFd_) != 0) perror("close");
+    for (int fd : pipeFds_) {
+        if (fd != -1 and close(fd) != 0) perror("close");
+    }
+}
+
+// ### Private methods ###
+
+bool EpollReactor::setup() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd_ < 0 or wakeFd_ < 0) {
+        cerr << "Err: Le réacteur n'a pas pu être créé - " << strerror(errno)
+             << endl;
+        return false;
+    }
+
+    if (Server::getInstance().spliceThreshold_ > 0
+        and pipe2(pipeFds_, O_NONBLOCK | O_CLOEXEC) != 0) {
+        cerr << "Err: Le tube du réacteur n'a pas pu être créé - "
+             << strerror(errno) << endl;
+        return false;
+    }
+
+    // A client reset before being accepted must not block the shard
+    int flags = fcntl(listenFd_, F_GETFL);
+    if (flags < 0 or fcntl(listenFd_, F_SETFL, flags | O_NONBLOCK) != 0) {
+        cerr << "Err: Le socket du serveur n'a pas pu être rendu non bloquant."
+             << endl;
+        return false;
+    }
+
+    // The member addresses tell these two apart from the connections
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = &wakeFd_;
+    epoll_event listenEvent{};
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.ptr = &listenFd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &event) != 0
+        or epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &listenEvent) != 0) {
+        cerr << "Err: Le réacteur n'a pas pu être créé - " << strerror(errno)
+             << endl;
+        return false;
+    }
+    return true;
+}
+
+void EpollReactor::loop() {
+    epoll_event events[MAX_EPOLL_EVENTS];
+
+    // Requests left when the reactor was last stopped come first
+    drainInbox();
+    resumeAdopted();
+    endBatch();
+
+    while (running_) {
+        // Woken up in time to close the clients that never log on
+        int numEvents =
+            epoll_wait(epollFd_, events, MAX_EPOLL_EVENTS, handshakeWait());
+        if (numEvents < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Err: epoll_wait - " << strerror(errno) << endl;
+            break;
+        }
+
+        for (int i = 0; i < numEvents; ++i) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &wakeFd_) {
+                uint64_t count;
+                if (read(wakeFd_, &count, sizeof(count)) < 0
+                    and errno != EAGAIN) {
+                    perror("read");
+                }
+                drainInbox();
+            } else if (ptr == &listenFd_) {
+                acceptClient();
+            } else {
+                handleEvents(*static_cast<Connection *>(ptr), events[i].events);
+            }
+        }
+
+        expireHandshakes([this](Connection &conn) { closeLater(conn); });
+        endBatch();
+    }
+}
+
+void EpollReactor::endBatch() {
+    // Written before the closed connections are released: a rejected
+    // client must still get its handshake response
+    // By index: a flush may replay offline messages, listing more
+    for (size_t j = 0; j < dirty_.size(); ++j) {
+        Connection *conn = dirty_[j];
+        conn->flushPending = false;
+        if (not conn->socketFull) flush(*conn);
+    }
+    dirty_.clear();
+
+    // Only now: later events of the batch may point to these connections
+    for (Connection *conn : closed_) {
+        release(*conn);
+    }
+    closed_.clear();
+}
+
+void EpollReactor::wake() {
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+        perror("write");
+    }
+}
+
+void EpollReactor::acceptClient() {
+    Server &server = Server::getInstance();
+
+    // Drain the backlog, but hand over to the other events now and then:
+    // the listening socket is level-triggered, so it is reported again
+    for (int i = 0; i < MAX_ACCEPTS_PER_EVENT; ++i) {
+        int clientSockFd =
+            accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSockFd < 0) {
+            if (errno == EINTR or errno == ECONNABORTED) continue;
+            // Another connection may have been reset before being accepted
+            if (errno != EAGAIN and errno != EWOULDBLOCK) {
+                cerr << "Err: Échec de l'acceptation du nouveau client."
+                     << endl;
+                bump(metrics_.acceptFailures);
+            }
+            return;
+        }
+
+        if (server.reachedMaxClients()) {
+            cerr << "Err: Trop de clients connectés." << endl;
+            bump(metrics_.acceptFailures);
+            if (close(clientSockFd) != 0) {
+                perror("close");
+            }
+            continue;
+        }
+
+        auto conn = make_shared<Connection>(clientSockFd, "");
+        conn->reactor = this;
+        connections_[conn.get()] = conn;
+        bump(metrics_.connectionsOpened);
+        if (watch(*conn)) awaitHandshake(*conn);
+    }
+}
+
+bool EpollReactor::watch(Connection &conn) {
+    // EPOLLOUT is only reported when the socket was full and drained
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = &conn;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, conn.fd, &event) != 0) {
+        cerr << "Err: Le client n'a pas pu être surveillé - "
+             << strerror(errno) << endl;
+        release(conn);
+        return false;
+    }
+    return true;
+}
+
+void EpollReactor::resumeAdopted() {
+    vector<Connection *> adopted;
+    adopted.swap(adopted_);
+    for (auto it = adopted.begin(); it != adopted.end();) {
+        it = watch(**it) ? it + 1 : adopted.erase(it);
+    }
+
+    // Only once they are all watched: a frame read may be for any of them
+    for (Connection *conn : adopted) {
+        if (not conn->closing) handleReadable(*conn);
+        if (conn->closing) continue;
+        if (conn->replaying) replay(*conn);
+        if (not conn->flushPending) {
+            conn->flushPending = true;
+            dirty_.push_back(conn);
+        }
+    }
+}
+
+void EpollReactor::handleEvents(Connection &conn, uint32_t events) {
+    if (conn.closing) return;
+
+    if (events & EPOLLOUT) {
+        conn.socketFull = false;
+        flush(conn);
+    }
+
+    // A hang-up may still come with unread frames: read them first
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        and not conn.paused and not conn.closing) {
+        handleReadable(conn);
+    }
+}
+
+void EpollReactor::handleReadable(Connection &conn) {
+    Server &server = Server::getInstance();
+    FrameView frame;
+    bool drained = false; //< The last read left nothing in the socket
+
+    // Short reads when splicing: a large body must still be in the socket
+    // once its header is decoded
+    size_t readLimit =
+        pipeFds_[0] != -1 ? server.spliceThreshold_ : SIZE_MAX;
+
+    while (true) {
+        DecodeReturnVal ret = conn.decoder.next(frame);
+
+        if (ret == DecodeReturnVal::FRAME_READY) {
+            if (not conn.loggedOn) {
+                if (not logOn(conn, frame)) break;
+            } else if (not server.handleMessage(conn, frame)) {
+                break;
+            } else if (conn.paused or conn.closing) {
+                return; //< Read again by resumeReading
+            }
+            continue;
+        } else if (ret != DecodeReturnVal::NEED_MORE) {
+            if (not conn.loggedOn) {
+                cerr << "Err: Échec du serrage de main." << endl;
+            } else if (ret == DecodeReturnVal::MESSAGE_TOO_LONG) {
+                server.sendTooLongMessage(conn);
+            }
+            break;
+        }
+
+        // Large messages skip user space when possible
+        if (pipeFds_[0] != -1 and conn.loggedOn and spliceMessage(conn)) {
+            drained = false; //< Frames may follow the spliced body
+            continue;
+        }
+
+        // Edge-triggered: bytes arriving after a short read raise a new event
+        if (drained) return;
+
+        ssize_t bytesRead = conn.decoder.fill(conn.fd, readLimit);
+        if (bytesRead > 0) {
+            bump(metrics_.bytesIn, bytesRead);
+            drained = static_cast<size_t>(bytesRead) < readLimit
+                      and not conn.decoder.full();
+            continue;
+        } else if (bytesRead < 0) {
+            if (errno == EAGAIN or errno == EWOULDBLOCK) return;
+            if (errno == EINTR) continue;
+            if (errno == ECONNRESET)
+                cerr << "Err: L'autre partie a annulé la connexion." << endl;
+            else perror("read");
+        }
+        break;
+    }
+
+    closeLater(conn);
+}
+
+void EpollReactor::resumeReading(Connection &conn) { handleReadable(conn); }
+
+void EpollReactor::flush(Connection &conn) {
+    while (not conn.outQueue.empty() and not conn.closed) {
+        conn.outIov.clear();
+        size_t offset = conn.outOffset;
+        size_t size = 0;
+        for (FrameBuffer *frame = conn.outQueue.front(); frame != nullptr;
+             frame = frame->next) {
+            if (conn.outIov.size() == IOV_MAX) break;
+            conn.outIov.push_back(
+                {frame->data() + offset, frame->size - offset});
+            size += frame->size - offset;
+            offset = 0;
+        }
+        bool more = conn.outIov.size() < conn.outQueue.size();
+
+        struct msghdr msg{};
+        msg.msg_iov = conn.outIov.data();
+        msg.msg_iovlen = conn.outIov.size();
+        ssize_t bytesWritten = sendmsg(conn.fd, &msg, more ? MSG_MORE : 0);
+        if (bytesWritten >= 0) {
+            bump(metrics_.bytesOut, bytesWritten);
+            dequeue(conn, bytesWritten);
+            if (static_cast<size_t>(bytesWritten) < size) {
+                conn.socketFull = true; //< Wait for the next EPOLLOUT
+                return;
+            }
+        } else if (errno == EAGAIN or errno == EWOULDBLOCK) {
+            conn.socketFull = true;
+            return;
+        } else if (errno != EINTR) {
+            if (errno != EPIPE and errno != ECONNRESET) {
+                cerr << "Err: " << strerror(errno) << endl;
+            }
+            closeLater(conn);
+            return;
+        }
+    }
+}
+
+bool EpollReactor::spliceMessage(Connection &conn) {
+    Server &server = Server::getInstance();
+    FrameView frame;
+    size_t missing;
+    if (not conn.decoder.partial(frame, missing)
+        or frame.message.size() + missing < server.spliceThreshold_) {
+        return false;
+    }
+
+    // The frames queued for the destination must be written first
+    shared_ptr<Connection> dest = server.findConnectionByName(frame.nickname);
+    if (dest == nullptr or dest->reactor != this or dest->closing
+        or dest->socketFull) {
+        return false;
+    }
+    if (not dest->outQueue.empty()) flush(*dest);
+    if (dest->socketFull or dest->closing or not dest->outQueue.empty()) {
+        return false;
+    }
+    int available = 0;
+    if (ioctl(conn.fd, FIONREAD, &available) != 0
+        or static_cast<size_t>(available) < missing) {
+        return false;
+    }
+
+    // The body moves into the pipe...
+    size_t piped = 0;
+    while (piped < missing) {
+        ssize_t ret = splice(conn.fd, nullptr, pipeFds_[1], nullptr,
+                             missing - piped,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (ret > 0) piped += ret;
+        else if (ret < 0 and errno == EINTR) continue;
+        else break;
+    }
+    bump(metrics_.bytesIn, piped);
+    char body[MAX_LENGTH_MESSAGE];
+    if (piped < missing) {
+        // Read back: the frame is handled once complete, like the others
+        conn.decoder.feed(body, readPipe(body, sizeof(body)));
+        return piped > 0;
+    }
+
+    // ...after the header and the beginning of the message, written from
+    // the decoder...
+    uint8_t flags = (frame.more ? FRAME_MORE : 0)
+                    | server.nicknameFlags(conn, *dest);
+    size_t nicknameSize =
+        flags & FRAME_NICKNAME_ID ? 0 : conn.nickname.size();
+    char header[MAX_HEADER_SIZE];
+    size_t headerSize =
+        encodeHeader(header, dest->version, nicknameSize,
+                     frame.message.size() + missing, flags, conn.nicknameId);
+    struct iovec iov[3] = {
+        {header, headerSize},
+        {const_cast<char *>(conn.nickname.data()), nicknameSize},
+        {const_cast<char *>(frame.message.data()), frame.message.size()}};
+    size_t size = headerSize + nicknameSize + frame.message.size();
+
+    // A broken destination loses the message, as in flush
+    auto abandon = [&]() {
+        if (errno != EPIPE and errno != ECONNRESET) {
+            cerr << "Err: " << strerror(errno) << endl;
+        }
+        readPipe(body, sizeof(body));
+        conn.decoder.discard();
+        closeLater(*dest);
+        return true;
+    };
+
+    // Not corked with MSG_MORE: the spliced body does not always push it
+    struct msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = sizeof(iov) / sizeof(iov[0]);
+    ssize_t written;
+    do {
+        written = sendmsg(dest->fd, &msg, 0);
+    } while (written < 0 and errno == EINTR);
+    if (written < 0 and errno != EAGAIN and errno != EWOULDBLOCK) {
+        return abandon();
+    }
+    if (written < 0) written = 0;
+
+    // ...then from the pipe to the destination
+    size_t sent = 0;
+    while (static_cast<size_t>(written) == size and sent < missing) {
+        ssize_t ret = splice(pipeFds_[0], nullptr, dest->fd, nullptr,
+                             missing - sent,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (ret > 0) {
+            sent += ret;
+        } else if (ret < 0 and errno == EINTR) {
+            continue;
+        } else if (ret < 0 and errno != EAGAIN and errno != EWOULDBLOCK) {
+            return abandon();
+        } else {
+            break;
+        }
+    }
+    bump(metrics_.bytesOut, written + sent);
+    bump(metrics_.messagesRouted);
+    bump(metrics_.spliced);
+
+    if (static_cast<size_t>(written) < size or sent < missing) {
+        // Queued whole but already written in part, so that the overflow
+        // policy keeps it; the rest waits for EPOLLOUT
+        readPipe(body + sent, missing - sent);
+        struct iovec frameIov[4] = {iov[0], iov[1], iov[2], {body, missing}};
+        dest->socketFull = true;
+        if (enqueue(*dest, FrameBuffer::create(&framePool_, frameIov, 4))) {
+            dest->outOffset = written + sent;
+            if (Server::getInstance().overflowPolicy_ == OverflowPolicy::BLOCK
+                and dest->congested) {
+                pause(conn, *dest);
+            }
+        } else {
+            closeLater(*dest);
+        }
+    } else {
+        bump(dest->received);
+    }
+    conn.decoder.discard();
+    return true;
+}
+
+size_t EpollReactor::readPipe(char *buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t ret = read(pipeFds_[0], buffer + total, size - total);
+        if (ret > 0) total += ret;
+        else if (ret < 0 and errno == EINTR) continue;
+        else break;
+    }
+    return total;
+}
+
+void EpollReactor::closeLater(Connection &conn) {
+    if (conn.closing) return;
+    conn.closing = true;
+    closed_.push_back(&conn);
+}
+
+SendMessageReturnVal EpollReactor::queueFrame(Connection &dest,
+                                              FrameBuffer *frame) {
+    if (dest.closed or dest.closing) {
+        FrameBuffer::release(frame);
+        return SendMessageReturnVal::BROKEN_PIPE;
+    }
+
+    if (not enqueue(dest, frame)) {
+        closeLater(dest);
+        return SendMessageReturnVal::COULD_NOT_WRITE_ALL_BYTES;
+    }
+    if (not dest.flushPending) {
+        dest.flushPending = true;
+        dirty_.push_back(&dest);
+    }
+
+    // A long batch must not fill the queue up to the overflow policy
+    if (dest.outBytes >= Server::getInstance().outputLimit_ / 2
+        and not dest.socketFull) {
+        flush(dest);
+    }
+    return SendMessageReturnVal::SUCCESS;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file epoll_reactor.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the epoll event loop driving client sockets
+ * @date 2024
+ *
+ */
+
+#ifndef EPOLL_REACTOR_HPP
+#define EPOLL_REACTOR_HPP
+
+#include "reactor.hpp"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+constexpr int MAX_EPOLL_EVENTS = 256;
+constexpr int MAX_ACCEPTS_PER_EVENT = 64; //< Clients accepted in a row
+
+/**
+ * @class EpollReactor
+ * @brief Edge-triggered epoll loop.
+ *
+ * @details The handshake is read like any other frame, so a slow client cannot
+ * stall the shard, and a client that does not send it in time is closed.
+ * Frames are queued and every queue that grew during a batch of events is
+ * flushed once at its end, so a burst to a client goes out in a single
+ * writev; what the socket does not accept waits for EPOLLOUT.
+ *
+ * With SPLICE_SERVEUR set, large messages between two idle clients of the
+ * shard skip user space (see spliceMessage).
+ */
+class EpollReactor : public Reactor {
+  private:
+    int epollFd_ = -1;
+    int wakeFd_ = -1;           //< eventfd used to interrupt epoll_wait
+    int pipeFds_[2] = {-1, -1}; //< Carries the spliced messages (if enabled)
+
+    vector<Connection *> dirty_;  //< Flushed at the end of the batch
+    vector<Connection *> closed_; //< Released at the end of the batch
+
+    bool setup() override;
+    void loop() override;
+    void wake() override;
+
+    /**
+     * @copydoc Reactor::queueFrame
+     *
+     * @note The frame is only queued: it is written by flush at the end of
+     * the batch, or right away once the queue reaches half the output limit.
+     */
+    SendMessageReturnVal queueFrame(Connection &dest,
+                                    FrameBuffer *frame) override;
+
+    void resumeReading(Connection &conn) override;
+
+    /**
+     * @brief Flush the queues that grew during the batch of events, then
+     * release the connections closed during it.
+     */
+    void endBatch();
+
+    /**
+     * @brief Handle the events reported for a connection.
+     */
+    void handleEvents(Connection &conn, uint32_t events);
+
+    /**
+     * @brief Write as much of the output queue as the socket accepts, gathered
+     * into as few sendmsg as possible.
+     *
+     * @note Every call but the last of a flush sets MSG_MORE (corks the
+     * socket), so that a queue longer than IOV_MAX frames still goes out in
+     * full-size segments.
+     */
+    void flush(Connection &conn);
+
+    /**
+     * @brief Relay the message being received on a connection without
+     * copying its body: the header and the nickname are written from the
+     * decoder, then the body moves from socket to socket through pipeFds_.
+     *
+     * @details Only done when the whole body is already in the socket and the
+     * destination is driven by this reactor with nothing queued, so that the
+     * frames keep their order. What the destination does not accept is read
+     * back from the pipe and queued like any other frame.
+     *
+     * @return bool Whether bytes were taken from the socket (the message may
+     * then have been fed back to the decoder instead).
+     */
+    bool spliceMessage(Connection &conn);
+
+    /**
+     * @brief Read the bytes left in the pipe.
+     *
+     * @return size_t The number of bytes read into buffer.
+     */
+    size_t readPipe(char *buffer, size_t size);
+
+    /**
+     * @brief Stop using the connection and release it at the end of the
+     * current batch of events.
+     */
+    void closeLater(Connection &conn);
+
+    /**
+     * @brief Accept the pending clients (up to MAX_ACCEPTS_PER_EVENT) and
+     * start watching them, each with its handshake deadline.
+     */
+    void acceptClient();
+
+    /**
+     * @brief Add a connection to the epoll set (released on failure).
+     *
+     * @return bool If the connection is watched
+     */
+    bool watch(Connection &conn);
+
+    /**
+     * @brief Watch the adopted connections, handle the frames left in their
+     * decoders and flush their queues.
+     */
+    void resumeAdopted();
+
+    /**
+     * @brief Read and handle every complete frame available on the connection.
+     *
+     * @note With edge-triggered notifications, the socket must be drained:
+     * until EAGAIN, or until a read does not fill the decoder.
+     *
+     * @param conn The readable connection.
+     */
+    void handleReadable(Connection &conn);
+
+  public:
+    /**
+     * @brief Construct a new EpollReactor object.
+     *
+     * @param index The shard number.
+     * @param listenFd The listening socket to accept clients from.
+     */
+    EpollReactor(unsigned index, int listenFd);
+
+    /**
+     * @brief Destroy the EpollReactor object, stopping its thread if needed.
+     */
+    ~EpollReactor() override;
+};
+
+#endif // EPOLL_REACTOR_HPP
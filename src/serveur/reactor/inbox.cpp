@@ -0,0 +1,72 @@
+/**
+ * @file inbox.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the lock-free queue of frames sent to a reactor
+ * @date 2024
+ *
+ */
+
+#include "inbox.hpp"
+
+using namespace std;
+
+// ### InboxItem ###
+
+thread_local SlabPool *InboxItem::pool = nullptr;
+
+InboxItem::~InboxItem() { FrameBuffer::release(frame); }
+
+void *InboxItem::operator new(size_t size) {
+    return SlabPool::allocate(pool, size);
+}
+
+void InboxItem::operator delete(void *ptr) { SlabPool::release(ptr); }
+
+// ### Constructor ###
+Inbox::Inbox() : head_(&stub_), tail_(&stub_) {}
+
+// ### Destructor ###
+Inbox::~Inbox() {
+    InboxItem *item;
+    while ((item = pop()) != nullptr) {
+        delete item;
+    }
+}
+
+// ### Public methods ###
+
+void Inbox::push(InboxItem *item) {
+    item->next.store(nullptr, memory_order_relaxed);
+    InboxItem *prev = head_.exchange(item, memory_order_acq_rel);
+    // Until this store, the consumer cannot see the item (nor the next ones)
+    prev->next.store(item, memory_order_release);
+}
+
+InboxItem *Inbox::pop() {
+    InboxItem *tail = tail_;
+    InboxItem *next = tail->next.load(memory_order_acquire);
+
+    if (tail == &stub_) {
+        if (next == nullptr) return nullptr;
+        tail_ = next;
+        tail = next;
+        next = next->next.load(memory_order_acquire);
+    }
+
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+
+    // tail is the last item: a producer may be linking a new one
+    if (tail != head_.load(memory_order_acquire)) return nullptr;
+
+    // Put the stub back so that tail can be handed out
+    push(&stub_);
+    next = tail->next.load(memory_order_acquire);
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
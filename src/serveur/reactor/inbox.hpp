@@ -0,0 +1,107 @@
+/**
+ * @file inbox.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the lock-free queue of frames sent to a reactor
+ * @date 2024
+ *
+ */
+
+#ifndef INBOX_HPP
+#define INBOX_HPP
+
+#include "../connection/connection.hpp"
+#include "../frame_queue/frame_queue.hpp"
+#include "../slab_pool/slab_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+
+using namespace std;
+
+/**
+ * @brief What a reactor is asked to do by another one.
+ */
+enum class InboxItemKind {
+    FRAME,   //< Write frame to dest
+    WAIT,    //< Resume waiter once dest's output queue drains
+    RESUME,  //< Read dest again (dest drained the queue it was waiting on)
+    REPLAY,  //< Send dest the messages stored while it was offline
+    LOG_OUT, //< Close dest (another node won its nickname)
+};
+
+/**
+ * @brief A request posted to the reactor driving dest.
+ *
+ * @note Allocated from the pool of the posting thread (see pool), and given
+ * back to it by the reactor handling the request.
+ */
+struct InboxItem {
+    atomic<InboxItem *> next = nullptr;
+    InboxItemKind kind = InboxItemKind::FRAME;
+    shared_ptr<Connection> dest;
+    shared_ptr<Connection> waiter; //< WAIT only
+    FrameBuffer *frame = nullptr;  //< FRAME only, owned by the item
+    chrono::steady_clock::time_point receivedAt; //< FRAME only, if measured
+
+    /**
+     * @brief The pool of the calling thread, if it is a reactor's.
+     */
+    static thread_local SlabPool *pool;
+
+    InboxItem() = default;
+    ~InboxItem();
+
+    InboxItem(const InboxItem &) = delete;
+    InboxItem &operator=(const InboxItem &) = delete;
+
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+};
+
+/**
+ * @class Inbox
+ * @brief Unbounded multi-producer single-consumer queue (intrusive Vyukov
+ * queue).
+ *
+ * @details Pushing is a single atomic exchange, so senders never wait for each
+ * other nor for the consumer. Only the reactor owning the inbox may pop.
+ */
+class Inbox {
+  private:
+    atomic<InboxItem *> head_; //< Last pushed item
+    InboxItem *tail_;          //< Next item to pop (consumer only)
+    InboxItem stub_;           //< Keeps the queue non-empty
+
+  public:
+    /**
+     * @brief Construct a new, empty Inbox object.
+     */
+    Inbox();
+
+    /**
+     * @brief Destroy the Inbox object and the items it still holds.
+     */
+    ~Inbox();
+
+    Inbox(const Inbox &) = delete;
+    Inbox &operator=(const Inbox &) = delete;
+
+    /**
+     * @brief Append an item (any thread).
+     *
+     * @param item The item, now owned by the inbox.
+     */
+    void push(InboxItem *item);
+
+    /**
+     * @brief Take the oldest item (owner thread only).
+     *
+     * @return InboxItem* The item, now owned by the caller, or nullptr if the
+     * inbox is empty or the next push is not complete yet.
+     */
+    InboxItem *pop();
+};
+
+#endif // INBOX_HPP
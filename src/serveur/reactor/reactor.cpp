@@ -0,0 +1,510 @@
+/**
+ * @file reactor.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the event loops driving client sockets
+ * @date 2024
+ *
+ */
+
+#include "reactor.hpp"
+#include "../../common/signal/mask.hpp"
+#include "../server.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+/**
+ * @brief The frame pool of the calling thread, if it is a reactor's.
+ */
+thread_local SlabPool *localFramePool = nullptr;
+
+} // namespace
+
+// ### Constructor ###
+Reactor::Reactor(unsigned index, int listenFd)
+    : index_(index), listenFd_(listenFd),
+      framePool_(sizeof(FrameBuffer) + FRAME_BUFFER_CAPACITY),
+      itemPool_(sizeof(InboxItem)) {}
+
+// ### Destructor ###
+Reactor::~Reactor() {
+    for (auto &pair : connections_) {
+        if (not pair.second->loggedOn and close(pair.first->fd) != 0) {
+            perror("close");
+        }
+    }
+}
+
+// ### Private methods ###
+
+void Reactor::post(InboxItem *item) {
+    inbox_.push(item);
+    if (not wakePending_.exchange(true)) wake();
+}
+
+void Reactor::resumeWaiters(Connection &conn) {
+    // Posted even to this reactor: the waiter may be the one being handled
+    for (auto &waiter : conn.waiters) {
+        InboxItem *item = new InboxItem;
+        item->kind = InboxItemKind::RESUME;
+        item->dest = move(waiter);
+        item->dest->reactor->post(item);
+    }
+    conn.waiters.clear();
+}
+
+// ### Protected methods ###
+
+void *Reactor::threadFunc(void *arg) {
+    Reactor *reactor = static_cast<Reactor *>(arg);
+
+    reactor->framePool_.bind();
+    reactor->itemPool_.bind();
+    localFramePool = &reactor->framePool_;
+    InboxItem::pool = &reactor->itemPool_;
+
+    reactor->loop();
+    return nullptr;
+}
+
+void Reactor::pauseReading(Connection &) {}
+
+void Reactor::drainInbox() {
+    // Cleared first: a post racing with the drain wakes the loop up again
+    wakePending_ = false;
+
+    InboxItem *item;
+    while ((item = inbox_.pop()) != nullptr) {
+        Connection &dest = *item->dest;
+
+        if (item->kind == InboxItemKind::FRAME) {
+            FrameBuffer *frame = compress(dest, item->frame);
+            item->frame = nullptr;
+            // A closed destination is dropped by its own reactor
+            if (queueFrame(dest, frame) == SendMessageReturnVal::SUCCESS
+                and item->receivedAt != chrono::steady_clock::time_point{}) {
+                metrics_.recordLatency(item->receivedAt);
+            }
+        } else if (item->kind == InboxItemKind::WAIT) {
+            dest.waiters.push_back(move(item->waiter));
+            // Drained (or closed) in the meantime: no drain will resume it
+            if (not dest.congested or dest.closed) resumeWaiters(dest);
+        } else if (item->kind == InboxItemKind::REPLAY) {
+            if (not dest.closed) replay(dest);
+        } else if (item->kind == InboxItemKind::LOG_OUT) {
+            // Released by the loop once it sees the end of the stream
+            if (not dest.closed) shutdown(dest.fd, SHUT_RDWR);
+        } else if (dest.paused and not dest.closed) {
+            dest.paused = false;
+            resumeReading(dest);
+        }
+        delete item;
+    }
+}
+
+namespace {
+
+/**
+ * @brief Whether the next frames of a queue may refer to a queued frame: it
+ * binds a nickname id or its message entered the compression window.
+ */
+bool isReferenced(const FrameBuffer &frame) {
+    return frame.size > 2 and frame.data()[0] == PROTOCOL_V2
+           and (frame.data()[1] & (FRAME_NICKNAME_BIND | FRAME_COMPRESSED));
+}
+
+} // namespace
+
+bool Reactor::enqueue(Connection &conn, FrameBuffer *frame) {
+    Server &server = Server::getInstance();
+    size_t limit = server.outputLimit_;
+
+    if (conn.outBytes + frame->size > limit) {
+        switch (server.overflowPolicy_) {
+        case OverflowPolicy::DROP_OLDEST: {
+            // Frames partially written or used by a pending write must stay,
+            // as well as those the next ones refer to
+            size_t keep = conn.outInFlight;
+            if (keep == 0 and conn.outOffset > 0) keep = 1;
+
+            size_t dropped = 0;
+            FrameBuffer *prev = nullptr; //< Last frame kept
+            for (size_t i = 0; i < keep and i < conn.outQueue.size(); ++i) {
+                prev = prev == nullptr ? conn.outQueue.front() : prev->next;
+            }
+            while (conn.outBytes + frame->size > limit) {
+                FrameBuffer *oldest =
+                    prev == nullptr ? conn.outQueue.front() : prev->next;
+                if (oldest == nullptr) break;
+                if (isReferenced(*oldest)) {
+                    prev = oldest;
+                    continue;
+                }
+                conn.outQueue.removeAfter(prev);
+                conn.outBytes -= oldest->size;
+                FrameBuffer::release(oldest);
+                ++dropped;
+            }
+            if (dropped > 0) {
+                bump(metrics_.dropped, dropped);
+                // Logged once until the queue drains, not for every frame
+                if (not conn.dropping) {
+                    conn.dropping = true;
+                    cerr << "Err: Des messages pour " << conn.nickname
+                         << " sont perdus (file d'envoi pleine)." << endl;
+                }
+            }
+            break;
+        }
+        case OverflowPolicy::DISCONNECT:
+            cerr << "Err: Le client " << conn.nickname
+                 << " ne lit plus ses messages." << endl;
+            FrameBuffer::release(frame);
+            return false;
+        case OverflowPolicy::BLOCK:
+            // Queued anyway: the senders pause. Frames from a peer node or a
+            // partial splice are not throttled though, hence a hard ceiling
+            if (conn.outBytes + frame->size > 2 * limit) {
+                cerr << "Err: Le client " << conn.nickname
+                     << " ne lit plus ses messages." << endl;
+                FrameBuffer::release(frame);
+                return false;
+            }
+            conn.congested = true;
+            break;
+        }
+    }
+
+    conn.outBytes += frame->size;
+    conn.outQueue.push(frame);
+    conn.queuedBytes.store(conn.outBytes, memory_order_relaxed);
+    bump(conn.received);
+    return true;
+}
+
+void Reactor::dequeue(Connection &conn, size_t written) {
+    while (written > 0) {
+        size_t left = conn.outQueue.front()->size - conn.outOffset;
+        if (written < left) {
+            conn.outOffset += written;
+            break;
+        }
+        written -= left;
+        FrameBuffer *frame = conn.outQueue.removeAfter(nullptr);
+        conn.outBytes -= frame->size;
+        FrameBuffer::release(frame);
+        conn.outOffset = 0;
+    }
+    conn.queuedBytes.store(conn.outBytes, memory_order_relaxed);
+
+    // Resumed at half the limit, so that senders do not pause every frame
+    if (conn.congested
+        and conn.outBytes <= Server::getInstance().outputLimit_ / 2) {
+        conn.congested = false;
+        resumeWaiters(conn);
+    }
+    if (conn.dropping
+        and conn.outBytes <= Server::getInstance().outputLimit_ / 2) {
+        conn.dropping = false;
+    }
+    if (conn.replaying
+        and conn.outBytes <= Server::getInstance().outputLimit_ / 2) {
+        replay(conn);
+    }
+}
+
+bool Reactor::logOn(Connection &conn, const FrameView &frame) {
+    Server &server = Server::getInstance();
+    conn.nickname = frame.nickname;
+
+    // A v1 client sends an empty message, a later one its highest version
+    // and its capabilities
+    uint8_t capabilities = 0;
+    if (frame.message.size() == 1) {
+        uint8_t offer = frame.message[0];
+        conn.version = clamp<uint8_t>(offer & VERSION_MASK, PROTOCOL_V1,
+                                      CURRENT_VERSION);
+        conn.decoder.setVersion(conn.version);
+        if (conn.version >= PROTOCOL_V2 and (offer & CAP_NICKNAME_IDS)) {
+            capabilities |= CAP_NICKNAME_IDS;
+            conn.nicknameIds = true;
+            conn.decoder.allowNicknameIds(MAX_CLIENT_NICKNAME_IDS);
+        }
+        if (conn.version >= PROTOCOL_V2 and (offer & CAP_COMPRESSION)
+            and server.compression_) {
+            capabilities |= CAP_COMPRESSION;
+            conn.compressor =
+                make_unique<StreamCompressor>(MAX_LENGTH_MESSAGE);
+            conn.decoder.allowCompression();
+        }
+    }
+
+    // Written before any frame posted once the client is registered
+    uint8_t response = server.addClient(conn.shared_from_this())
+                           ? conn.version | capabilities
+                           : 0;
+    struct iovec iov = {&response, sizeof(response)};
+    if (writeFrame(conn, &iov, 1) != SendMessageReturnVal::SUCCESS) {
+        cerr << "Err: La réponse n'a pas pu être envoyée." << endl;
+        return false;
+    }
+    if (response != 0) replay(conn);
+    return response != 0;
+}
+
+void Reactor::replay(Connection &conn) {
+    if (conn.closed or conn.closing) return;
+    Server &server = Server::getInstance();
+
+    // Never more than the queue takes, whatever the overflow policy
+    size_t limit = server.outputLimit_;
+    size_t budget = conn.outBytes < limit ? limit - conn.outBytes : 0;
+    conn.replaying = server.offline_.replay(
+        conn.nickname, budget,
+        [&](string_view sender, string_view message, bool more) {
+            server.sendMessage(conn, sender, message,
+                               more ? FRAME_MORE : 0);
+        });
+}
+
+SendMessageReturnVal Reactor::writeFrame(Connection &dest,
+                                         const struct iovec *iov,
+                                         int iovcnt) {
+    return queueFrame(
+        dest, compress(dest, FrameBuffer::create(&framePool_, iov, iovcnt)));
+}
+
+FrameBuffer *Reactor::compress(Connection &dest, FrameBuffer *frame) {
+    // Not once over the limit: compressed frames are never dropped
+    FrameHeader header;
+    if (dest.compressor == nullptr or dest.closed
+        or dest.outBytes + frame->size > Server::getInstance().outputLimit_
+        or parseFrameHeader(frame->data(), frame->size, CURRENT_VERSION,
+                            header)
+               != DecodeReturnVal::FRAME_READY) {
+        return frame;
+    }
+
+    const char *nickname = frame->data() + header.headerSize;
+    string_view message(nickname + header.nicknameSize, header.messageSize);
+    char body[MAX_LENGTH_MESSAGE];
+    size_t size = message.size() <= sizeof(body)
+                      ? dest.compressor->compress(message, body)
+                      : 0;
+    if (size == 0) return frame; //< Does not pay off
+
+    char head[MAX_HEADER_SIZE];
+    size_t headSize =
+        encodeHeader(head, PROTOCOL_V2, header.nicknameSize, size,
+                     header.flags | FRAME_COMPRESSED, header.nicknameId);
+    struct iovec iov[3] = {{head, headSize},
+                           {const_cast<char *>(nickname), header.nicknameSize},
+                           {body, size}};
+    FrameBuffer *compressed = FrameBuffer::create(&framePool_, iov, 3);
+    bump(metrics_.compressed);
+    // Filling the window may cost a few bytes (see StreamCompressor)
+    if (compressed->size < frame->size) {
+        bump(metrics_.bytesSaved, frame->size - compressed->size);
+    }
+    FrameBuffer::release(frame);
+    return compressed;
+}
+
+void Reactor::awaitHandshake(Connection &conn) {
+    chrono::milliseconds timeout = Server::getInstance().handshakeTimeout_;
+    if (timeout.count() == 0) return;
+    handshakes_.push_back(
+        {chrono::steady_clock::now() + timeout, conn.serial, &conn});
+}
+
+int Reactor::handshakeWait() {
+    while (not handshakes_.empty()) {
+        const Handshake &front = handshakes_.front();
+        auto it = connections_.find(front.conn);
+        if (it != connections_.end() and it->second->serial == front.serial
+            and not it->second->loggedOn) {
+            auto left = front.deadline - chrono::steady_clock::now();
+            if (left <= chrono::steady_clock::duration::zero()) return 0;
+            return chrono::duration_cast<chrono::milliseconds>(left).count()
+                   + 1;
+        }
+        handshakes_.pop_front();
+    }
+    return -1;
+}
+
+void Reactor::expireHandshakes(const function<void(Connection &)> &expire) {
+    auto now = chrono::steady_clock::now();
+    while (not handshakes_.empty() and handshakes_.front().deadline <= now) {
+        Handshake handshake = handshakes_.front();
+        handshakes_.pop_front();
+
+        auto it = connections_.find(handshake.conn);
+        if (it == connections_.end() or it->second->serial != handshake.serial
+            or it->second->loggedOn or it->second->closing
+            or it->second->closed) {
+            continue;
+        }
+        cerr << "Err: Le client ne s'est pas identifié à temps." << endl;
+        bump(metrics_.handshakeTimeouts);
+        expire(*handshake.conn);
+    }
+}
+
+void Reactor::release(Connection &conn) {
+    bump(metrics_.connectionsClosed);
+    conn.congested = false;
+    resumeWaiters(conn);
+
+    if (conn.loggedOn) {
+        Server::getInstance().disconnectClient(conn);
+    } else {
+        conn.closed = true;
+        if (close(conn.fd) != 0) {
+            perror("close");
+        }
+    }
+    // Not written anymore: back to the pools while they are in use
+    conn.outQueue.clear();
+    conn.outBytes = conn.outOffset = 0;
+    conn.queuedBytes.store(0, memory_order_relaxed);
+    connections_.erase(&conn);
+}
+
+// ### Public methods ###
+
+bool Reactor::start() {
+    if (not setUp_ and not setup()) return false;
+    setUp_ = true;
+
+    // Signals are handled by the main thread only
+    if (not setSigMask(true)) return false;
+    running_ = true;
+    int ret = pthread_create(&thread_, nullptr, threadFunc, this);
+    bool unmasked = setSigMask(false);
+    if (ret != 0) {
+        cerr << "Err: Impossible de créer le thread du réacteur." << endl;
+        running_ = false;
+        thread_ = 0;
+        return false;
+    }
+
+    // Keep the shard's connections in the caches of a single core
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numCores > 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index_ % numCores, &cpus);
+        ret = pthread_setaffinity_np(thread_, sizeof(cpus), &cpus);
+        if (ret != 0) {
+            cerr << "Err: Le réacteur n'a pas pu être attaché à un cœur - "
+                 << strerror(ret) << endl;
+        }
+    }
+    return unmasked;
+}
+
+void Reactor::stop() {
+    if (thread_ == 0) return;
+
+    running_ = false;
+    wake();
+    pthread_join(thread_, nullptr);
+    thread_ = 0;
+}
+
+void Reactor::discard() {
+    InboxItem *item;
+    while ((item = inbox_.pop()) != nullptr) {
+        delete item;
+    }
+    for (auto &pair : connections_) {
+        pair.first->outQueue.clear();
+    }
+}
+
+void Reactor::adopt(const shared_ptr<Connection> &conn) {
+    conn->reactor = this;
+    connections_[conn.get()] = conn;
+    adopted_.push_back(conn.get());
+    if (not conn->loggedOn) awaitHandshake(*conn);
+}
+
+vector<shared_ptr<Connection>> Reactor::clients() const {
+    vector<shared_ptr<Connection>> ret;
+    ret.reserve(connections_.size());
+    for (const auto &pair : connections_) {
+        ret.push_back(pair.second);
+    }
+    return ret;
+}
+
+void Reactor::forEachPosted(const function<void(const InboxItem &)> &visit) {
+    // Every poster is stopped: the inbox is not being pushed to
+    vector<InboxItem *> items;
+    InboxItem *item;
+    while ((item = inbox_.pop()) != nullptr) {
+        visit(*item);
+        items.push_back(item);
+    }
+    for (InboxItem *posted : items) {
+        inbox_.push(posted);
+    }
+}
+
+SendMessageReturnVal
+Reactor::sendFrame(Connection &dest, const struct iovec *iov, int iovcnt,
+                   chrono::steady_clock::time_point receivedAt) {
+    if (thread_ != 0 and pthread_equal(pthread_self(), thread_)) {
+        SendMessageReturnVal ret = writeFrame(dest, iov, iovcnt);
+        if (ret == SendMessageReturnVal::SUCCESS
+            and receivedAt != chrono::steady_clock::time_point{}) {
+            metrics_.recordLatency(receivedAt);
+        }
+        return ret;
+    }
+
+    InboxItem *item = new InboxItem;
+    item->dest = dest.shared_from_this();
+    item->receivedAt = receivedAt; //< Measured once dest's reactor queues it
+    item->frame = FrameBuffer::create(localFramePool, iov, iovcnt);
+
+    post(item);
+    return SendMessageReturnVal::SUCCESS;
+}
+
+void Reactor::pause(Connection &conn, Connection &dest) {
+    conn.paused = true;
+    pauseReading(conn);
+
+    // Only dest's reactor may touch its waiters
+    InboxItem *item = new InboxItem;
+    item->kind = InboxItemKind::WAIT;
+    item->dest = dest.shared_from_this();
+    item->waiter = conn.shared_from_this();
+    dest.reactor->post(item);
+}
+
+void Reactor::requestReplay(Connection &dest) {
+    InboxItem *item = new InboxItem;
+    item->kind = InboxItemKind::REPLAY;
+    item->dest = dest.shared_from_this();
+    post(item);
+}
+
+void Reactor::requestLogOut(Connection &dest) {
+    InboxItem *item = new InboxItem;
+    item->kind = InboxItemKind::LOG_OUT;
+    item->dest = dest.shared_from_this();
+    post(item);
+}
+
+ShardMetrics &Reactor::metrics() { return metrics_; }
@@ -0,0 +1,384 @@
+/**
+ * @file reactor.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the event loops driving client sockets
+ * @date 2024
+ *
+ */
+
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include "../../common/send_message/send_message.hpp"
+#include "../connection/connection.hpp"
+#include "../frame_queue/frame_queue.hpp"
+#include "../metrics/metrics.hpp"
+#include "../slab_pool/slab_pool.hpp"
+#include "inbox.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+constexpr int MAX_FRAME_PARTS = 4; //< Max number of iovecs of a single frame
+
+/**
+ * @brief The I/O backends a reactor can be built on.
+ */
+enum class IoBackend { EPOLL, IO_URING };
+
+/**
+ * @brief What to do when a frame does not fit in a client's output queue.
+ */
+enum class OverflowPolicy {
+    DROP_OLDEST, //< Drop the oldest frames not written yet
+    DISCONNECT,  //< Disconnect the slow client
+    BLOCK        //< Stop reading the senders until the queue drains
+                 //< (disconnected past twice the limit)
+};
+
+/**
+ * @class Reactor
+ * @brief An event loop running on its own thread: one shard of the server.
+ *
+ * @details Every reactor accepts clients from its own listening socket (the
+ * kernel spreads new connections over them with SO_REUSEPORT) and is the only
+ * thread ever reading, writing and closing them. Frames for a client of
+ * another reactor are posted to that reactor's inbox.
+ *
+ * Frames that cannot be written right away wait in the client's output
+ * queue, bounded by the server's output limit and overflow policy. Frames and
+ * inbox items are taken from the pools of the thread building them, so a warm
+ * server relays messages without calling the heap.
+ */
+class Reactor {
+  private:
+    Inbox inbox_;
+    atomic<bool> wakePending_ = false; //< Coalesces the wake-ups of posts
+
+    /**
+     * @brief Queue a request for this reactor (from any thread).
+     *
+     * @param item The request, now owned by the inbox.
+     */
+    void post(InboxItem *item);
+
+    /**
+     * @brief Ask the reactors of the senders waiting on conn to read them
+     * again.
+     */
+    void resumeWaiters(Connection &conn);
+
+  protected:
+    unsigned index_; //< Shard number, also used to pick a core
+    ShardMetrics metrics_;
+    int listenFd_;   //< Non-blocking listening socket (owned by the server)
+    pthread_t thread_ = 0;
+    atomic<bool> running_ = false;
+    bool setUp_ = false; //< The kernel objects exist (started once)
+    SlabPool framePool_; //< Frames built by this reactor's thread
+    SlabPool itemPool_;  //< Inbox items posted by this reactor's thread
+
+    /**
+     * @brief Every connection accepted by this reactor and not closed yet,
+     * logged on or not (reactor thread only).
+     */
+    unordered_map<Connection *, shared_ptr<Connection>> connections_;
+
+    /**
+     * @brief Connections handed over by the previous server, not watched yet.
+     */
+    vector<Connection *> adopted_;
+
+    /**
+     * @brief A connection that has not logged on yet, and until when it may
+     * send its handshake.
+     */
+    struct Handshake {
+        chrono::steady_clock::time_point deadline;
+        uint64_t serial; //< Tells conn from a later one at the same address
+        Connection *conn;
+    };
+
+    /**
+     * @brief The connections waiting for their handshake (reactor thread
+     * only). They all get the same time, so the earliest deadline is first;
+     * the entries of those that logged on or closed since are dropped lazily.
+     */
+    deque<Handshake> handshakes_;
+
+    /**
+     * @brief Thread function running the event loop.
+     *
+     * @param arg A pointer to the Reactor object.
+     * @return void* Return a pointer to void.
+     */
+    static void *threadFunc(void *arg);
+
+    /**
+     * @brief Create the kernel objects of the reactor.
+     *
+     * @return bool If the operation succeded
+     */
+    virtual bool setup() = 0;
+
+    /**
+     * @brief Wait for events and dispatch them until stop() is called.
+     */
+    virtual void loop() = 0;
+
+    /**
+     * @brief Interrupt the loop so that it drains its inbox and notices when
+     * it must stop.
+     */
+    virtual void wake() = 0;
+
+    /**
+     * @brief Write (or queue) a frame for a connection driven by this reactor,
+     * from this reactor's thread.
+     *
+     * @param dest The connection.
+     * @param frame The frame, now owned by the reactor.
+     *
+     * @return SendMessageReturnVal BROKEN_PIPE if the connection is closed.
+     */
+    virtual SendMessageReturnVal queueFrame(Connection &dest,
+                                            FrameBuffer *frame) = 0;
+
+    /**
+     * @brief Gather a frame into a buffer of this reactor's pool and queue it,
+     * from this reactor's thread.
+     *
+     * @return SendMessageReturnVal BROKEN_PIPE if the connection is closed.
+     */
+    SendMessageReturnVal writeFrame(Connection &dest, const struct iovec *iov,
+                                    int iovcnt);
+
+    /**
+     * @brief Compress the message of a frame about to be queued for a client
+     * that negotiated it, when it pays off.
+     *
+     * @note Called in queueing order from dest's reactor, which owns the
+     * compression window of the client.
+     *
+     * @return FrameBuffer* The frame to queue: the compressed one (the
+     * original is released) or the original.
+     */
+    FrameBuffer *compress(Connection &dest, FrameBuffer *frame);
+
+    /**
+     * @brief Stop reading a connection until resumeReading is called.
+     *
+     * @note conn.paused is already set; frames already received may still be
+     * handed out by the backend, which must then keep them for later.
+     */
+    virtual void pauseReading(Connection &conn);
+
+    /**
+     * @brief Handle the frames received while the connection was paused and
+     * read it again.
+     *
+     * @note conn.paused is already cleared. The connection may be released.
+     */
+    virtual void resumeReading(Connection &conn) = 0;
+
+    /**
+     * @brief Handle the requests posted by the other reactors.
+     *
+     * @note Must be called by the loop every time it is woken up.
+     */
+    void drainInbox();
+
+    /**
+     * @brief Append a frame to the connection's output queue, applying the
+     * overflow policy if the queue is full.
+     *
+     * @param conn The connection.
+     * @param frame The frame, now owned by the queue (released on failure).
+     *
+     * @return bool False if the connection must be disconnected.
+     */
+    bool enqueue(Connection &conn, FrameBuffer *frame);
+
+    /**
+     * @brief Remove the bytes that were written from the output queue.
+     *
+     * @param conn The connection.
+     * @param written The number of bytes written from the front of the queue.
+     */
+    void dequeue(Connection &conn, size_t written);
+
+    /**
+     * @brief Answer the handshake frame that was just read and register the
+     * client if its nickname is free.
+     *
+     * @details The response is the protocol version the server will speak to
+     * the client (the highest both know), or 0 if the nickname is taken.
+     *
+     * @param conn The connection.
+     * @param frame The handshake frame (its nickname field holds the client's
+     * nickname, its message the client's highest version, empty for v1).
+     *
+     * @return bool True if the client is now logged on; otherwise, the
+     * connection must be closed once the response is written.
+     */
+    bool logOn(Connection &conn, const FrameView &frame);
+
+    /**
+     * @brief Queue the messages stored for the connection while it was
+     * offline, as many as its output queue can take.
+     *
+     * @note The rest is replayed once the queue drains.
+     */
+    void replay(Connection &conn);
+
+    /**
+     * @brief Give a connection just accepted the server's handshake timeout
+     * to log on.
+     */
+    void awaitHandshake(Connection &conn);
+
+    /**
+     * @brief Get the time left before the earliest handshake deadline.
+     *
+     * @return int Milliseconds (rounded up), or -1 if no connection is
+     * waiting for its handshake.
+     */
+    int handshakeWait();
+
+    /**
+     * @brief Hand the connections whose handshake deadline passed to expire,
+     * which must close them.
+     */
+    void expireHandshakes(const function<void(Connection &)> &expire);
+
+    /**
+     * @brief Close the connection, resume its waiters and forget it.
+     *
+     * @note The connection must not be used afterwards.
+     */
+    void release(Connection &conn);
+
+  public:
+    /**
+     * @brief Construct a new Reactor object.
+     *
+     * @param index The shard number.
+     * @param listenFd The listening socket to accept clients from.
+     */
+    Reactor(unsigned index, int listenFd);
+
+    /**
+     * @brief Destroy the Reactor object, closing the connections that never
+     * logged on (the others belong to the server).
+     *
+     * @note Derived classes must stop the thread in their own destructor.
+     */
+    virtual ~Reactor();
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    /**
+     * @brief Set the reactor up (the first time) and start its thread, pinned
+     * to a core.
+     *
+     * @note A stopped reactor may be started again: it goes on with the same
+     * connections and requests.
+     *
+     * @return bool If the operation succeded
+     */
+    bool start();
+
+    /**
+     * @brief Stop the reactor thread and wait for it to end.
+     */
+    void stop();
+
+    /**
+     * @brief Release the requests still posted and the frames still queued.
+     *
+     * @note Must be called once every reactor is stopped and before any is
+     * destroyed: they may hold blocks of each other's pools.
+     */
+    void discard();
+
+    /**
+     * @brief Drive a connection handed over by the previous server: it is
+     * watched, read and flushed as soon as the loop starts.
+     *
+     * @note Must be called before start(), with the epoll backend.
+     */
+    void adopt(const shared_ptr<Connection> &conn);
+
+    /**
+     * @brief Get the connections of the stopped reactor, logged on or not.
+     */
+    vector<shared_ptr<Connection>> clients() const;
+
+    /**
+     * @brief Visit the requests still posted to the stopped reactor, oldest
+     * first; they stay posted.
+     */
+    void forEachPosted(const function<void(const InboxItem &)> &visit);
+
+    /**
+     * @brief Send a frame to a connection driven by this reactor (from any
+     * thread).
+     *
+     * @param dest The client.
+     * @param iov The parts of the frame.
+     * @param iovcnt The number of parts (at most MAX_FRAME_PARTS).
+     * @param receivedAt When the message was decoded, to measure the time it
+     * spends inside the server (not measured if left empty).
+     *
+     * @return SendMessageReturnVal An enum that holds values for success and
+     * the possible errors. From another thread, the frame is only queued and
+     * SUCCESS is returned.
+     */
+    SendMessageReturnVal
+    sendFrame(Connection &dest, const struct iovec *iov, int iovcnt,
+              chrono::steady_clock::time_point receivedAt = {});
+
+    /**
+     * @brief Stop reading a sender until the given congested destination
+     * drains its output queue.
+     *
+     * @note Must be called from this reactor's thread, which drives conn.
+     *
+     * @param conn The sender.
+     * @param dest The congested destination (driven by any reactor).
+     */
+    void pause(Connection &conn, Connection &dest);
+
+    /**
+     * @brief Ask this reactor to replay the offline messages of a connection
+     * it drives (from any thread).
+     *
+     * @param dest The logged-on client.
+     */
+    void requestReplay(Connection &dest);
+
+    /**
+     * @brief Ask this reactor to close a connection it drives, as if the
+     * client left (from any thread).
+     *
+     * @param dest The client.
+     */
+    void requestLogOut(Connection &dest);
+
+    /**
+     * @brief Get the counters of this shard (written by its thread only).
+     */
+    ShardMetrics &metrics();
+};
+
+#endif // REACTOR_HPP
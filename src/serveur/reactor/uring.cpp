@@ -0,0 +1,172 @@
+/**
+ * @file uring.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for a minimal io_uring wrapper (raw syscalls)
+ * @date 2024
+ *
+ */
+
+#include "uring.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                 unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                   nullptr, 0);
+}
+
+int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+} // namespace
+
+// ### Destructor ###
+Uring::~Uring() {
+    if (ringFd_ != -1) close(ringFd_); //< Cancels the pending requests
+    if (bufRing_ != nullptr) munmap(bufRing_, bufRingSize_);
+    delete[] bufs_;
+    if (sqes_ != nullptr) munmap(sqes_, sqesSize_);
+    if (cqPtr_ != nullptr and cqPtr_ != sqPtr_) munmap(cqPtr_, cqPtrSize_);
+    if (sqPtr_ != nullptr) munmap(sqPtr_, sqPtrSize_);
+}
+
+// ### Public methods ###
+
+bool Uring::init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4; //< Multishot requests complete a lot
+
+    ringFd_ = ioUringSetup(entries, &params);
+    if (ringFd_ < 0) {
+        ringFd_ = -1;
+        return false;
+    }
+    if (not(params.features & IORING_FEAT_SINGLE_MMAP)
+        or not(params.features & IORING_FEAT_NODROP)) {
+        return false;
+    }
+
+    sqPtrSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqPtrSize_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (cqPtrSize_ > sqPtrSize_) sqPtrSize_ = cqPtrSize_;
+    cqPtrSize_ = sqPtrSize_;
+
+    sqPtr_ = mmap(nullptr, sqPtrSize_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if (sqPtr_ == MAP_FAILED) {
+        sqPtr_ = nullptr;
+        return false;
+    }
+    cqPtr_ = sqPtr_; //< IORING_FEAT_SINGLE_MMAP
+
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(
+        mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        return false;
+    }
+
+    char *sq = static_cast<char *>(sqPtr_);
+    sqHead_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries_ =
+        reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqLocalTail_ = *sqTail_;
+
+    char *cq = static_cast<char *>(cqPtr_);
+    cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+bool Uring::initBuffers(unsigned count, unsigned size, uint16_t group) {
+    bufRingSize_ = count * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return false;
+    bufRing_ = static_cast<io_uring_buf_ring *>(ring);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (ioUringRegister(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return false;
+    }
+
+    bufCount_ = count;
+    bufSize_ = size;
+    bufs_ = new char[static_cast<size_t>(count) * size];
+    for (unsigned bid = 0; bid < count; ++bid) {
+        recycleBuffer(bid);
+    }
+    return true;
+}
+
+io_uring_sqe *Uring::getSqe() {
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (sqLocalTail_ - head >= *sqEntries_) {
+        if (submitAndWait(0) < 0) return nullptr;
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (sqLocalTail_ - head >= *sqEntries_) return nullptr;
+    }
+
+    unsigned index = sqLocalTail_ & *sqMask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    ++sqLocalTail_;
+    ++toSubmit_;
+    return sqe;
+}
+
+int Uring::submitAndWait(unsigned waitNr) {
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+
+    unsigned flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = ioUringEnter(ringFd_, toSubmit_, waitNr, flags);
+    if (ret < 0) return -errno;
+
+    toSubmit_ -= ret;
+    return ret;
+}
+
+char *Uring::buffer(uint16_t bid) const {
+    return bufs_ + static_cast<size_t>(bid) * bufSize_;
+}
+
+void Uring::recycleBuffer(uint16_t bid) {
+    // Not bufRing_->bufs: in C++, the header's flexible array is misplaced
+    io_uring_buf *buf = reinterpret_cast<io_uring_buf *>(bufRing_)
+                        + (bufTail_ & (bufCount_ - 1));
+    buf->addr = reinterpret_cast<uint64_t>(buffer(bid));
+    buf->len = bufSize_;
+    buf->bid = bid;
+    ++bufTail_;
+    __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
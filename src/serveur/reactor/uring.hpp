@@ -0,0 +1,132 @@
+/**
+ * @file uring.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for a minimal io_uring wrapper (raw syscalls)
+ * @date 2024
+ *
+ */
+
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+using namespace std;
+
+/**
+ * @class Uring
+ * @brief Own an io_uring instance: its submission and completion rings and an
+ * optional ring of provided buffers.
+ *
+ * @note Not thread-safe: a ring is meant to be driven by a single thread.
+ */
+class Uring {
+  private:
+    int ringFd_ = -1;
+
+    // Submission ring
+    void *sqPtr_ = nullptr;
+    size_t sqPtrSize_ = 0;
+    unsigned *sqHead_, *sqTail_, *sqMask_, *sqEntries_, *sqArray_;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqesSize_ = 0;
+    unsigned sqLocalTail_ = 0;
+    unsigned toSubmit_ = 0;
+
+    // Completion ring
+    void *cqPtr_ = nullptr;
+    size_t cqPtrSize_ = 0;
+    unsigned *cqHead_, *cqTail_, *cqMask_;
+    io_uring_cqe *cqes_ = nullptr;
+
+    // Provided buffers
+    io_uring_buf_ring *bufRing_ = nullptr;
+    size_t bufRingSize_ = 0;
+    char *bufs_ = nullptr;
+    unsigned bufCount_ = 0, bufSize_ = 0;
+    uint16_t bufTail_ = 0;
+
+  public:
+    /**
+     * @brief Construct a new Uring object.
+     */
+    Uring() = default;
+
+    /**
+     * @brief Destroy the Uring object, cancelling every pending request.
+     */
+    ~Uring();
+
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    /**
+     * @brief Create the ring.
+     *
+     * @param entries The number of submission queue entries.
+     * @return bool False if io_uring is not available.
+     */
+    bool init(unsigned entries);
+
+    /**
+     * @brief Register a group of provided buffers used by recv requests.
+     *
+     * @param count The number of buffers (a power of 2).
+     * @param size The size of each buffer.
+     * @param group The buffer group ID.
+     * @return bool False if the kernel does not support buffer rings.
+     */
+    bool initBuffers(unsigned count, unsigned size, uint16_t group);
+
+    /**
+     * @brief Get a zeroed submission queue entry.
+     *
+     * @note Submits the pending entries when the submission ring is full.
+     *
+     * @return io_uring_sqe* The entry, or nullptr if the ring is unusable.
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * @brief Submit every pending entry and wait for completions.
+     *
+     * @param waitNr The minimum number of completions to wait for.
+     * @return int The number of submitted entries, or -errno.
+     */
+    int submitAndWait(unsigned waitNr);
+
+    /**
+     * @brief Call f on every available completion, then release them.
+     *
+     * @param f A callable taking a const io_uring_cqe &.
+     * @return unsigned The number of processed completions.
+     */
+    template <typename F> unsigned forEachCqe(F f) {
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; ++head, ++count) {
+            f(cqes_[head & *cqMask_]);
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    /**
+     * @brief Get the data of a provided buffer.
+     *
+     * @param bid The buffer ID given by a completion.
+     */
+    char *buffer(uint16_t bid) const;
+
+    /**
+     * @brief Give a consumed buffer back to the kernel.
+     *
+     * @param bid The buffer ID.
+     */
+    void recycleBuffer(uint16_t bid);
+};
+
+#endif // URING_HPP
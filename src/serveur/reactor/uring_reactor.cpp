@@ -0,0 +1,444 @@
+/**
+ * @file uring_reactor.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the io_uring event loop driving client sockets
+ * @date 2024
+ *
+ */
+
+#include "uring_reactor.hpp"
+#include "../server.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+uint64_t tag(Connection *conn, UringOp op) {
+    return reinterpret_cast<uint64_t>(conn) | op;
+}
+
+} // namespace
+
+// ### Constructor ###
+UringReactor::UringReactor(unsigned index, int listenFd)
+    : Reactor(index, listenFd) {}
+
+// ### Destructor ###
+UringReactor::~UringReactor() {
+    stop();
+    if (wakeFd_ != -1 and close(wakeFd_) != 0) perror("close");
+}
+
+// ### Private methods ###
+
+bool UringReactor::setup() {
+    if (not ring_.init(URING_ENTRIES)) {
+        cerr << "Err: io_uring n'est pas disponible - " << strerror(errno)
+             << endl;
+        return false;
+    }
+    if (not ring_.initBuffers(URING_BUFFERS, URING_BUFFER_SIZE,
+                              URING_BUFFER_GROUP)) {
+        cerr << "Err: io_uring ne supporte pas les tampons fournis - "
+             << strerror(errno) << endl;
+        return false;
+    }
+    wakeFd_ = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        cerr << "Err: Le réacteur n'a pas pu être créé - " << strerror(errno)
+             << endl;
+        return false;
+    }
+    return true;
+}
+
+void UringReactor::loop() {
+    armWake();
+    armAccept();
+
+    while (running_) {
+        for (Connection *conn : dirty_) {
+            if (not conn->writeInFlight and not conn->outQueue.empty()
+                and not conn->closed) {
+                submitWrite(*conn);
+            }
+        }
+        dirty_.clear();
+        reapClosed(); //< Only now: dirty_ may point to closed connections
+
+        int wait = handshakeWait();
+        if (wait >= 0 and not timerArmed_) armTimer(wait);
+
+        // One syscall submits the whole batch and waits for the next one
+        int ret = ring_.submitAndWait(1);
+        if (ret < 0 and ret != -EINTR and ret != -EBUSY) {
+            cerr << "Err: io_uring_enter - " << strerror(-ret) << endl;
+            break;
+        }
+
+        // Writes first: the queues they drain make room for the new frames
+        ring_.forEachCqe([this](const io_uring_cqe &cqe) {
+            if ((cqe.user_data & URING_OP_MASK) == URING_OP_WRITE) {
+                handleCompletion(cqe);
+            } else {
+                batch_.push_back(cqe);
+            }
+        });
+        for (const io_uring_cqe &cqe : batch_) {
+            handleCompletion(cqe);
+        }
+        batch_.clear();
+    }
+}
+
+void UringReactor::wake() {
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+        perror("write");
+    }
+}
+
+// ### Requests ###
+
+void UringReactor::armAccept() {
+    io_uring_sqe *sqe = ring_.getSqe();
+    if (sqe == nullptr) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = tag(nullptr, URING_OP_ACCEPT);
+    acceptArmed_ = true;
+}
+
+void UringReactor::armWake() {
+    io_uring_sqe *sqe = ring_.getSqe();
+    if (sqe == nullptr) return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeFd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeValue_);
+    sqe->len = sizeof(wakeValue_);
+    sqe->user_data = tag(nullptr, URING_OP_WAKE);
+}
+
+void UringReactor::armRecv(Connection &conn) {
+    io_uring_sqe *sqe = ring_.getSqe();
+    if (sqe == nullptr) {
+        abort(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = tag(&conn, URING_OP_RECV);
+    conn.recvArmed = true;
+}
+
+void UringReactor::armTimer(int ms) {
+    io_uring_sqe *sqe = ring_.getSqe();
+    if (sqe == nullptr) return;
+    timeout_.tv_sec = ms / 1000;
+    timeout_.tv_nsec = static_cast<long long>(ms % 1000) * 1000000;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = reinterpret_cast<uint64_t>(&timeout_);
+    sqe->len = 1;
+    sqe->user_data = tag(nullptr, URING_OP_TIMEOUT);
+    timerArmed_ = true;
+}
+
+void UringReactor::submitWrite(Connection &conn) {
+    conn.outIov.clear();
+    size_t offset = conn.outOffset;
+    for (FrameBuffer *frame = conn.outQueue.front(); frame != nullptr;
+         frame = frame->next) {
+        if (conn.outIov.size() == IOV_MAX) break;
+        conn.outIov.push_back({frame->data() + offset, frame->size - offset});
+        offset = 0;
+    }
+
+    conn.outMsg = {};
+    conn.outMsg.msg_iov = conn.outIov.data();
+    conn.outMsg.msg_iovlen = conn.outIov.size();
+
+    io_uring_sqe *sqe = ring_.getSqe();
+    if (sqe == nullptr) {
+        abort(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.outMsg);
+    sqe->len = 1;
+    // Corked while the queue holds more than one sendmsg can carry
+    if (conn.outIov.size() < conn.outQueue.size()) sqe->msg_flags = MSG_MORE;
+    sqe->user_data = tag(&conn, URING_OP_WRITE);
+    conn.writeInFlight = true;
+    conn.outInFlight = conn.outIov.size();
+}
+
+void UringReactor::writeNow(Connection &conn) {
+    while (not conn.outQueue.empty() and not conn.closed) {
+        conn.outIov.clear();
+        size_t offset = conn.outOffset;
+        size_t size = 0;
+        for (FrameBuffer *frame = conn.outQueue.front(); frame != nullptr;
+             frame = frame->next) {
+            if (conn.outIov.size() == IOV_MAX) break;
+            conn.outIov.push_back(
+                {frame->data() + offset, frame->size - offset});
+            size += frame->size - offset;
+            offset = 0;
+        }
+        bool more = conn.outIov.size() < conn.outQueue.size();
+
+        struct msghdr msg{};
+        msg.msg_iov = conn.outIov.data();
+        msg.msg_iovlen = conn.outIov.size();
+        ssize_t bytesWritten =
+            sendmsg(conn.fd, &msg, MSG_DONTWAIT | (more ? MSG_MORE : 0));
+        if (bytesWritten >= 0) {
+            bump(metrics_.bytesOut, bytesWritten);
+            dequeue(conn, bytesWritten);
+            if (static_cast<size_t>(bytesWritten) < size) break;
+        } else if (errno == EAGAIN or errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            if (errno != EPIPE and errno != ECONNRESET) {
+                cerr << "Err: " << strerror(errno) << endl;
+            }
+            abort(conn);
+            return;
+        }
+    }
+
+    // The socket is full: the rest waits for room in the kernel
+    if (not conn.outQueue.empty() and not conn.closed) submitWrite(conn);
+}
+
+// ### Completions ###
+
+void UringReactor::handleCompletion(const io_uring_cqe &cqe) {
+    Connection *conn =
+        reinterpret_cast<Connection *>(cqe.user_data & ~URING_OP_MASK);
+
+    switch (cqe.user_data & URING_OP_MASK) {
+    case URING_OP_ACCEPT:
+        if (cqe.res >= 0) {
+            onAccept(cqe.res);
+        } else if (cqe.res != -EINTR) {
+            cerr << "Err: Échec de l'acceptation du nouveau client." << endl;
+            bump(metrics_.acceptFailures);
+        }
+        acceptArmed_ = cqe.flags & IORING_CQE_F_MORE;
+        if (not acceptArmed_ and running_) armAccept();
+        break;
+    case URING_OP_WAKE:
+        drainInbox();
+        if (running_) armWake();
+        break;
+    case URING_OP_RECV:
+        onRecv(*conn, cqe);
+        break;
+    case URING_OP_WRITE:
+        onWrite(*conn, cqe.res);
+        break;
+    case URING_OP_CANCEL: //< conn may already be released
+        break;
+    case URING_OP_TIMEOUT: //< Maybe before the earliest deadline left
+        timerArmed_ = false;
+        expireHandshakes([this](Connection &conn) { beginClose(conn, false); });
+        break;
+    }
+}
+
+void UringReactor::onAccept(int clientSockFd) {
+    Server &server = Server::getInstance();
+
+    if (server.reachedMaxClients()) {
+        cerr << "Err: Trop de clients connectés." << endl;
+        bump(metrics_.acceptFailures);
+        if (close(clientSockFd) != 0) {
+            perror("close");
+        }
+        return;
+    }
+
+    auto conn = make_shared<Connection>(clientSockFd, "");
+    conn->reactor = this;
+    connections_[conn.get()] = conn;
+    bump(metrics_.connectionsOpened);
+    armRecv(*conn);
+    awaitHandshake(*conn);
+}
+
+void UringReactor::onRecv(Connection &conn, const io_uring_cqe &cqe) {
+    conn.recvArmed = cqe.flags & IORING_CQE_F_MORE;
+
+    if (cqe.res > 0) {
+        bump(metrics_.bytesIn, cqe.res);
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (conn.paused) {
+            conn.pending.append(ring_.buffer(bid), cqe.res);
+        } else {
+            consume(conn, ring_.buffer(bid), cqe.res);
+        }
+        ring_.recycleBuffer(bid);
+    } else if (cqe.res != -ENOBUFS and cqe.res != -ECANCELED) {
+        // EOF or error (a closing connection ends up here too)
+        if (cqe.res < 0 and cqe.res != -ECONNRESET) {
+            cerr << "Err: recv - " << strerror(-cqe.res) << endl;
+        }
+        if (not conn.closing) abort(conn);
+        return;
+    }
+
+    // The multishot recv ends when the provided buffers run out (or when
+    // it is cancelled by pauseReading)
+    if (not conn.recvArmed and not conn.closing and not conn.closed
+        and not conn.paused) {
+        armRecv(conn);
+    }
+}
+
+void UringReactor::onWrite(Connection &conn, int res) {
+    conn.writeInFlight = false;
+    conn.outInFlight = 0;
+    if (conn.closed) return;
+
+    if (res < 0) {
+        if (res != -EPIPE and res != -ECONNRESET) {
+            cerr << "Err: " << strerror(-res) << endl;
+        }
+        abort(conn);
+        return;
+    }
+
+    bump(metrics_.bytesOut, res);
+    dequeue(conn, res);
+
+    if (not conn.outQueue.empty()) {
+        dirty_.push_back(&conn);
+    } else if (conn.closing) {
+        abort(conn);
+    }
+}
+
+void UringReactor::consume(Connection &conn, const char *data, size_t size) {
+    Server &server = Server::getInstance();
+    FrameView frame;
+
+    while (not conn.closing and not conn.closed) {
+        DecodeReturnVal ret = conn.decoder.next(frame);
+
+        if (ret == DecodeReturnVal::FRAME_READY) {
+            if (not conn.loggedOn) {
+                if (not logOn(conn, frame)) beginClose(conn, true);
+            } else if (not server.handleMessage(conn, frame)) {
+                abort(conn);
+            } else if (conn.paused) {
+                conn.pending.append(data, size); //< Handled once resumed
+                return;
+            }
+        } else if (ret == DecodeReturnVal::NEED_MORE) {
+            if (size == 0) break;
+            size_t fed = conn.decoder.feed(data, size);
+            data += fed;
+            size -= fed;
+        } else if (not conn.loggedOn) {
+            cerr << "Err: Échec du serrage de main." << endl;
+            abort(conn);
+        } else {
+            if (ret == DecodeReturnVal::MESSAGE_TOO_LONG) {
+                server.sendTooLongMessage(conn);
+            }
+            beginClose(conn, true);
+        }
+    }
+}
+
+void UringReactor::pauseReading(Connection &conn) {
+    if (not conn.recvArmed) return;
+
+    io_uring_sqe *sqe = ring_.getSqe();
+    if (sqe == nullptr) return; //< Received bytes are kept anyway
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = tag(&conn, URING_OP_RECV);
+    sqe->user_data = tag(&conn, URING_OP_CANCEL);
+}
+
+void UringReactor::resumeReading(Connection &conn) {
+    string pending = move(conn.pending);
+    conn.pending.clear();
+    consume(conn, pending.data(), pending.size());
+
+    if (not conn.paused and not conn.recvArmed and not conn.closing
+        and not conn.closed) {
+        armRecv(conn);
+    }
+}
+
+// ### Helpers ###
+
+void UringReactor::beginClose(Connection &conn, bool flush) {
+    if (not flush or (conn.outQueue.empty() and not conn.writeInFlight)) {
+        abort(conn);
+        return;
+    }
+    conn.closing = true;
+    shutdown(conn.fd, SHUT_RD); //< Ends the multishot recv
+}
+
+void UringReactor::abort(Connection &conn) {
+    if (conn.closed) return;
+
+    conn.closed = true;
+
+    conn.closing = true;
+    shutdown(conn.fd, SHUT_RDWR); //< Ends the pending requests
+    closed_.push_back(&conn);
+}
+
+void UringReactor::reapClosed() {
+    auto it = closed_.begin();
+    while (it != closed_.end()) {
+        Connection &conn = **it;
+        if (conn.recvArmed or conn.writeInFlight) {
+            ++it;
+            continue;
+        }
+
+        it = closed_.erase(it);
+        release(conn);
+    }
+}
+
+SendMessageReturnVal UringReactor::queueFrame(Connection &dest,
+                                              FrameBuffer *frame) {
+    if (dest.closed or dest.closing) {
+        FrameBuffer::release(frame);
+        return SendMessageReturnVal::BROKEN_PIPE;
+    }
+
+    if (not enqueue(dest, frame)) {
+        abort(dest);
+        return SendMessageReturnVal::COULD_NOT_WRITE_ALL_BYTES;
+    }
+    if (dest.writeInFlight) return SendMessageReturnVal::SUCCESS;
+    dirty_.push_back(&dest);
+
+    // A long batch must not fill the queue up to the overflow policy
+    if (dest.outBytes >= Server::getInstance().outputLimit_ / 2) {
+        writeNow(dest);
+    }
+    return SendMessageReturnVal::SUCCESS;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file uring_reactor.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the io_uring event loop driving client sockets
+ * @date 2024
+ *
+ */
+
+#ifndef URING_REACTOR_HPP
+#define URING_REACTOR_HPP
+
+#include "reactor.hpp"
+#include "uring.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+constexpr unsigned URING_ENTRIES = 1024;
+constexpr unsigned URING_BUFFERS = 1024; //< Must be a power of 2
+constexpr unsigned URING_BUFFER_SIZE = 4096;
+constexpr uint16_t URING_BUFFER_GROUP = 0;
+
+/**
+ * @brief The kind of request a completion belongs to, stored in the low bits
+ * of its user_data (the high bits hold the Connection, if any).
+ */
+enum UringOp : uint64_t {
+    URING_OP_ACCEPT = 0,
+    URING_OP_WAKE = 1,
+    URING_OP_RECV = 2,
+    URING_OP_WRITE = 3,
+    URING_OP_CANCEL = 4,
+    URING_OP_TIMEOUT = 5,
+    URING_OP_MASK = 7
+};
+
+/**
+ * @class UringReactor
+ * @brief io_uring loop accepting, handshaking and serving clients.
+ *
+ * @details Clients are accepted with a multishot accept and read with a
+ * multishot recv into provided buffers; a timeout request closes those that
+ * do not log on in time. The frames sent to a client are queued
+ * and gathered into a single sendmsg per client. Every request prepared while
+ * handling a batch of completions is submitted with one io_uring_enter.
+ */
+class UringReactor : public Reactor {
+  private:
+    int wakeFd_ = -1; //< eventfd used to interrupt the loop
+    uint64_t wakeValue_;
+    bool acceptArmed_ = false;
+    bool timerArmed_ = false;
+    __kernel_timespec timeout_{}; //< Of the timer (read on submission)
+
+    vector<Connection *> dirty_;  //< Connections with bytes to write
+    vector<Connection *> closed_; //< Connections waiting to be released
+    vector<io_uring_cqe> batch_;  //< Completions handled after the writes
+
+    Uring ring_; //< Destroyed first: cancels the requests in flight
+
+    bool setup() override;
+    void loop() override;
+    void wake() override;
+
+    /**
+     * @copydoc Reactor::queueFrame
+     *
+     * @note The frame is only queued: the queue is written by a single
+     * sendmsg once the batch of completions is handled, or right away (see
+     * writeNow) once it reaches half the output limit.
+     */
+    SendMessageReturnVal queueFrame(Connection &dest,
+                                    FrameBuffer *frame) override;
+
+    /**
+     * @copydoc Reactor::pauseReading
+     *
+     * @note The multishot recv is cancelled; what it still receives is kept in
+     * conn.pending.
+     */
+    void pauseReading(Connection &conn) override;
+
+    void resumeReading(Connection &conn) override;
+
+    // ### Requests ###
+
+    void armAccept();
+    void armWake();
+    void armRecv(Connection &conn);
+
+    /**
+     * @brief Complete after ms milliseconds, to close the clients whose
+     * handshake deadline passed.
+     */
+    void armTimer(int ms);
+    void submitWrite(Connection &conn);
+
+    /**
+     * @brief Write as much of the output queue as the socket accepts right
+     * away, with a non-blocking sendmsg, and submit the rest.
+     *
+     * @details The completion of a submitted write is only handled with the
+     * next batch: until then its bytes still count against the output limit.
+     *
+     * @note No write may be in flight for the connection.
+     */
+    void writeNow(Connection &conn);
+
+    // ### Completions ###
+
+    /**
+     * @brief Dispatch a completion to the right handler.
+     */
+    void handleCompletion(const io_uring_cqe &cqe);
+
+    void onAccept(int clientSockFd);
+    void onRecv(Connection &conn, const io_uring_cqe &cqe);
+    void onWrite(Connection &conn, int res);
+
+    /**
+     * @brief Decode and handle the frames left in the decoder, then every
+     * frame in the received bytes.
+     */
+    void consume(Connection &conn, const char *data, size_t size);
+
+    // ### Helpers ###
+
+    /**
+     * @brief Stop reading the connection and close it.
+     *
+     * @param conn The connection.
+     * @param flush Whether the bytes already queued must be written first.
+     */
+    void beginClose(Connection &conn, bool flush);
+
+    /**
+     * @brief Shut the socket down so that every pending request completes.
+     */
+    void abort(Connection &conn);
+
+    /**
+     * @brief Release the closed connections with no request in flight (the
+     * connections are kept alive until then).
+     */
+    void reapClosed();
+
+  public:
+    /**
+     * @brief Construct a new UringReactor object.
+     *
+     * @param index The shard number.
+     * @param listenFd The listening socket to accept clients from.
+     */
+    UringReactor(unsigned index, int listenFd);
+
+    /**
+     * @brief Destroy the UringReactor object, stopping its thread if needed.
+     */
+    ~UringReactor() override;
+};
+
+#endif // URING_REACTOR_HPP
@@ -0,0 +1,119 @@
+/**
+ * @file epoch.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the epoch-based reclamation of shared objects
+ * @date 2024
+ *
+ */
+
+#include "epoch.hpp"
+
+#include <iostream>
+#include <sched.h>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t CACHED_EPOCHS = 4; //< Epoch objects a thread reads at once
+
+/**
+ * @brief The slots claimed by the current thread, one per Epoch object it
+ * reads, given back when it ends.
+ */
+struct ThreadSlots {
+    struct Entry {
+        const void *owner = nullptr;
+        atomic<bool> *used = nullptr;
+        void *slot = nullptr;
+    };
+
+    Entry entries[CACHED_EPOCHS];
+    size_t next = 0; //< Replaced once they are all taken
+
+    ~ThreadSlots() {
+        for (Entry &entry : entries) {
+            if (entry.used != nullptr) {
+                entry.used->store(false, memory_order_release);
+            }
+        }
+    }
+};
+
+thread_local ThreadSlots threadSlotCache;
+
+} // namespace
+
+// ### Destructor ###
+Epoch::~Epoch() {
+    for (Retired &retired : retired_) {
+        retired.deleter();
+    }
+    if (pthread_mutex_destroy(&retiredMtx_) != 0) {
+        cerr << "Err: échec de la destruction du mutex." << endl;
+    }
+}
+
+// ### Private methods ###
+
+Epoch::Slot &Epoch::threadSlot() {
+    ThreadSlots &cache = threadSlotCache;
+    for (ThreadSlots::Entry &entry : cache.entries) {
+        if (entry.owner == this) return *static_cast<Slot *>(entry.slot);
+    }
+
+    ThreadSlots::Entry &entry = cache.entries[cache.next];
+    cache.next = (cache.next + 1) % CACHED_EPOCHS;
+    if (entry.used != nullptr) entry.used->store(false, memory_order_release);
+
+    // Only happens once per thread, so waiting for a free slot is fine
+    while (true) {
+        for (Slot &slot : slots_) {
+            bool expected = false;
+            if (not slot.used.load(memory_order_relaxed)
+                and slot.used.compare_exchange_strong(expected, true)) {
+                entry.owner = this;
+                entry.used = &slot.used;
+                entry.slot = &slot;
+                return slot;
+            }
+        }
+        sched_yield();
+    }
+}
+
+void Epoch::reclaim() {
+    // The objects retired before the oldest epoch still read are unreachable
+    uint64_t oldest = UINT64_MAX;
+    for (const Slot &slot : slots_) {
+        uint64_t epoch = slot.epoch.load();
+        if (epoch != 0 and epoch < oldest) oldest = epoch;
+    }
+
+    size_t kept = 0;
+    for (Retired &retired : retired_) {
+        if (retired.epoch < oldest) {
+            retired.deleter();
+        } else {
+            retired_[kept++] = move(retired);
+        }
+    }
+    retired_.resize(kept);
+}
+
+// ### Public methods ###
+
+Epoch::Guard::Guard(Epoch &epoch) : slot_(epoch.threadSlot()) {
+    // Sequentially consistent: published before the shared pointer is loaded
+    slot_.epoch.store(epoch.global_.load());
+}
+
+Epoch::Guard::~Guard() { slot_.epoch.store(0, memory_order_release); }
+
+void Epoch::retire(function<void()> deleter) {
+    pthread_mutex_lock(&retiredMtx_);
+    // Readers from now on start in a later epoch and cannot see the object
+    retired_.push_back({global_.fetch_add(1), move(deleter)});
+    reclaim();
+    pthread_mutex_unlock(&retiredMtx_);
+}
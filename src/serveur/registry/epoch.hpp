@@ -0,0 +1,114 @@
+/**
+ * @file epoch.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the epoch-based reclamation of shared objects
+ * @date 2024
+ *
+ */
+
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <pthread.h>
+#include <vector>
+
+using namespace std;
+
+constexpr unsigned MAX_EPOCH_THREADS = 512; //< Max concurrent readers
+
+/**
+ * @class Epoch
+ * @brief Epoch-based reclamation: lets readers use objects without locks while
+ * writers replace them.
+ *
+ * @details A reader announces the global epoch it starts in (Epoch::Guard)
+ * before loading a shared pointer. A writer publishes a new object, then
+ * retires the old one, which is deleted once every reader that may still see
+ * it has left its epoch. Entering and leaving are a couple of atomic stores
+ * into a slot of the calling thread.
+ */
+class Epoch {
+  private:
+    /**
+     * @brief The epoch of a reading thread (0 when it is not reading), on its
+     * own cache line.
+     */
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch = 0;
+        atomic<bool> used = false;
+    };
+
+    /**
+     * @brief An object waiting for its readers to leave.
+     */
+    struct Retired {
+        uint64_t epoch; //< Global epoch when it was retired
+        function<void()> deleter;
+    };
+
+    atomic<uint64_t> global_ = 1;
+    Slot slots_[MAX_EPOCH_THREADS];
+
+    pthread_mutex_t retiredMtx_ = PTHREAD_MUTEX_INITIALIZER;
+    vector<Retired> retired_; //< Protected by retiredMtx_
+
+    /**
+     * @brief Get the slot of the calling thread, claiming one the first time.
+     */
+    Slot &threadSlot();
+
+    /**
+     * @brief Delete the retired objects no reader can see anymore.
+     *
+     * @note retiredMtx_ must be held.
+     */
+    void reclaim();
+
+  public:
+    /**
+     * @class Guard
+     * @brief Marks the calling thread as reading for its lifetime.
+     *
+     * @note Guards must not be nested.
+     */
+    class Guard {
+      private:
+        Slot &slot_;
+
+      public:
+        explicit Guard(Epoch &epoch);
+        ~Guard();
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+    };
+
+    /**
+     * @brief Construct a new Epoch object.
+     */
+    Epoch() = default;
+
+    /**
+     * @brief Destroy the Epoch object and every retired object.
+     *
+     * @note No thread may be reading anymore.
+     */
+    ~Epoch();
+
+    Epoch(const Epoch &) = delete;
+    Epoch &operator=(const Epoch &) = delete;
+
+    /**
+     * @brief Delete an object once no reader can see it anymore.
+     *
+     * @note The object must already be unreachable for new readers.
+     *
+     * @param deleter Callable deleting the object.
+     */
+    void retire(function<void()> deleter);
+};
+
+#endif // EPOCH_HPP
@@ -0,0 +1,131 @@
+/**
+ * @file registry.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the registry of the logged-on clients
+ * @date 2024
+ *
+ */
+
+#include "registry.hpp"
+
+#include <iostream>
+
+using namespace std;
+
+// ### Constructor ###
+Registry::Registry() {
+    for (auto &shard : shards_) shard = new Shard();
+}
+
+// ### Destructor ###
+Registry::~Registry() {
+    for (auto &shard : shards_) delete shard.load();
+    if (pthread_mutex_destroy(&writeMtx_) != 0) {
+        cerr << "Err: échec de la destruction du mutex." << endl;
+    }
+}
+
+// ### Private methods ###
+
+size_t Registry::shardOf(string_view nickname) {
+    return hash<string_view>()(nickname) % REGISTRY_SHARDS;
+}
+
+void Registry::publish(size_t shard, const Shard *next) {
+    const Shard *previous = shards_[shard].exchange(next);
+    epoch_.retire([previous]() { delete previous; });
+}
+
+bool Registry::takeId(NicknameId &id) {
+    if (id == NO_NICKNAME_ID) {
+        if (freeIds_.empty()) {
+            id = usedIds_.size();
+            usedIds_.push_back(true);
+        } else {
+            id = *freeIds_.begin();
+            freeIds_.erase(freeIds_.begin());
+            usedIds_[id] = true;
+        }
+        return true;
+    }
+
+    // Kept from a previous server: the ids skipped are free
+    while (usedIds_.size() <= id) {
+        freeIds_.insert(usedIds_.size());
+        usedIds_.push_back(false);
+    }
+    if (usedIds_[id]) return false;
+    freeIds_.erase(id);
+    usedIds_[id] = true;
+    return true;
+}
+
+// ### Public methods ###
+
+bool Registry::add(const shared_ptr<Connection> &conn) {
+    size_t shard = shardOf(conn->nickname);
+    pthread_mutex_lock(&writeMtx_);
+    const Shard *current = shards_[shard].load();
+
+    NicknameId id = conn->nicknameId;
+    if (current->count(conn->nickname) != 0 or not takeId(id)) {
+        pthread_mutex_unlock(&writeMtx_);
+        return false;
+    }
+    conn->nicknameId = id;
+
+    Shard *next = new Shard(*current);
+    next->emplace(conn->nickname, conn);
+    publish(shard, next);
+    ++size_;
+    pthread_mutex_unlock(&writeMtx_);
+
+    return true;
+}
+
+shared_ptr<Connection> Registry::remove(const Connection &conn) {
+    shared_ptr<Connection> ret;
+    size_t shard = shardOf(conn.nickname);
+
+    pthread_mutex_lock(&writeMtx_);
+    const Shard *current = shards_[shard].load();
+    auto it = current->find(conn.nickname);
+    if (it != current->end() and it->second.get() == &conn) {
+        ret = it->second;
+
+        Shard *next = new Shard(*current);
+        next->erase(conn.nickname);
+        publish(shard, next);
+        usedIds_[conn.nicknameId] = false;
+        freeIds_.insert(conn.nicknameId);
+        --size_;
+    }
+    pthread_mutex_unlock(&writeMtx_);
+
+    return ret;
+}
+
+shared_ptr<Connection> Registry::find(string_view nickname) const {
+    thread_local string key;
+    key.assign(nickname);
+
+    Epoch::Guard guard(epoch_);
+    const Shard *current = shards_[shardOf(nickname)].load();
+
+    auto it = current->find(key);
+    if (it == current->end()) return nullptr;
+    return it->second;
+}
+
+vector<shared_ptr<Connection>> Registry::connections() const {
+    vector<shared_ptr<Connection>> ret;
+    ret.reserve(size_);
+
+    Epoch::Guard guard(epoch_);
+    for (const auto &shard : shards_) {
+        for (const auto &entry : *shard.load()) ret.push_back(entry.second);
+    }
+    return ret;
+}
+
+size_t Registry::size() const { return size_; }
@@ -0,0 +1,143 @@
+/**
+ * @file registry.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the registry of the logged-on clients
+ * @date 2024
+ *
+ */
+
+#ifndef REGISTRY_HPP
+#define REGISTRY_HPP
+
+#include "../connection/connection.hpp"
+#include "epoch.hpp"
+
+#include <atomic>
+#include <memory>
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t REGISTRY_SHARDS = 256; //< Copied one at a time by writers
+
+/**
+ * @class Registry
+ * @brief Bidirectional index of the logged-on clients.
+ *
+ * @details The clients are split into REGISTRY_SHARDS tables by the hash of
+ * their nickname, so a lookup is a single hash, whatever the number of
+ * clients. Each logged-on client also gets a compact NicknameId, stored in its
+ * connection.
+ *
+ * The tables are immutable snapshots: lookups never lock nor wait, while
+ * logging a client on or off (rare) copies the table of its shard only,
+ * publishes the new version and retires the old one, reclaimed by epoch once
+ * no lookup can still be reading it.
+ *
+ * An id is free again once its client logs off: a connection always binds its
+ * id (FRAME_NICKNAME_BIND) before referring to it, and the frames of the
+ * previous owner are queued before those of the next one.
+ */
+class Registry {
+  private:
+    /**
+     * @brief One immutable version of a shard: nickname -> connection.
+     */
+    using Shard = unordered_map<string, shared_ptr<Connection>>;
+
+    mutable Epoch epoch_;
+    atomic<const Shard *> shards_[REGISTRY_SHARDS];
+
+    pthread_mutex_t writeMtx_ = PTHREAD_MUTEX_INITIALIZER; //< Writers only
+    vector<bool> usedIds_;    //< Protected by writeMtx_
+    set<NicknameId> freeIds_; //< Below usedIds_.size(), by writeMtx_ too
+
+    atomic<size_t> size_ = 0;
+
+    /**
+     * @brief Get the shard of a nickname.
+     */
+    static size_t shardOf(string_view nickname);
+
+    /**
+     * @brief Make next the current version of a shard and retire the
+     * previous one.
+     *
+     * @note writeMtx_ must be held.
+     */
+    void publish(size_t shard, const Shard *next);
+
+    /**
+     * @brief Take the smallest free id, or the given one.
+     *
+     * @note writeMtx_ must be held.
+     *
+     * @return bool False if the given id is already taken.
+     */
+    bool takeId(NicknameId &id);
+
+  public:
+    /**
+     * @brief Construct a new, empty Registry object.
+     */
+    Registry();
+
+    /**
+     * @brief Destroy the Registry object.
+     */
+    ~Registry();
+
+    Registry(const Registry &) = delete;
+    Registry &operator=(const Registry &) = delete;
+
+    /**
+     * @brief Register a connection under its nickname, unless the nickname is
+     * already taken.
+     *
+     * @param conn The connection; its nicknameId is set on success, or kept
+     * if already set (by a previous server).
+     *
+     * @return bool If the connection was registered
+     */
+    bool add(const shared_ptr<Connection> &conn);
+
+    /**
+     * @brief Unregister a connection, freeing its id.
+     *
+     * @param conn The connection.
+     *
+     * @return shared_ptr<Connection> The registry's reference to the
+     * connection, or nullptr if it was not registered.
+     */
+    shared_ptr<Connection> remove(const Connection &conn);
+
+    /**
+     * @brief Find the connection logged on with the given nickname.
+     *
+     * @param nickname The nickname.
+     *
+     * @return shared_ptr<Connection> The connection if it was found;
+     * otherwise, nullptr.
+     *
+     * @note The key is built in a per-thread string kept between calls, so
+     * that looking a nickname up does not allocate.
+     */
+    shared_ptr<Connection> find(string_view nickname) const;
+
+    /**
+     * @brief Get a copy of the logged-on connections.
+     */
+    vector<shared_ptr<Connection>> connections() const;
+
+    /**
+     * @brief Get the number of logged-on connections.
+     */
+    size_t size() const;
+};
+
+#endif // REGISTRY_HPP
@@ -8,231 +8,332 @@
 
 #include "server.hpp"
 #include "../common/header/header.hpp"
-#include "../common/receive_message/receive_message.hpp"
-#include "../common/safe_write/safe_write.hpp"
 #include "../common/signal/mask.hpp"
 
+#include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <netinet/in.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <string>
+#include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <unordered_map>
 
 using namespace std;
 
-volatile sig_atomic_t exitFlag = false;
+static volatile sig_atomic_t exitFlag = false;
+static volatile sig_atomic_t upgradeFlag = false;
+
+namespace {
+
+// The notices about a recipient, around its nickname
+constexpr string_view NOTICE_START = "Cette personne (";
+constexpr string_view UNREACHABLE_START = "Err: Le serveur de cette personne (";
+constexpr string_view DISCONNECTED_END = ") n'est pas connectée.";
+constexpr string_view STORED_END =
+    ") n'est pas connectée, le message lui sera remis à sa connexion.";
+constexpr string_view UNREACHABLE_END =
+    ") est injoignable, le message n'a pas été remis.";
+
+constexpr size_t NOTICE_SIZE = 128 + MAX_LENGTH_NICKNAME;
+static_assert(UNREACHABLE_START.size() + UNREACHABLE_END.size() <= 128
+              and NOTICE_START.size() + STORED_END.size() <= 128);
+
+/**
+ * @brief Write a notice about a recipient into a buffer on the stack, so that
+ * undeliverable messages do not allocate.
+ *
+ * @return string_view The notice, in buffer.
+ */
+string_view writeNotice(char (&buffer)[NOTICE_SIZE], string_view start,
+                        string_view nickname, string_view end) {
+    nickname = nickname.substr(0, MAX_LENGTH_NICKNAME); //< As decoded
+    size_t size = 0;
+    for (string_view piece : {start, nickname, end}) {
+        memcpy(buffer + size, piece.data(), piece.size());
+        size += piece.size();
+    }
+    return string_view(buffer, size);
+}
+
+} // namespace
 
 // ### Constructors ###
 Server::Server() = default;
 
 // ### Destructor ###
 Server::~Server() {
-    disconnectAllClients();
-    closeServerSocket();
-    waitAllThreads();
-    if (pthread_mutex_destroy(&mapMtx_) != 0
-        or pthread_mutex_destroy(&fdMtx_) != 0) {
-        cerr << "Err: échec de la destruction du mutex." << endl;
-    }
-    if (sem_destroy(&finishedThreads) != 0) {
-        cerr << "Err: échec de la destruction du sémaphore." << endl;
-    }
+    admin_.stop();   //< Reads the reactors
+    cluster_.stop(); //< Posts to them
+    stopReactors();
+    // Handed over: the clients are still connected, to the new server
+    if (not handedOver_) disconnectAllClients();
+    closeServerSockets();
 }
 
 // ### Private methods ###
 
-bool Server::startListening() {
-    if (listen(serverSockFd_, ACCEPT_BACKLOG) != 0) {
-        cerr << "Err: échec lors de l'écoute des connexions." << endl;
-        return false;
+int Server::openListener() {
+    int sockFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockFd < 0) {
+        cerr << "Err: Le socket n'a pas pu être créé - " << strerror(errno)
+             << endl;
+        return -1;
     }
-    return true;
-}
-
-int Server::acceptNewClient() {
-    socklen_t addresslen = 0;
 
-    int newClientSockFd = accept(serverSockFd_, nullptr, &addresslen);
-    if (newClientSockFd < 0) {
-        if (errno != EINTR and errno != EBADF) {
-            cerr << "Err: Échec de l'acceptation du nouveau client." << endl;
-        }
+    // Allow the reuse of the port, by this server's other sockets too
+    int opt = 1;
+    if (setsockopt(sockFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) != 0
+        or setsockopt(sockFd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))
+               != 0) {
+        cerr << "Err: La réutilisation du port/adresse n'a pas pu être activée."
+             << endl;
+        close(sockFd);
         return -1;
     }
 
-    pthread_mutex_lock(&mapMtx_);
-    bool reachedMaxClientsConnected =
-        (mapSocketToClient_.size() >= MAX_CLIENTS_CONNECTED);
-    pthread_mutex_unlock(&mapMtx_);
+    struct sockaddr_in address;
 
-    if (reachedMaxClientsConnected) {
-        cerr << "Err: Trop de clients connectés." << endl;
-        if (close(newClientSockFd) != 0) {
-            perror("close");
-        }
+    // Set the listening address and port, reserve the port
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(static_cast<uint16_t>(port_));
+
+    if (bind(sockFd, reinterpret_cast<sockaddr *>(&address), sizeof(address))
+        != 0) {
+        cerr << "Err: Échec de la liaison entre le socket et le port." << endl;
+        close(sockFd);
         return -1;
     }
 
-    // get the Nickname
-    string nickname;
-    string emptyMessage;
-    if (receiveMessage(newClientSockFd, nickname, emptyMessage, CURRENT_VERSION)
-        != ReceiveMessageReturnVal::SUCCESS) {
-        cerr << "Err: Échec du serrage de main." << endl;
-        if (close(newClientSockFd) != 0) {
-            perror("close");
+    return sockFd;
+}
+
+bool Server::startReactors() {
+    if (backend_ == IoBackend::IO_URING) {
+        bool started = true;
+        for (unsigned i = 0; i < numReactors_ and started; ++i) {
+            reactors_.push_back(make_unique<UringReactor>(i, listenFds_[i]));
+            started = reactors_.back()->start();
         }
-        return -1;
-    }
+        if (started) return true;
 
-    uint8_t response = 1;
-    if (findSocketByName(nickname) != -1) {
-        cerr << "Err: Il y a déjà une connexion avec le nom d'utilisateur "
-             << nickname << "." << endl;
-        response = 0;
+        cerr << "Le serveur utilise epoll à la place d'io_uring." << endl;
+        stopReactors();
+        reactors_.clear();
+        backend_ = IoBackend::EPOLL;
     }
 
-    if (!safeWrite(newClientSockFd, reinterpret_cast<char *>(&response),
-                   sizeof(response))) {
-        cerr << "Err: La réponse n'a pas pu être envoyée." << endl;
-        if (close(newClientSockFd) != 0) {
-            perror("close");
-        }
-        return -1;
+    for (unsigned i = 0; i < numReactors_; ++i) {
+        reactors_.push_back(make_unique<EpollReactor>(i, listenFds_[i]));
+    }
+    // Every client taken over has its reactor before any shard routes to it
+    for (size_t i = 0; i < adopted_.size(); ++i) {
+        reactors_[i % numReactors_]->adopt(adopted_[i]);
+    }
+    adopted_.clear();
+    for (auto &reactor : reactors_) {
+        if (not reactor->start()) return false;
     }
+    return true;
+}
 
-    if (response == 0) return -1;
+bool Server::openCluster() {
+    return clusterNodes_.empty()
+           or cluster_.open(
+               clusterNodes_, node_,
+               [this](string_view dest, string_view sender,
+                      string_view message, bool more) {
+                   deliverFromPeer(dest, sender, message, more);
+               },
+               [this]() {
+                   vector<string> nicknames;
+                   for (const auto &conn : registry_.connections()) {
+                       nicknames.push_back(conn->nickname);
+                   }
+                   return nicknames;
+               },
+               [this](string_view nickname, unsigned node) {
+                   yieldNickname(nickname, node);
+               },
+               [this](string_view dest, string_view sender,
+                      string_view message, bool more) {
+                   loseToPeer(dest, sender, message, more);
+               });
+}
 
-    pthread_mutex_lock(&mapMtx_);
-    mapSocketToClient_[newClientSockFd] = nickname;
-    pthread_mutex_unlock(&mapMtx_);
+bool Server::openAdmin() {
+    return adminPath_.empty()
+           or admin_.open(adminPath_, [this](AdminFormat format) {
+                  return metricsReport(format);
+              });
+}
 
-    cerr << "[+] Client connecté: " << nickname << endl;
+void Server::stopReactors() {
+    for (auto &reactor : reactors_) {
+        reactor->stop();
+    }
+    // Only once they are all stopped: they hold blocks of each other's pools
+    for (auto &reactor : reactors_) {
+        reactor->discard();
+    }
+}
 
-    return newClientSockFd;
+bool Server::startListening() {
+    for (int listenFd : listenFds_) {
+        if (listen(listenFd, acceptBacklog_) != 0) {
+            cerr << "Err: échec lors de l'écoute des connexions." << endl;
+            return false;
+        }
+    }
+    return true;
 }
 
-void Server::disconnectClient(int clientSockFd) {
-    pthread_mutex_lock(&fdMtx_);
-    pthread_mutex_lock(&mapMtx_);
-    string nickname = mapSocketToClient_[clientSockFd];
+bool Server::reachedMaxClients() {
+    return registry_.size() >= MAX_CLIENTS_CONNECTED;
+}
 
-    auto threadIt = mapSocketToThread_.find(clientSockFd);
-    if (threadIt != mapSocketToThread_.end()) {
-        mapSocketToThread_.erase(threadIt);
-    } else {
-        cerr << "Err: Le thread n'a pas été trouvé dans la liste." << endl;
+bool Server::addClient(const shared_ptr<Connection> &conn) {
+    // The check and the insertion are atomic: shards log clients on in
+    // parallel. The other nodes are checked once registered, so that a
+    // client they announce meanwhile is seen here or by yieldNickname
+    bool added = registry_.add(conn);
+    if (added and cluster_.knows(conn->nickname)) {
+        registry_.remove(*conn);
+        added = false;
+    }
+    if (not added) {
+        cerr << "Err: Il y a déjà une connexion avec le nom d'utilisateur "
+             << conn->nickname << "." << endl;
+        return false;
     }
+    conn->loggedOn = true;
+    cluster_.announce(conn->nickname, true);
+    cerr << "[+] Client connecté: " << conn->nickname << endl;
+    return true;
+}
 
-    auto clientIt = mapSocketToClient_.find(clientSockFd);
-    if (clientIt != mapSocketToClient_.end()) {
-        mapSocketToClient_.erase(clientIt);
-    } else {
+void Server::disconnectClient(Connection &conn) {
+    // conn may be owned by the registry only
+    shared_ptr<Connection> keepAlive = registry_.remove(conn);
+    if (keepAlive == nullptr) {
         cerr << "Err: Le socket n'a pas été trouvé dans la liste." << endl;
+    } else {
+        cluster_.announce(conn.nickname, false);
     }
 
-    if (close(clientSockFd) != 0) {
+    // Frames still posted to conn must not be written into a reused fd
+    conn.closed = true;
+    if (close(conn.fd) != 0) {
         cerr << "Err: Échec de la fermeture du socket client - "
              << strerror(errno) << endl;
     }
 
-    pthread_mutex_unlock(&mapMtx_);
-    pthread_mutex_unlock(&fdMtx_);
-    cerr << "[-] Client déconnecté: " << nickname << endl;
+    cerr << "[-] Client déconnecté: " << conn.nickname << endl;
 }
 
 void Server::disconnectAllClients() {
-    pthread_mutex_lock(&mapMtx_);
-    auto copySTC(mapSocketToClient_);
-    auto copySTT(mapSocketToThread_);
-    pthread_mutex_unlock(&mapMtx_);
-
-    for (const auto &pair : copySTC) {
-        if (shutdown(pair.first, SHUT_RD) < 0) {
-            cerr << "Err: Une connexion n'a pas pu être fermée." << endl;
-            pthread_cancel(copySTT[pair.first]); //< Force quit
-            sem_post(&finishedThreads);
-        }
+    for (const auto &conn : registry_.connections()) {
+        disconnectClient(*conn);
     }
+    cerr << "Tous les clients ont été déconnectés." << endl;
 }
 
-void *Server::handleClientThreadFunc(void *arg) {
-    int clientSockFd = reinterpret_cast<long>(arg);
-    Server &server = Server::getInstance();
+bool Server::handleMessage(Connection &sender, const FrameView &frame) {
+    auto receivedAt = chrono::steady_clock::now();
+    ShardMetrics &metrics = sender.reactor->metrics();
 
-    if (not setSigMask(true)) { // Ignore signals
-        server.disconnectClient(clientSockFd);
-        sem_post(&server.finishedThreads);
-        return nullptr;
+    shared_ptr<Connection> dest = findConnectionByName(frame.nickname);
+    ForwardReturnVal forwarded = ForwardReturnVal::UNKNOWN;
+    if (dest == nullptr) {
+        forwarded = cluster_.forward(frame.nickname, sender.nickname,
+                                     frame.message, frame.more);
     }
 
-    pthread_mutex_lock(&server.mapMtx_);
-    string nicknameSender = server.mapSocketToClient_[clientSockFd];
-    pthread_mutex_unlock(&server.mapMtx_);
-
-    ReceiveMessageReturnVal readMsgRet;
-
-    string nicknameDest;
-    string message;
-    do {
-        readMsgRet = receiveMessage(clientSockFd, nicknameDest, message,
-                                    CURRENT_VERSION);
-        if (static_cast<bool>(readMsgRet)) continue;
-
-        int destSockFd = server.findSocketByName(nicknameDest);
-        if (destSockFd == -1) {
-            string emptyNickname;
-            string disconnectedDestMessage =
-                "Cette personne (" + nicknameDest + ") n'est pas connectée.";
-
-            SendMessageReturnVal ret = server.sendMessage(
-                clientSockFd, emptyNickname, disconnectedDestMessage);
-            if (ret == SendMessageReturnVal::BROKEN_PIPE) {
-                break;
-            } else if (ret != SendMessageReturnVal::SUCCESS) {
-                cerr << "Err: Échec de l'envoi du message signalant que "
-                        "l'utilisateur n'est pas connecté."
-                     << endl;
-            }
+    if (forwarded == ForwardReturnVal::FORWARDED) {
+        bump(metrics.forwarded);
+    } else if (forwarded == ForwardReturnVal::UNREACHABLE) {
+        // Logged on to another node: not stored here, nor said to be gone
+        bump(metrics.unreachable);
+        if (frame.more) return true; //< Once per message, on its last part
+        char notice[NOTICE_SIZE];
+        if (sendMessage(sender, {},
+                        writeNotice(notice, UNREACHABLE_START, frame.nickname,
+                                    UNREACHABLE_END))
+            == SendMessageReturnVal::BROKEN_PIPE) {
+            return false;
+        }
+    } else if (dest == nullptr) {
+        bump(metrics.undeliverable);
+        string_view end = DISCONNECTED_END;
+
+        if (offline_.store(frame.nickname, sender.nickname, frame.message,
+                           frame.more)) {
+            bump(metrics.storedOffline);
+            end = STORED_END;
+            // Logged on since the lookup: its replay may have missed it
+            dest = findConnectionByName(frame.nickname);
+            if (dest != nullptr) dest->reactor->requestReplay(*dest);
+        }
 
-        } else {
-            SendMessageReturnVal ret =
-                server.sendMessage(destSockFd, nicknameSender, message);
-            if (ret == SendMessageReturnVal::BROKEN_PIPE) {
-                break;
-            } else if (ret != SendMessageReturnVal::SUCCESS) {
-                cerr << "Err: Échec de l'envoi du message." << endl;
-            }
+        // Once per message, not per fragment
+        if (frame.more) return true;
+        char notice[NOTICE_SIZE];
+        SendMessageReturnVal ret = sendMessage(
+            sender, {}, writeNotice(notice, NOTICE_START, frame.nickname, end));
+        if (ret == SendMessageReturnVal::BROKEN_PIPE) {
+            return false;
+        } else if (ret != SendMessageReturnVal::SUCCESS) {
+            cerr << "Err: Échec de l'envoi du message signalant que "
+                    "l'utilisateur n'est pas connecté."
+                 << endl;
         }
-    } while (readMsgRet == ReceiveMessageReturnVal::SUCCESS);
 
-    if (readMsgRet == ReceiveMessageReturnVal::MESSAGE_TOO_LONG) {
-        server.sendTooLongMessage(clientSockFd);
+    } else {
+        // A broken destination is disconnected by its own reactor
+        uint8_t flags =
+            (frame.more ? FRAME_MORE : 0) | nicknameFlags(sender, *dest);
+        // Counted only: the reactor of dest logs when it drops the client
+        if (sendMessage(*dest, sender.nickname, frame.message, flags,
+                        sender.nicknameId, receivedAt)
+            != SendMessageReturnVal::SUCCESS) {
+            bump(metrics.sendFailures);
+            return true;
+        }
+        bump(metrics.messagesRouted);
+        if (overflowPolicy_ == OverflowPolicy::BLOCK and dest->congested) {
+            sender.reactor->pause(sender, *dest);
+        }
     }
-
-    server.disconnectClient(clientSockFd);
-    sem_post(&server.finishedThreads);
-    return nullptr;
+    // Its own notices too: a sender that does not read them is not read
+    if (overflowPolicy_ == OverflowPolicy::BLOCK and sender.congested
+        and not sender.paused) {
+        sender.reactor->pause(sender, sender);
+    }
+    return true;
 }
 
 void Server::signalHandler(int signal) {
     if (signal == SIGINT or signal == SIGTERM) {
         exitFlag = true;
+    } else if (signal == SIGUSR2) {
+        upgradeFlag = true;
     }
 }
 
-void Server::sendTooLongMessage(const int clientSockFd) {
-    string emptyNickname;
-    string tooLongMessageWarning = TOO_LONG_MESSAGE_WARNING;
+void Server::sendTooLongMessage(Connection &client) {
+    bump(client.reactor->metrics().tooLong);
 
-    if (sendMessage(clientSockFd, emptyNickname, tooLongMessageWarning)
+    if (sendMessage(client, "", TOO_LONG_MESSAGE_WARNING)
         != SendMessageReturnVal::SUCCESS) {
         cerr << "Err: échec de l'envoi de l'avertissement pour message trop "
                 "long."
@@ -240,41 +341,178 @@ void Server::sendTooLongMessage(const int clientSockFd) {
     }
 }
 
-void Server::closeServerSocket() {
-    if (serverSockFd_ == -1) {
+void Server::closeServerSockets() {
+    for (int listenFd : listenFds_) {
+        if (close(listenFd) != 0) {
+            cerr << "Err: échec de la fermeture du socket du serveur." << endl;
+        }
+    }
+    listenFds_.clear();
+}
+
+shared_ptr<Connection> Server::findConnectionByName(string_view nickname) {
+    return registry_.find(nickname);
+}
+
+void Server::deliverFromPeer(string_view destNickname, string_view sender,
+                             string_view message, bool more) {
+    shared_ptr<Connection> dest = findConnectionByName(destNickname);
+    if (dest != nullptr) {
+        sendMessage(*dest, sender, message, more ? FRAME_MORE : 0, 0,
+                    chrono::steady_clock::now());
         return;
     }
+    // Left since the other node looked it up
+    offline_.store(destNickname, sender, message, more);
+}
+
+void Server::yieldNickname(string_view nickname, unsigned node) {
+    shared_ptr<Connection> conn = findConnectionByName(nickname);
+    if (conn == nullptr) return;
+    cerr << "Err: Le nom d'utilisateur " << nickname
+         << " est aussi pris sur le nœud " << node
+         << ", qui le garde: le client est déconnecté." << endl;
+    conn->reactor->requestLogOut(*conn);
+}
+
+void Server::loseToPeer(string_view destNickname, string_view sender,
+                        string_view, bool more) {
+    // Once per message, on its last part: the parts after a lost one are
+    // lost too, or refused as unreachable
+    if (more) return;
+    shared_ptr<Connection> conn = findConnectionByName(sender);
+    if (conn == nullptr) return;
+    char notice[NOTICE_SIZE];
+    sendMessage(*conn, {},
+                writeNotice(notice, UNREACHABLE_START, destNickname,
+                            UNREACHABLE_END));
+}
 
-    if (close(serverSockFd_) != 0) {
-        cerr << "Err: échec de la fermeture du socket du serveur." << endl;
+HandoffWriter Server::saveState() {
+    HandoffWriter state;
+    state.putU32(listenFds_.size());
+    for (int listenFd : listenFds_) state.putFd(listenFd);
+
+    // The frames still posted between shards follow the queues of their
+    // destinations (as is: only the queued ones went through the compressor)
+    unordered_map<const Connection *, vector<const FrameBuffer *>> posted;
+    vector<shared_ptr<Connection>> clients;
+    for (auto &reactor : reactors_) {
+        reactor->forEachPosted([&](const InboxItem &item) {
+            if (item.kind == InboxItemKind::FRAME and item.frame) {
+                posted[item.dest.get()].push_back(item.frame);
+            }
+        });
+        for (auto &conn : reactor->clients()) {
+            if (not conn->closed and not conn->closing) {
+                clients.push_back(move(conn));
+            }
+        }
     }
 
-    serverSockFd_ = -1;
+    state.putU32(clients.size());
+    for (const auto &conn : clients) {
+        saveConnection(state, *conn, posted[conn.get()]);
+    }
+    return state;
 }
 
-int Server::findSocketByName(const string &nickname) {
-    int ret = -1;
+bool Server::takeOver() {
+    HandoffReader state;
+    if (not state.receive(handoffFd_)) return false;
+
+    for (uint32_t count = state.getU32(); count > 0; --count) {
+        int listenFd = state.takeFd();
+        if (listenFd < 0) return false;
+        listenFds_.push_back(listenFd);
+    }
+
+    unordered_map<uint64_t, uint64_t> serials; //< Previous ones to ours
+    for (uint32_t count = state.getU32(); count > 0 and not state.failed();
+         --count) {
+        uint64_t serial;
+        shared_ptr<Connection> conn = loadConnection(state, serial);
+        if (conn == nullptr) return false;
+        serials[serial] = conn->serial;
+        adopted_.push_back(move(conn));
+    }
+    if (not state.done()) return false;
 
-    pthread_mutex_lock(&mapMtx_);
-    for (const auto &pair : mapSocketToClient_) {
-        if (pair.second == nickname) {
-            ret = pair.first;
-            break;
+    for (const auto &conn : adopted_) {
+        unordered_set<uint64_t> boundTo;
+        for (uint64_t serial : conn->boundTo) {
+            auto found = serials.find(serial);
+            if (found != serials.end()) boundTo.insert(found->second);
         }
+        conn->boundTo = move(boundTo);
+        if (overflowPolicy_ == OverflowPolicy::BLOCK
+            and conn->outBytes > outputLimit_) {
+            conn->congested = true;
+        }
+        if (conn->loggedOn and not registry_.add(conn)) return false;
     }
-    pthread_mutex_unlock(&mapMtx_);
 
-    return ret;
+    cerr << adopted_.size() << " client(s) repris du serveur précédent."
+         << endl;
+    return true;
 }
 
-// ### Public methods ###
+bool Server::handOver() {
+    if (backend_ != IoBackend::EPOLL) {
+        cerr << "Err: La mise à jour à chaud n'est possible qu'avec epoll."
+             << endl;
+        return false;
+    }
+    cerr << "Passage du relais à " << executable_ << "..." << endl;
+
+    // Nothing may change the state while it is written (the other nodes
+    // reconnect to the new server)
+    admin_.stop();
+    cluster_.stop();
+    for (auto &reactor : reactors_) {
+        reactor->stop();
+    }
+    offline_.close(); //< Synced, reopened by the new server
 
-bool Server::init() {
-    if (sem_init(&finishedThreads, 0, 0) != 0) {
-        cerr << "Err: Le sémaphore n'a pas pu être initialisé." << endl;
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        perror("socketpair");
         return false;
     }
+    pid_t successor = spawnSuccessor(executable_, fds[1]);
+    close(fds[1]);
+
+    bool tookOver =
+        successor > 0 and saveState().send(fds[0]) and waitHandoffAck(fds[0]);
+    close(fds[0]);
+    if (tookOver) {
+        handedOver_ = true;
+        cerr << "Le nouveau serveur (" << successor << ") a pris le relais."
+             << endl;
+        return true;
+    }
+
+    // Not serving yet: it must not touch the clients once we resume
+    if (successor > 0) {
+        kill(successor, SIGKILL);
+        waitpid(successor, nullptr, 0);
+    }
+    return false;
+}
+
+bool Server::resume() {
+    cerr << "Err: La mise à jour à chaud a échoué, le serveur continue."
+         << endl;
+    if (not offline_.reopen()) return false;
+    for (auto &reactor : reactors_) {
+        if (not reactor->start()) return false;
+    }
+    return openAdmin() and openCluster();
+}
+
+// ### Public methods ###
 
+bool Server::init() {
     // Get the port from the environment variable PORT_SERVEUR and if not found,
     // set default port to 1234
     port_ = DEFAULT_PORT;
@@ -286,36 +524,195 @@ bool Server::init() {
         }
     }
 
-    // Create the socket
-    serverSockFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSockFd_ < 0) {
-        cerr << "Err: Le socket n'a pas pu être créé - " << strerror(errno)
-             << endl;
-        return false;
+    // Get the number of pending connections per listening socket from the
+    // environment variable BACKLOG_SERVEUR and if not found, use SOMAXCONN (the
+    // kernel caps it at net.core.somaxconn)
+    acceptBacklog_ = DEFAULT_ACCEPT_BACKLOG;
+    const char *backlog = getenv("BACKLOG_SERVEUR");
+    if (backlog) {
+        int backlogNum = atoi(backlog);
+        if (backlogNum > 0) {
+            acceptBacklog_ = backlogNum;
+        }
     }
 
-    // Allow the reuse of the port
-    int opt = 1;
-    if (setsockopt(serverSockFd_, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt,
-                   sizeof(opt))
-        != 0) {
-        cerr << "Err: La réutilisation du port/adresse n'a pas pu être activée."
-             << endl;
-        return false;
+    // Get the time a client has to send its nickname from the environment
+    // variable HANDSHAKE_SERVEUR, in milliseconds (0 for no limit), and if not
+    // found, give it 10 seconds
+    handshakeTimeout_ = chrono::milliseconds(DEFAULT_HANDSHAKE_TIMEOUT_MS);
+    const char *handshake = getenv("HANDSHAKE_SERVEUR");
+    if (handshake and atoll(handshake) >= 0) {
+        handshakeTimeout_ = chrono::milliseconds(atoll(handshake));
     }
 
-    struct sockaddr_in address;
+    // Get the I/O backend from the environment variable IO_SERVEUR (epoll or
+    // io_uring) and if not found, use epoll
+    backend_ = IoBackend::EPOLL;
+    const char *io = getenv("IO_SERVEUR");
+    if (io and strcmp(io, "io_uring") == 0) {
+        backend_ = IoBackend::IO_URING;
+    } else if (io and strcmp(io, "epoll") != 0) {
+        cerr << "Err: Backend d'entrées/sorties inconnu: " << io
+             << ", utilisation d'epoll." << endl;
+    }
 
-    // Set the listening address and port, reserve the port
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(static_cast<uint16_t>(port_));
+    // Get the number of reactors (shards) from the environment variable
+    // THREADS_SERVEUR and if not found, use one per core
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    numReactors_ = numCores > 0 ? numCores : 1;
+    const char *threads = getenv("THREADS_SERVEUR");
+    if (threads) {
+        int threadsNum = atoi(threads);
+        if (threadsNum > 0 && threadsNum <= MAX_REACTORS) {
+            numReactors_ = threadsNum;
+        }
+    }
 
-    if (bind(serverSockFd_, reinterpret_cast<sockaddr *>(&address),
-             sizeof(address))
-        != 0) {
-        cerr << "Err: Échec de la liaison entre le socket et le port." << endl;
-        return false;
+    // Get the maximum number of bytes queued for a client from the
+    // environment variable OUTBUF_SERVEUR and if not found, use 256 KiB
+    outputLimit_ = DEFAULT_OUTPUT_LIMIT;
+    const char *outbuf = getenv("OUTBUF_SERVEUR");
+    if (outbuf) {
+        long long outbufNum = atoll(outbuf);
+        if (outbufNum >= static_cast<long long>(MIN_OUTPUT_LIMIT)) {
+            outputLimit_ = outbufNum;
+        }
+    }
+
+    // Get what to do when a client's queue is full from the environment
+    // variable OVERFLOW_SERVEUR (drop-oldest, disconnect or block) and if not
+    // found, make its senders wait: like a blocking write, no message is lost
+    overflowPolicy_ = OverflowPolicy::BLOCK;
+    const char *overflow = getenv("OVERFLOW_SERVEUR");
+    if (overflow and strcmp(overflow, "drop-oldest") == 0) {
+        overflowPolicy_ = OverflowPolicy::DROP_OLDEST;
+    } else if (overflow and strcmp(overflow, "disconnect") == 0) {
+        overflowPolicy_ = OverflowPolicy::DISCONNECT;
+    } else if (overflow and strcmp(overflow, "block") != 0) {
+        cerr << "Err: Politique de débordement inconnue: " << overflow
+             << ", les expéditeurs attendront les clients trop lents." << endl;
+    }
+
+    // Get the size from which messages are relayed with splice() (epoll only)
+    // from the environment variable SPLICE_SERVEUR, in bytes, and if not
+    // found, always copy them
+    spliceThreshold_ = 0;
+    const char *spliceMin = getenv("SPLICE_SERVEUR");
+    if (spliceMin) {
+        long long spliceNum = atoll(spliceMin);
+        if (spliceNum > 0) {
+            spliceThreshold_ = max<long long>(spliceNum, MIN_SPLICE_THRESHOLD);
+        }
+    }
+
+    // Accept to compress the messages of the clients offering it if the
+    // environment variable COMPRESSION_SERVEUR is set to a non-zero value
+    const char *compression = getenv("COMPRESSION_SERVEUR");
+    compression_ = compression and atoi(compression) != 0;
+
+    // Get the directory of the offline messages from the environment variable
+    // OFFLINE_DIR_SERVEUR and if not found, do not store them. Their max size
+    // per recipient (OFFLINE_MAX_SERVEUR, in bytes) and lifetime
+    // (OFFLINE_TTL_SERVEUR, in seconds) default to 1 MiB and 7 days, the max
+    // number of recipients (OFFLINE_RECIPIENTS_SERVEUR) and size of all their
+    // segments (OFFLINE_TOTAL_SERVEUR, in bytes) to 4096 and 1 GiB
+    const char *offlineDir = getenv("OFFLINE_DIR_SERVEUR");
+    if (offlineDir) {
+        size_t offlineLimit = DEFAULT_OFFLINE_LIMIT;
+        const char *offlineMax = getenv("OFFLINE_MAX_SERVEUR");
+        if (offlineMax and atoll(offlineMax) > 0) {
+            offlineLimit = atoll(offlineMax);
+        }
+        time_t offlineTtl = DEFAULT_OFFLINE_TTL;
+        const char *ttl = getenv("OFFLINE_TTL_SERVEUR");
+        if (ttl and atoll(ttl) > 0) {
+            offlineTtl = atoll(ttl);
+        }
+        size_t offlineRecipients = DEFAULT_OFFLINE_RECIPIENTS;
+        const char *recipients = getenv("OFFLINE_RECIPIENTS_SERVEUR");
+        if (recipients and atoll(recipients) > 0) {
+            offlineRecipients = atoll(recipients);
+        }
+        size_t offlineTotal = DEFAULT_OFFLINE_TOTAL;
+        const char *total = getenv("OFFLINE_TOTAL_SERVEUR");
+        if (total and atoll(total) > 0) {
+            offlineTotal = atoll(total);
+        }
+        if (not offline_.open(offlineDir, offlineLimit, offlineTtl,
+                              offlineRecipients, offlineTotal)) {
+            return false;
+        }
+    }
+
+    // Get the nodes of the cluster from the environment variable
+    // CLUSTER_SERVEUR ("ip:port" of every node, separated by commas, in the
+    // same order on all of them) and our index in it from NODE_SERVEUR, and
+    // if not found, run alone
+    const char *cluster = getenv("CLUSTER_SERVEUR");
+    if (cluster and cluster[0] != '\0') {
+        string nodes = cluster;
+        for (size_t start = 0; start <= nodes.size();) {
+            size_t comma = min(nodes.find(',', start), nodes.size());
+            clusterNodes_.push_back(nodes.substr(start, comma - start));
+            start = comma + 1;
+        }
+        const char *node = getenv("NODE_SERVEUR");
+        int nodeNum = node ? atoi(node) : -1;
+        if (clusterNodes_.size() < 2
+            or clusterNodes_.size() > MAX_CLUSTER_NODES or nodeNum < 0
+            or static_cast<size_t>(nodeNum) >= clusterNodes_.size()) {
+            cerr << "Err: Le cluster doit compter de 2 à " << MAX_CLUSTER_NODES
+                 << " nœuds, dont celui-ci (NODE_SERVEUR)." << endl;
+            return false;
+        }
+        node_ = nodeNum;
+    }
+
+    // Get the path of the admin socket from the environment variable
+    // ADMIN_SERVEUR and if not found, do not open it
+    const char *admin = getenv("ADMIN_SERVEUR");
+    if (admin and admin[0] != '\0') {
+        adminPath_ = admin;
+    }
+
+    // Remember the binary, run again by a hot upgrade even if it was
+    // replaced since
+    char executable[PATH_MAX];
+    ssize_t length =
+        readlink("/proc/self/exe", executable, sizeof(executable));
+    if (length > 0 and static_cast<size_t>(length) < sizeof(executable)) {
+        executable_.assign(executable, length);
+    }
+
+    // Take the sockets and clients of the previous server over if started by
+    // a hot upgrade (HANDOFF_FD_SERVEUR, not inherited by our own successor)
+    const char *handoff = getenv(HANDOFF_ENV.c_str());
+    if (handoff) {
+        handoffFd_ = atoi(handoff);
+        unsetenv(HANDOFF_ENV.c_str());
+        if (backend_ != IoBackend::EPOLL) {
+            cerr << "Le serveur utilise epoll pour reprendre les clients du "
+                    "serveur précédent."
+                 << endl;
+            backend_ = IoBackend::EPOLL;
+        }
+        if (not takeOver()) {
+            cerr << "Err: L'état du serveur précédent n'a pas pu être repris."
+                 << endl;
+            return false;
+        }
+    }
+
+    // Create one listening socket per reactor (the previous server's ones
+    // first)
+    while (listenFds_.size() > numReactors_) {
+        close(listenFds_.back());
+        listenFds_.pop_back();
+    }
+    while (listenFds_.size() < numReactors_) {
+        int listenFd = openListener();
+        if (listenFd < 0) return false;
+        listenFds_.push_back(listenFd);
     }
 
     return initSignals();
@@ -326,38 +723,29 @@ int Server::run() {
         return 1;
     }
 
-    cerr << "Le serveur est en cours d'exécution." << endl;
-    startListening();
-
-    // Exit this loop when receiving SIGINT
-    while (true) {
-        handleSignalsSafely();
-        int newClientSockFd = acceptNewClient();
-        if (serverSockFd_ == -1) break; // Server shutting down
-
-        pthread_mutex_lock(&fdMtx_);
-        if (newClientSockFd > 0) {
-            pthread_t thread;
-            int ret = pthread_create(&thread, nullptr, handleClientThreadFunc,
-                                     reinterpret_cast<void *>(newClientSockFd));
-
-            if (ret == 0) {
-                pthread_mutex_lock(&mapMtx_);
-                mapSocketToThread_[newClientSockFd] = thread;
-                pthread_mutex_unlock(&mapMtx_);
-
-                if (pthread_detach(thread) != 0) { // Abort
-                    if (shutdown(newClientSockFd, SHUT_RD) != 0) {
-                        pthread_cancel(thread);
-                        sem_post(&finishedThreads);
-                    }
-                }
-                ++startedThreads;
-            }
-        }
-        pthread_mutex_unlock(&fdMtx_);
+    if (not startListening()) {
+        return 1;
+    }
+
+    // The previous server stops serving once told, just before we start
+    if (handoffFd_ >= 0) {
+        bool acknowledged = acknowledgeHandoff(handoffFd_);
+        close(handoffFd_);
+        handoffFd_ = -1;
+        if (not acknowledged) return 1;
+    }
+
+    if (not startReactors() or not openAdmin() or not openCluster()) {
+        return 1;
     }
 
+    cerr << "Le serveur est en cours d'exécution." << endl;
+
+    // The reactors accept the clients themselves
+    while (waitForSignal()) {
+        if (handOver()) return 0;
+        if (not resume()) return 1;
+    }
     return 0;
 }
 
@@ -366,60 +754,76 @@ Server &Server::getInstance() {
     return instance;
 }
 
-SendMessageReturnVal Server::sendMessage(int destSockFd, const string &nickname,
-                                         const string &message) {
-
-    uint8_t nicknameSize = nickname.size();
-    uint16_t messageSize = message.size();
-    uint16_t totalSize = sizeof(PacketHeader) + messageSize + nicknameSize;
+SendMessageReturnVal
+Server::sendMessage(Connection &dest, string_view nickname, string_view message,
+                    uint8_t flags, NicknameId nicknameId,
+                    chrono::steady_clock::time_point receivedAt) {
 
-    PacketHeader header{CURRENT_VERSION, htons(totalSize), nicknameSize};
+    if (flags & FRAME_NICKNAME_ID) nickname = {};
+    char header[MAX_HEADER_SIZE];
+    size_t headerSize = encodeHeader(header, dest.version, nickname.size(),
+                                     message.size(), flags, nicknameId);
 
     struct iovec iov[3];
-    iov[0].iov_base = &header;
-    iov[0].iov_len = sizeof(header);
+    iov[0].iov_base = header;
+    iov[0].iov_len = headerSize;
     iov[1].iov_base = const_cast<char *>(nickname.data());
-    iov[1].iov_len = nicknameSize;
+    iov[1].iov_len = nickname.size();
     iov[2].iov_base = const_cast<char *>(message.data());
-    iov[2].iov_len = messageSize;
+    iov[2].iov_len = message.size();
 
-    size_t numBytes = sizeof(PacketHeader) + nicknameSize + messageSize,
-           iovcnt = sizeof(iov) / sizeof(struct iovec);
-
-    while (true) {
-        int bytesWritten = writev(destSockFd, iov, iovcnt);
-
-        if (bytesWritten == static_cast<int>(numBytes)) {
-            return SendMessageReturnVal::SUCCESS;
-        } else if (bytesWritten < 0) {
-            if (errno == EPIPE) {
-                return SendMessageReturnVal::BROKEN_PIPE;
-            }
+    return dest.reactor->sendFrame(dest, iov, sizeof(iov) / sizeof(iov[0]),
+                                   receivedAt);
+}
 
-            if (errno != EINTR) {
-                cerr << "Err: " << strerror(errno) << endl;
-                return SendMessageReturnVal::WRITE_FAILED;
-            }
-        } else {
-            return SendMessageReturnVal::COULD_NOT_WRITE_ALL_BYTES;
-        }
+uint8_t Server::nicknameFlags(Connection &sender, const Connection &dest) {
+    if (not dest.nicknameIds or sender.nicknameId >= MAX_NICKNAME_IDS) {
+        return 0;
     }
+    return sender.boundTo.insert(dest.serial).second ? FRAME_NICKNAME_BIND
+                                                      : FRAME_NICKNAME_ID;
 }
 
-void Server::waitAllThreads() {
-    unsigned max = startedThreads;
-    for (unsigned i = 0; i < max; ++i) {
-        sem_wait(&finishedThreads);
+string Server::metricsReport(AdminFormat format) {
+    MetricsSnapshot snapshot;
+    for (const auto &reactor : reactors_) {
+        snapshot.add(reactor->metrics());
     }
-    cerr << "Tous les clients ont été déconnectés." << endl;
-    startedThreads = 0;
+
+    vector<shared_ptr<Connection>> connections = registry_.connections();
+    snapshot.loggedOn = connections.size();
+    snapshot.fromPeers = cluster_.received();
+    snapshot.peerLinks = cluster_.linksUp();
+    snapshot.lostOnLinks = cluster_.lost();
+    snapshot.queues.reserve(connections.size());
+    for (const auto &conn : connections) {
+        snapshot.queues.push_back(
+            {conn->nickname, conn->queuedBytes.load(memory_order_relaxed),
+             conn->received.load(memory_order_relaxed)});
+    }
+    snapshot.sortQueues();
+
+    return format == AdminFormat::JSON ? snapshot.toJson() : snapshot.toText();
 }
 
-void Server::handleSignalsSafely() {
-    if (exitFlag) {
-        closeServerSocket();
-        exitFlag = false;
+bool Server::waitForSignal() {
+    sigset_t signals, previousMask;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR2);
+
+    // Block the signals while checking the flags so that none is missed
+    pthread_sigmask(SIG_BLOCK, &signals, &previousMask);
+    while (not exitFlag and not upgradeFlag) {
+        sigsuspend(&previousMask);
     }
+    pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+
+    bool upgrade = upgradeFlag and not exitFlag;
+    upgradeFlag = false;
+    if (exitFlag) exitFlag = false;
+    return upgrade;
 }
 
 bool Server::initSignals() {
@@ -430,7 +834,8 @@ bool Server::initSignals() {
     sigemptyset(&sa.sa_mask);
     if (signal(SIGPIPE, SIG_IGN) == SIG_ERR
         or sigaction(SIGINT, &sa, NULL) == -1
-        or sigaction(SIGTERM, &sa, NULL) == -1) {
+        or sigaction(SIGTERM, &sa, NULL) == -1
+        or sigaction(SIGUSR2, &sa, NULL) == -1) {
         cerr << "Err: Échec de l'assignation de gestionnaire de signaux"
              << endl;
         return false;
@@ -9,89 +9,239 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include "../common/header/header.hpp"
 #include "../common/send_message/send_message.hpp"
+#include "admin/admin_socket.hpp"
+#include "cluster/cluster.hpp"
+#include "connection/connection.hpp"
+#include "handoff/handoff.hpp"
+#include "metrics/metrics.hpp"
+#include "offline/offline_store.hpp"
+#include "reactor/epoll_reactor.hpp"
+#include "reactor/reactor.hpp"
+#include "reactor/uring_reactor.hpp"
+#include "registry/registry.hpp"
 
-#include <atomic>
+#include <chrono>
+#include <memory>
 #include <netinet/in.h>
-#include <pthread.h>
-#include <semaphore.h>
 #include <string>
+#include <string_view>
+#include <sys/socket.h>
 #include <sys/types.h>
-#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
 constexpr int DEFAULT_PORT = 1234;
-constexpr int ACCEPT_BACKLOG = 5;
+constexpr int DEFAULT_ACCEPT_BACKLOG = SOMAXCONN; //< Per listening socket
+constexpr int DEFAULT_HANDSHAKE_TIMEOUT_MS = 10000;
 constexpr int MAX_CLIENTS_CONNECTED = 1000;
 constexpr int MAX_LENGTH_MESSAGE = 1024;
 constexpr int MAX_LENGTH_NICKNAME = 30;
-constexpr uint8_t CURRENT_VERSION = 1;
+constexpr uint8_t CURRENT_VERSION = PROTOCOL_V2; //< Highest version spoken
+constexpr int MAX_REACTORS = 256;
+constexpr size_t DEFAULT_OUTPUT_LIMIT = 256 * 1024; //< Bytes per client
+constexpr size_t MIN_OUTPUT_LIMIT = 16 * 1024;      //< Fits a few frames
+constexpr size_t FRAME_BUFFER_CAPACITY =
+    MAX_HEADER_SIZE + MAX_LENGTH_NICKNAME + MAX_LENGTH_MESSAGE;
+constexpr size_t MIN_SPLICE_THRESHOLD = //< Reads reach past the nickname
+    MAX_HEADER_SIZE + MAX_LENGTH_NICKNAME;
 const string TOO_LONG_MESSAGE_WARNING = "Votre message est trop long !";
 
 class Server {
   private:
-    int serverSockFd_;
     int port_;
+    int acceptBacklog_; //< Pending connections per listening socket
+    unsigned numReactors_;
+    IoBackend backend_;
+    size_t outputLimit_;            //< Max bytes queued for a client
+    OverflowPolicy overflowPolicy_; //< When the queue is full
+    size_t spliceThreshold_;        //< Min message spliced (0: never)
+    bool compression_;              //< Whether CAP_COMPRESSION is accepted
+    chrono::milliseconds handshakeTimeout_; //< To log on (0: no limit)
 
-    pthread_mutex_t mapMtx_ PTHREAD_MUTEX_INITIALIZER,
-        fdMtx_ PTHREAD_MUTEX_INITIALIZER;
+    /**
+     * @brief One listening socket per reactor, all bound to port_ with
+     * SO_REUSEPORT.
+     */
+    vector<int> listenFds_;
 
-    sem_t finishedThreads;
-    atomic<unsigned> startedThreads = 0;
+    /**
+     * @brief The logged-on clients, indexed by nickname.
+     */
+    Registry registry_;
+
+    /**
+     * @brief The messages sent to clients that are not logged on (disabled
+     * unless OFFLINE_DIR_SERVEUR is set).
+     */
+    OfflineStore offline_;
+
+    /**
+     * @brief The shards serving the clients, each accepting its own clients.
+     */
+    vector<unique_ptr<Reactor>> reactors_;
+
+    /**
+     * @brief Path of the admin socket, from ADMIN_SERVEUR (none if empty).
+     */
+    string adminPath_;
 
     /**
-     * @brief Map each socket to the name of its corresponding client.
+     * @brief Answers the local administration tools (metrics), once the
+     * reactors are running.
      */
-    unordered_map<int, string> mapSocketToClient_;
+    AdminSocket admin_;
 
     /**
-     * @brief Map each socket to the thread responsible of handling that
-     * socket/client.
+     * @brief "ip:port" of every node of the cluster, from CLUSTER_SERVEUR
+     * (empty if the server runs alone), and ours, from NODE_SERVEUR.
      */
-    unordered_map<int, pthread_t> mapSocketToThread_;
+    vector<string> clusterNodes_;
+    unsigned node_ = 0;
 
     /**
-     * @brief Wait for all running threads to end their execution
+     * @brief Forwards the messages to the clients of the other nodes.
      */
-    void waitAllThreads();
+    Cluster cluster_;
 
     /**
-     * @brief Start listening for incoming connections.
-     * Exit if the call to listen fails.
+     * @brief Path of the server's binary, run again by a hot upgrade
+     * (SIGUSR2).
+     */
+    string executable_;
+
+    /**
+     * @brief Socket to the previous server, from HANDOFF_FD_SERVEUR, until it
+     * is told that its state was taken over (-1 if none).
+     */
+    int handoffFd_ = -1;
+
+    /**
+     * @brief The clients taken over from the previous server, given to the
+     * reactors before they start.
+     */
+    vector<shared_ptr<Connection>> adopted_;
+
+    /**
+     * @brief The clients and sockets now belong to the new server: they are
+     * not closed on exit.
+     */
+    bool handedOver_ = false;
+
+    /**
+     * @brief Create a socket bound to port_, sharing the port with the other
+     * ones.
+     *
+     * @return int The socket in case of success; otherwise, -1.
+     */
+    int openListener();
+
+    /**
+     * @brief Start the reactors, falling back to epoll if io_uring was asked
+     * for but is not available.
+     *
+     * @note The server must already be listening.
+     *
+     * @return bool If the operation succeded
+     */
+    bool startReactors();
+
+    /**
+     * @brief Open the admin socket, if its path is set.
+     *
+     * @return bool If the operation succeded
+     */
+    bool openAdmin();
+
+    /**
+     * @brief Join the cluster, if the server is part of one.
+     *
+     * @return bool If the operation succeded
+     */
+    bool openCluster();
+
+    /**
+     * @brief Hand a message forwarded by another node to its destination
+     * (from the cluster's thread), or store it if the destination left.
+     */
+    void deliverFromPeer(string_view destNickname, string_view sender,
+                         string_view message, bool more);
+
+    /**
+     * @brief Log out the local client with a nickname a node listed before
+     * this one claims too (from the cluster's thread).
+     */
+    void yieldNickname(string_view nickname, unsigned node);
+
+    /**
+     * @brief Tell the sender of a message forwarded to another node that it
+     * was dropped with the link (from the cluster's thread).
+     */
+    void loseToPeer(string_view destNickname, string_view sender,
+                    string_view message, bool more);
+
+    /**
+     * @brief Stop all the reactors, wait for their threads to end and release
+     * the frames they still hold.
+     */
+    void stopReactors();
+
+    /**
+     * @brief Start listening for incoming connections on every socket.
      */
     bool startListening();
 
     /**
-     * @brief Accept a new client.
+     * @brief Check whether a new client would be one too many.
+     */
+    bool reachedMaxClients();
+
+    /**
+     * @brief Register a client whose handshake succeeded, unless its nickname
+     * is already taken.
+     *
+     * @note conn->reactor must already be set, as other reactors may route
+     * messages to the client as soon as it is registered.
      *
-     * @return int Return the new client socket in case of success; otherwise,
-     * -1.
+     * @param conn The client.
+     *
+     * @return bool If the client was registered
      */
-    int acceptNewClient();
+    bool addClient(const shared_ptr<Connection> &conn);
 
     /**
-     * @brief Close the specified client socket and removes the corresponding
-     * thread from the map of threads.
-     * This function doesn't stop the thread that was handling the given client.
+     * @brief Unregister the given client and close its socket.
+     *
+     * @note Must be called by the reactor watching the connection (or once the
+     * reactors are stopped). The connection must not be used by that reactor
+     * afterwards.
      *
-     * @param clientSockFd The socket of the client to disconnect.
+     * @param conn The client to disconnect.
      */
-    void disconnectClient(int clientSockFd);
+    void disconnectClient(Connection &conn);
 
     /**
      * @brief Disconnect all the connected clients.
-     * This function makes every tread for every client stop.
+     *
+     * @note The reactors must be stopped beforehand.
      */
     void disconnectAllClients();
 
     /**
-     * @brief Thread function to handle a client.
+     * @brief Route the frame that was just read from the given client, or
+     * store it if the destination is offline.
      *
-     * @param arg The client socket cast to a void*.
-     * @return void* Return a pointer to void.
+     * @note With the BLOCK overflow policy, the sender is paused if the
+     * destination is congested.
+     *
+     * @param sender The client that sent the frame.
+     * @param frame The frame (its nickname field holds the destination).
+     *
+     * @return bool False if the sender must be disconnected.
      */
-    static void *handleClientThreadFunc(void *arg);
+    bool handleMessage(Connection &sender, const FrameView &frame);
 
     /**
      * @brief Handle signals.
@@ -104,43 +254,111 @@ class Server {
      * @brief Send a message to the client notifying them that their message is
      * too long.
      *
-     * @param clientSockFd The client's socket.
+     * @param client The client.
      */
-    void sendTooLongMessage(const int clientSockFd);
+    void sendTooLongMessage(Connection &client);
 
     /**
-     * @brief close the server's socket.
+     * @brief close the server's listening sockets.
      */
-    void closeServerSocket();
+    void closeServerSockets();
 
     /**
-     * @brief Find the socket corresponding to the given client.
+     * @brief Find the connection corresponding to the given client.
      *
      * @param nickname The client's nickname.
      *
-     * @return int The socket if it was found; otherwise, -1.
+     * @return shared_ptr<Connection> The connection if it was found;
+     * otherwise, nullptr.
      */
-    int findSocketByName(const string &nickname);
+    shared_ptr<Connection> findConnectionByName(string_view nickname);
 
     /**
-     * @brief Send a message associated with a nickname to the client
-     * associated with the given socket.
+     * @brief Send a message associated with a nickname to the given client,
+     * through the reactor driving that client, in the client's version.
+     *
+     * @note A v1 client gets the fragments of a v2 message as separate
+     * messages.
      *
-     * @param destSockFd The client's sockets.
+     * @param dest The client.
      * @param nickname The nickname.
      * @param message The message.
+     * @param flags The v2 flags (see nicknameFlags).
+     * @param nicknameId The nickname's id, with FRAME_NICKNAME_ID or
+     * FRAME_NICKNAME_BIND.
+     * @param receivedAt When the message was decoded, to measure its latency
+     * (notices from the server are not measured).
      *
      * @return SendMessageReturnVal An enum that holds values for success and
      * the possible errors.
      */
-    SendMessageReturnVal sendMessage(int destSockFd, const string &nickname,
-                                     const string &message);
+    SendMessageReturnVal
+    sendMessage(Connection &dest, string_view nickname, string_view message,
+                uint8_t flags = 0, NicknameId nicknameId = 0,
+                chrono::steady_clock::time_point receivedAt = {});
+
+    /**
+     * @brief Choose how the nickname of a sender is written in a frame
+     * relayed to a client: in full, bound to the sender's id, or as the id
+     * alone once bound.
+     *
+     * @note Only called from the sender's reactor, whose frames reach the
+     * destination in order: a bind always comes before the ids.
+     *
+     * @return uint8_t 0, FRAME_NICKNAME_BIND or FRAME_NICKNAME_ID.
+     */
+    uint8_t nicknameFlags(Connection &sender, const Connection &dest);
+
+    /**
+     * @brief Sum the metrics of the reactors and list the deepest output
+     * queues (from any thread).
+     *
+     * @param format The format of the report.
+     *
+     * @return string The report.
+     */
+    string metricsReport(AdminFormat format);
+
+    /**
+     * @brief Serialize the listening sockets, the registry and the clients,
+     * with the frames they have not been sent yet.
+     *
+     * @note The reactors must be stopped beforehand.
+     */
+    HandoffWriter saveState();
+
+    /**
+     * @brief Take over the state of the previous server, received on
+     * handoffFd_.
+     *
+     * @return bool If the operation succeded
+     */
+    bool takeOver();
+
+    /**
+     * @brief Hand the sockets and the clients over to a new process running
+     * the server's binary again, without closing any connection.
+     *
+     * @note Only with the epoll backend.
+     *
+     * @return bool True once the new server took over (this one must exit);
+     * otherwise, the server is stopped and must be resumed.
+     */
+    bool handOver();
 
     /**
-     * @brief Handle signals received
+     * @brief Serve again after a failed handover.
      *
+     * @return bool If the operation succeded
+     */
+    bool resume();
+
+    /**
+     * @brief Sleep until SIGINT, SIGTERM or SIGUSR2 is received.
+     *
+     * @return bool True if a hot upgrade was asked for (SIGUSR2).
      */
-    void handleSignalsSafely();
+    bool waitForSignal();
 
     /**
      * @brief Initialize signal handler
@@ -149,6 +367,10 @@ class Server {
      */
     bool initSignals();
 
+    friend class Reactor;
+    friend class EpollReactor;
+    friend class UringReactor;
+
   public:
     /**
      * @brief Construct a new Server object.
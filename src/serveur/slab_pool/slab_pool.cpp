@@ -0,0 +1,74 @@
+/**
+ * @file slab_pool.cpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Source file for the pools of fixed-size blocks owned by a thread
+ * @date 2024
+ *
+ */
+
+#include "slab_pool.hpp"
+
+#include <new>
+
+using namespace std;
+
+// ### Constructor ###
+SlabPool::SlabPool(size_t size)
+    : size_(size),
+      stride_((sizeof(Block) + size + alignof(Block) - 1)
+              / alignof(Block) * alignof(Block)) {}
+
+// ### Private methods ###
+
+void SlabPool::refill() {
+    free_ = remoteFree_.exchange(nullptr, memory_order_acquire);
+    if (free_ != nullptr) return;
+
+    // new[] of char is aligned for any fundamental type, Block included
+    slabs_.emplace_back(new char[stride_ * SLAB_BLOCKS]);
+    char *slab = slabs_.back().get();
+    for (size_t i = SLAB_BLOCKS; i-- > 0;) {
+        Block *block = reinterpret_cast<Block *>(slab + i * stride_);
+        block->owner = this;
+        block->next = free_;
+        free_ = block;
+    }
+}
+
+// ### Public methods ###
+
+void SlabPool::bind() { owner_ = pthread_self(); }
+
+size_t SlabPool::size() const { return size_; }
+
+void *SlabPool::allocate(SlabPool *pool, size_t size) {
+    Block *block;
+    if (pool == nullptr or size > pool->size_) {
+        block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+        block->owner = nullptr;
+    } else {
+        if (pool->free_ == nullptr) pool->refill();
+        block = pool->free_;
+        pool->free_ = block->next;
+    }
+    return block + 1;
+}
+
+void SlabPool::release(void *ptr) {
+    if (ptr == nullptr) return;
+    Block *block = static_cast<Block *>(ptr) - 1;
+    SlabPool *pool = block->owner;
+
+    if (pool == nullptr) {
+        ::operator delete(block);
+    } else if (pthread_equal(pthread_self(), pool->owner_)) {
+        block->next = pool->free_;
+        pool->free_ = block;
+    } else {
+        block->next = pool->remoteFree_.load(memory_order_relaxed);
+        while (not pool->remoteFree_.compare_exchange_weak(
+            block->next, block, memory_order_release,
+            memory_order_relaxed)) {
+        }
+    }
+}
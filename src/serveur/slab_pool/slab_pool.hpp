@@ -0,0 +1,100 @@
+/**
+ * @file slab_pool.hpp
+ * @author Ethan Van Ruyskensvelde (Main developer)
+ * @brief Header file for the pools of fixed-size blocks owned by a thread
+ * @date 2024
+ *
+ */
+
+#ifndef SLAB_POOL_HPP
+#define SLAB_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <pthread.h>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t SLAB_BLOCKS = 64; //< Blocks allocated at once when dry
+
+/**
+ * @class SlabPool
+ * @brief Fixed-size blocks allocated by a single thread and released by any.
+ *
+ * @details Blocks are carved out of slabs of SLAB_BLOCKS blocks and recycled
+ * through a free list, so that a warm pool never calls the heap. A block
+ * released by its owner thread goes straight back to the free list; one
+ * released by another thread is pushed onto a lock-free list that the owner
+ * takes back all at once when its own list runs dry.
+ *
+ * @note The slabs are only freed with the pool: every block must be released
+ * before it is destroyed.
+ */
+class SlabPool {
+  private:
+    /**
+     * @brief The header in front of every block.
+     */
+    struct alignas(16) Block {
+        Block *next;     //< In a free list
+        SlabPool *owner; //< nullptr for a block taken from the heap
+    };
+
+    size_t size_;   //< Bytes of a block, past its header
+    size_t stride_; //< Bytes between two blocks of a slab
+    pthread_t owner_ = 0;
+
+    Block *free_ = nullptr;               //< Owner thread only
+    atomic<Block *> remoteFree_ = nullptr; //< Released by other threads
+    vector<unique_ptr<char[]>> slabs_;    //< Owner thread only
+
+    /**
+     * @brief Fill the free list, from the remote one or from a new slab.
+     */
+    void refill();
+
+  public:
+    /**
+     * @brief Construct a new, empty SlabPool object.
+     *
+     * @param size The size of a block.
+     */
+    explicit SlabPool(size_t size);
+
+    SlabPool(const SlabPool &) = delete;
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    /**
+     * @brief Make the calling thread the owner of the pool.
+     */
+    void bind();
+
+    /**
+     * @brief Get the size of a block.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Take a block from a pool, or from the heap if there is no pool
+     * or the block would not fit.
+     *
+     * @note Must be called from the pool's owner thread.
+     *
+     * @param pool The pool, may be nullptr.
+     * @param size The bytes needed.
+     *
+     * @return void* The block (16-byte aligned).
+     */
+    static void *allocate(SlabPool *pool, size_t size);
+
+    /**
+     * @brief Give a block back to its pool (from any thread).
+     *
+     * @param ptr The block, or nullptr.
+     */
+    static void release(void *ptr);
+};
+
+#endif // SLAB_POOL_HPP